@@ -0,0 +1,195 @@
+#include "BridgeMetrics.h"
+#include "Json.h"
+#include "TraceRecorder.h"
+
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+namespace opacity_bridge {
+
+namespace {
+
+constexpr int kMaxCallSites = 96;
+// Local refs an upcall may create before the VM has to grow the frame.
+constexpr jint kUpcallLocalFrameCapacity = 16;
+
+std::atomic<CallSite *> callSites[kMaxCallSites];
+std::atomic<int> callSiteCount{0};
+
+constexpr int kBlockingUpcalls = 3;
+constexpr int kWaitOutcomes = 3;
+constexpr const char *kBlockingUpcallNames[kBlockingUpcalls] = {
+    "eval_js", "cookies_for_current_url", "cookies_for_domain"};
+constexpr const char *kWaitOutcomeNames[kWaitOutcomes] = {
+    "completed", "timed_out", "cancelled"};
+
+struct BlockedWaitStats {
+  std::atomic<uint64_t> outcomes[kWaitOutcomes] = {};
+  LatencyHistogram blocked;
+};
+
+BlockedWaitStats blockedWaits[kBlockingUpcalls];
+
+// Indexed by whether the browser adopted a prewarmed WebView.
+LatencyHistogram prepareToFirstPaint[2];
+
+// Currently attached, and attaches over the process lifetime.
+std::atomic<int64_t> attachedThreads{0};
+std::atomic<int64_t> threadAttaches{0};
+std::atomic<uint64_t> localFrameFailures{0};
+
+long residentSetBytes() {
+  FILE *statm = fopen("/proc/self/statm", "r");
+  if (statm == nullptr) {
+    return -1;
+  }
+  long size = 0, resident = 0;
+  int matched = fscanf(statm, "%ld %ld", &size, &resident);
+  fclose(statm);
+  if (matched != 2) {
+    return -1;
+  }
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+void appendSites(std::string &out, CallDirection direction) {
+  out.push_back('{');
+  bool first = true;
+  int count = callSiteCount.load(std::memory_order_acquire);
+  for (int i = 0; i < count; i++) {
+    CallSite *site = callSites[i].load(std::memory_order_acquire);
+    if (site == nullptr || site->direction != direction) {
+      continue;
+    }
+    if (!first) {
+      out.push_back(',');
+    }
+    first = false;
+    out.push_back('"');
+    out.append(site->name);
+    out.append("\":");
+    site->latency.appendJson(out);
+    out.pop_back();
+    out.push_back(',');
+    appendJsonInteger(out, "in_flight",
+                      site->inFlight.load(std::memory_order_relaxed));
+    out.push_back('}');
+  }
+  out.push_back('}');
+}
+
+void appendBlockedWaits(std::string &out) {
+  out.push_back('{');
+  for (int kind = 0; kind < kBlockingUpcalls; kind++) {
+    if (kind > 0) {
+      out.push_back(',');
+    }
+    const BlockedWaitStats &stats = blockedWaits[kind];
+    out.push_back('"');
+    out.append(kBlockingUpcallNames[kind]);
+    out.append("\":{");
+    for (int outcome = 0; outcome < kWaitOutcomes; outcome++) {
+      appendJsonInteger(out, kWaitOutcomeNames[outcome],
+                        static_cast<long long>(stats.outcomes[outcome].load(
+                            std::memory_order_relaxed)));
+      out.push_back(',');
+    }
+    out.append("\"blocked\":");
+    stats.blocked.appendJson(out);
+    out.push_back('}');
+  }
+  out.push_back('}');
+}
+
+} // namespace
+
+CallSite::CallSite(const char *name, CallDirection direction)
+    : name(name), nameLength(strlen(name)), direction(direction) {
+  int index = callSiteCount.fetch_add(1, std::memory_order_acq_rel);
+  if (index < kMaxCallSites) {
+    callSites[index].store(this, std::memory_order_release);
+  } else {
+    callSiteCount.store(kMaxCallSites, std::memory_order_release);
+  }
+}
+
+CallScope::CallScope(CallSite &site, JNIEnv *env)
+    : site_(site), env_(env), startNanos_(monotonicNanos()) {
+  site_.inFlight.fetch_add(1, std::memory_order_relaxed);
+  if (env_ != nullptr) {
+    framePushed_ = env_->PushLocalFrame(kUpcallLocalFrameCapacity) == JNI_OK;
+    if (!framePushed_) {
+      env_->ExceptionClear();
+      localFrameFailures.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+}
+
+CallScope::~CallScope() {
+  if (framePushed_) {
+    env_->PopLocalFrame(nullptr);
+  }
+  uint64_t endNanos = monotonicNanos();
+  site_.latency.record(endNanos - startNanos_);
+  if (isTracingEnabled()) {
+    traceComplete(site_.direction == CallDirection::Upcall ? "upcall"
+                                                           : "downcall",
+                  site_.name, site_.nameLength, startNanos_, endNanos);
+  }
+  site_.inFlight.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void recordBlockedWait(int kind, int outcome, uint64_t nanos) {
+  if (kind < 0 || kind >= kBlockingUpcalls || outcome < 0 ||
+      outcome >= kWaitOutcomes) {
+    return;
+  }
+  blockedWaits[kind].outcomes[outcome].fetch_add(1, std::memory_order_relaxed);
+  blockedWaits[kind].blocked.record(nanos);
+}
+
+void recordPrepareToFirstPaint(uint64_t nanos, bool warm) {
+  prepareToFirstPaint[warm ? 1 : 0].record(nanos);
+}
+
+void noteThreadAttached() {
+  attachedThreads.fetch_add(1, std::memory_order_relaxed);
+  threadAttaches.fetch_add(1, std::memory_order_relaxed);
+}
+
+void noteThreadDetached() {
+  attachedThreads.fetch_sub(1, std::memory_order_relaxed);
+}
+
+std::string bridgeStatsJson() {
+  std::string out;
+  out.reserve(4096);
+  out.append("{\"upcalls\":");
+  appendSites(out, CallDirection::Upcall);
+  out.append(",\"downcalls\":");
+  appendSites(out, CallDirection::Downcall);
+  out.append(",\"blocked_waits\":");
+  appendBlockedWaits(out);
+  out.append(",\"prepare_to_first_paint\":{\"cold\":");
+  prepareToFirstPaint[0].appendJson(out);
+  out.append(",\"warm\":");
+  prepareToFirstPaint[1].appendJson(out);
+  out.push_back('}');
+  out.push_back(',');
+  appendJsonInteger(out, "attached_threads",
+                    attachedThreads.load(std::memory_order_relaxed));
+  out.push_back(',');
+  appendJsonInteger(out, "thread_attaches",
+                    threadAttaches.load(std::memory_order_relaxed));
+  out.push_back(',');
+  appendJsonInteger(out, "local_frame_failures",
+                    static_cast<long long>(
+                        localFrameFailures.load(std::memory_order_relaxed)));
+  out.push_back(',');
+  appendJsonInteger(out, "rss_bytes", residentSetBytes());
+  out.push_back('}');
+  return out;
+}
+
+} // namespace opacity_bridge
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "BridgeUtil.h"
+#include "LatencyHistogram.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <jni.h>
+#include <string>
+
+namespace opacity_bridge {
+
+enum class CallDirection : uint8_t {
+  // libsdk calling into Kotlin through an extern "C" function.
+  Upcall,
+  // Kotlin calling into libsdk through a JNI entry point.
+  Downcall,
+};
+
+// Per call site counters. Instances are function-local statics created by
+// the UPCALL_SCOPE / DOWNCALL_SCOPE macros and register themselves once.
+struct CallSite {
+  CallSite(const char *name, CallDirection direction);
+
+  const char *name;
+  size_t nameLength;
+  CallDirection direction;
+  std::atomic<int64_t> inFlight{0};
+  LatencyHistogram latency;
+};
+
+// Times one call, records it as a trace span when tracing is on and, for
+// upcalls, wraps it in a JNI local frame. Rust threads attached by GetJniEnv
+// never return to Java, so without the frame every local ref created by an
+// upcall would live until the thread exits.
+class CallScope {
+public:
+  CallScope(CallSite &site, JNIEnv *env);
+  ~CallScope();
+
+  CallScope(const CallScope &) = delete;
+  CallScope &operator=(const CallScope &) = delete;
+
+private:
+  CallSite &site_;
+  JNIEnv *env_;
+  bool framePushed_ = false;
+  uint64_t startNanos_;
+};
+
+// Matches BlockingUpcalls.Kind / BlockingUpcalls.Outcome on the Kotlin side.
+enum class BlockingUpcall : int {
+  EvalJs = 0,
+  CookiesForCurrentUrl = 1,
+  CookiesForDomain = 2,
+};
+
+enum class WaitOutcome : int {
+  Completed = 0,
+  TimedOut = 1,
+  Cancelled = 2,
+};
+
+// Records how long a thread was parked in a blocking upcall and how the wait
+// ended. Out of range values are ignored.
+void recordBlockedWait(int kind, int outcome, uint64_t nanos);
+
+// Records the time from android_prepare_request to the browser's first
+// painted page, split by whether a prewarmed WebView was used.
+void recordPrepareToFirstPaint(uint64_t nanos, bool warm);
+
+// Threads GetJniEnv attached, and detached again when they exit.
+void noteThreadAttached();
+void noteThreadDetached();
+
+// Snapshot of every counter as a JSON object, see OpacityCore.getBridgeStats.
+std::string bridgeStatsJson();
+
+} // namespace opacity_bridge
+
+#define OPACITY_CONCAT_INNER(a, b) a##b
+#define OPACITY_CONCAT(a, b) OPACITY_CONCAT_INNER(a, b)
+
+#define UPCALL_SCOPE(env, name)                                                \
+  static opacity_bridge::CallSite OPACITY_CONCAT(call_site_, __LINE__)(        \
+      name, opacity_bridge::CallDirection::Upcall);                            \
+  opacity_bridge::CallScope OPACITY_CONCAT(call_scope_, __LINE__)(             \
+      OPACITY_CONCAT(call_site_, __LINE__), env)
+
+#define DOWNCALL_SCOPE(name)                                                   \
+  static opacity_bridge::CallSite OPACITY_CONCAT(call_site_, __LINE__)(        \
+      name, opacity_bridge::CallDirection::Downcall);                          \
+  opacity_bridge::CallScope OPACITY_CONCAT(call_scope_, __LINE__)(             \
+      OPACITY_CONCAT(call_site_, __LINE__), nullptr)
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+namespace opacity_bridge {
+
+// CLOCK_MONOTONIC in nanoseconds, the clock behind Kotlin's System.nanoTime().
+inline uint64_t monotonicNanos() {
+  timespec ts{};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull +
+         static_cast<uint64_t>(ts.tv_nsec);
+}
+
+// Raises `target` to `value` if it is lower.
+template <typename T> void atomicMax(std::atomic<T> &target, T value) {
+  T current = target.load(std::memory_order_relaxed);
+  while (value > current &&
+         !target.compare_exchange_weak(current, value,
+                                       std::memory_order_relaxed)) {
+  }
+}
+
+// 64-bit FNV-1a.
+inline uint64_t fnv1a(const char *data, size_t length) {
+  uint64_t hash = 0xCBF29CE484222325ull;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= static_cast<unsigned char>(data[i]);
+    hash *= 0x100000001B3ull;
+  }
+  return hash;
+}
+
+} // namespace opacity_bridge
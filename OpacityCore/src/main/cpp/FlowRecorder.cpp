@@ -0,0 +1,416 @@
+#include "FlowRecorder.h"
+#include "BridgeUtil.h"
+#include "Json.h"
+#include "MemoryAccounting.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace opacity_bridge {
+
+namespace {
+
+std::atomic<bool> recording{false};
+std::mutex recordMutex;
+FILE *recordFile = nullptr;
+uint64_t recordStartNanos = 0;
+uint64_t recordSeq = 0;
+
+struct ReplayEvent {
+  uint64_t offsetNanos;
+  // Upcalls recorded before this event; it waits for that many replays.
+  uint64_t upcallsBefore;
+  std::string json;
+};
+
+std::atomic<bool> replaying{false};
+std::mutex replayMutex;
+std::condition_variable replayProgress;
+std::unordered_map<std::string, std::deque<ReplayedValue>> replayResults;
+std::vector<ReplayEvent> replayEvents;
+uint64_t upcallsReplayed = 0;
+uint64_t replayGeneration = 0;
+std::thread replayThread;
+
+// Live flows and replays exclude each other, see LiveFlowScope.
+std::mutex modeMutex;
+int liveFlows = 0;
+bool replayClaimed = false;
+
+void appendArgs(std::string &line, std::initializer_list<const char *> args) {
+  line.append(",\"args\":[");
+  bool first = true;
+  for (const char *arg : args) {
+    if (!first) {
+      line.push_back(',');
+    }
+    first = false;
+    if (arg == nullptr) {
+      line.append("null");
+    } else {
+      appendJsonString(line, arg);
+    }
+  }
+  line.push_back(']');
+}
+
+// Builds the common prefix of a record and writes it once `finish` has
+// appended the type specific fields.
+template <typename Finish>
+void writeRecord(const char *type, Finish &&finish) {
+  if (!isRecording()) {
+    return;
+  }
+  std::string line;
+  line.reserve(256);
+  uint64_t now = monotonicNanos();
+
+  std::lock_guard<std::mutex> lock(recordMutex);
+  if (recordFile == nullptr) {
+    return;
+  }
+  char prefix[96];
+  snprintf(prefix, sizeof(prefix),
+           "{\"seq\":%llu,\"t_ns\":%llu,\"type\":\"%s\"",
+           static_cast<unsigned long long>(recordSeq++),
+           static_cast<unsigned long long>(now - recordStartNanos), type);
+  line.append(prefix);
+  finish(line);
+  line.append("}\n");
+  fwrite(line.data(), 1, line.size(), recordFile);
+}
+
+void writeUpcall(const char *name, std::initializer_list<const char *> args,
+                 const char *resultJson, const char *resultString) {
+  writeRecord("upcall", [&](std::string &line) {
+    line.append(",\"name\":");
+    appendJsonString(line, name);
+    appendArgs(line, args);
+    if (resultJson != nullptr) {
+      line.append(",\"result\":");
+      line.append(resultJson);
+    } else if (resultString != nullptr) {
+      line.append(",\"result\":");
+      appendJsonString(line, resultString);
+    }
+  });
+}
+
+void runReplayEvents(uint64_t generation, bool originalTiming,
+                     EmitEventFn emit) {
+  uint64_t startNanos = monotonicNanos();
+  uint64_t firstOffset = 0;
+  size_t index = 0;
+  while (true) {
+    std::string json;
+    uint64_t offset;
+    {
+      std::unique_lock<std::mutex> lock(replayMutex);
+      if (index >= replayEvents.size()) {
+        return;
+      }
+      const ReplayEvent &event = replayEvents[index];
+      replayProgress.wait(lock, [&] {
+        return replayGeneration != generation ||
+               upcallsReplayed >= event.upcallsBefore;
+      });
+      if (replayGeneration != generation) {
+        return;
+      }
+      if (index == 0) {
+        firstOffset = event.offsetNanos;
+        startNanos = monotonicNanos();
+      }
+      json = event.json;
+      offset = event.offsetNanos - firstOffset;
+      index++;
+    }
+
+    if (originalTiming) {
+      uint64_t elapsed = monotonicNanos() - startNanos;
+      if (offset > elapsed) {
+        std::unique_lock<std::mutex> lock(replayMutex);
+        replayProgress.wait_for(
+            lock, std::chrono::nanoseconds(offset - elapsed),
+            [&] { return replayGeneration != generation; });
+        if (replayGeneration != generation) {
+          return;
+        }
+      }
+    }
+    emit(json.c_str());
+  }
+}
+
+} // namespace
+
+template <> void ReplayedValue::as<void>() const {}
+
+template <> const char *ReplayedValue::as<const char *>() const {
+  return isNull ? nullptr
+                : handOffString(MEMORY_SITE("replayed_upcall"), text.c_str());
+}
+
+template <> bool ReplayedValue::as<bool>() const {
+  return !isNull && text == "true";
+}
+
+template <> int32_t ReplayedValue::as<int32_t>() const {
+  return isNull ? 0 : static_cast<int32_t>(strtol(text.c_str(), nullptr, 10));
+}
+
+template <> float ReplayedValue::as<float>() const {
+  return isNull ? 0.0f : strtof(text.c_str(), nullptr);
+}
+
+bool RecordedFlow::matches(int32_t replayedStatus,
+                           std::string_view replayedPayload) const {
+  if (replayedStatus != status) {
+    return false;
+  }
+  JsonValue recordedJson, replayedJson;
+  if (!parseJson(payload, recordedJson) ||
+      !parseJson(replayedPayload, replayedJson)) {
+    return payload == replayedPayload;
+  }
+  std::string recordedCanonical, replayedCanonical;
+  appendCanonicalJson(recordedCanonical, recordedJson);
+  appendCanonicalJson(replayedCanonical, replayedJson);
+  return recordedCanonical == replayedCanonical;
+}
+
+bool startRecording(const char *path) {
+  // Recordings hold secure storage values in the clear; owner-only.
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    return false;
+  }
+  FILE *file = fdopen(fd, "w");
+  if (file == nullptr) {
+    close(fd);
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(recordMutex);
+  if (recordFile != nullptr) {
+    fclose(recordFile);
+  }
+  recordFile = file;
+  recordStartNanos = monotonicNanos();
+  recordSeq = 0;
+  recording.store(true, std::memory_order_release);
+  return true;
+}
+
+void stopRecording() {
+  recording.store(false, std::memory_order_release);
+  std::lock_guard<std::mutex> lock(recordMutex);
+  if (recordFile != nullptr) {
+    fclose(recordFile);
+    recordFile = nullptr;
+  }
+}
+
+bool isRecording() { return recording.load(std::memory_order_acquire); }
+
+void recordUpcall(const char *name, std::initializer_list<const char *> args) {
+  writeUpcall(name, args, nullptr, nullptr);
+}
+
+void recordStringUpcall(const char *name,
+                        std::initializer_list<const char *> args,
+                        const char *result) {
+  writeUpcall(name, args, result == nullptr ? "null" : nullptr, result);
+}
+
+void recordNumberUpcall(const char *name,
+                        std::initializer_list<const char *> args,
+                        double result) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.9g", result);
+  writeUpcall(name, args, buf, nullptr);
+}
+
+void recordBoolUpcall(const char *name, std::initializer_list<const char *> args,
+                      bool result) {
+  writeUpcall(name, args, result ? "true" : "false", nullptr);
+}
+
+void recordWebviewEvent(std::string_view json) {
+  writeRecord("event", [&](std::string &line) {
+    line.append(",\"payload\":");
+    appendJsonString(line, json);
+  });
+}
+
+void recordFlow(const char *name, const char *params, int32_t status,
+                std::string_view payload) {
+  writeRecord("flow", [&](std::string &line) {
+    char buf[32];
+    line.append(",\"name\":");
+    appendJsonString(line, name);
+    line.append(",\"params\":");
+    if (params == nullptr) {
+      line.append("null");
+    } else {
+      appendJsonString(line, params);
+    }
+    snprintf(buf, sizeof(buf), ",\"status\":%d", status);
+    line.append(buf);
+    line.append(",\"result\":");
+    appendJsonString(line, payload);
+  });
+}
+
+ReplayStart startReplay(const char *path, bool originalTiming,
+                        EmitEventFn emit, RecordedFlow &flow) {
+  std::ifstream file(path);
+  if (!file) {
+    return ReplayStart::NoFlow;
+  }
+
+  std::unordered_map<std::string, std::deque<ReplayedValue>> results;
+  std::vector<ReplayEvent> events;
+  bool haveFlow = false;
+  uint64_t upcalls = 0;
+  std::string line;
+  while (std::getline(file, line)) {
+    JsonValue record;
+    if (!parseJson(line, record)) {
+      continue;
+    }
+    const JsonValue *type = record.find("type");
+    const JsonValue *offset = record.find("t_ns");
+    if (type == nullptr || type->type != JsonValue::Type::String) {
+      continue;
+    }
+
+    if (type->text == "upcall") {
+      const JsonValue *name = record.find("name");
+      if (name == nullptr) {
+        continue;
+      }
+      ReplayedValue value;
+      const JsonValue *result = record.find("result");
+      if (result != nullptr && result->type != JsonValue::Type::Null) {
+        value.isNull = false;
+        value.text = result->type == JsonValue::Type::Bool
+                         ? (result->boolean ? "true" : "false")
+                         : result->text;
+      }
+      results[name->text].push_back(std::move(value));
+      upcalls++;
+    } else if (type->text == "event") {
+      const JsonValue *payload = record.find("payload");
+      if (payload == nullptr) {
+        continue;
+      }
+      events.push_back(
+          {offset != nullptr ? strtoull(offset->text.c_str(), nullptr, 10) : 0,
+           upcalls, payload->text});
+    } else if (type->text == "flow" && !haveFlow) {
+      const JsonValue *name = record.find("name");
+      const JsonValue *params = record.find("params");
+      const JsonValue *status = record.find("status");
+      const JsonValue *result = record.find("result");
+      if (name == nullptr) {
+        continue;
+      }
+      haveFlow = true;
+      flow.name = name->text;
+      flow.hasParams =
+          params != nullptr && params->type == JsonValue::Type::String;
+      flow.params = flow.hasParams ? params->text : "";
+      flow.status = status != nullptr ? static_cast<int32_t>(strtol(
+                                            status->text.c_str(), nullptr, 10))
+                                      : 0;
+      flow.payload = result != nullptr ? result->text : "";
+    }
+  }
+  if (!haveFlow) {
+    return ReplayStart::NoFlow;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(modeMutex);
+    if (liveFlows > 0 || replayClaimed) {
+      return ReplayStart::Busy;
+    }
+    replayClaimed = true;
+  }
+  uint64_t generation;
+  {
+    std::lock_guard<std::mutex> lock(replayMutex);
+    replayResults = std::move(results);
+    replayEvents = std::move(events);
+    upcallsReplayed = 0;
+    generation = ++replayGeneration;
+  }
+  replaying.store(true, std::memory_order_release);
+  replayThread = std::thread(runReplayEvents, generation, originalTiming, emit);
+  return ReplayStart::Started;
+}
+
+void stopReplay() {
+  replaying.store(false, std::memory_order_release);
+  {
+    std::lock_guard<std::mutex> lock(replayMutex);
+    replayGeneration++;
+    replayResults.clear();
+  }
+  replayProgress.notify_all();
+  if (replayThread.joinable()) {
+    replayThread.join();
+  }
+  std::lock_guard<std::mutex> lock(modeMutex);
+  replayClaimed = false;
+}
+
+bool isReplaying() { return replaying.load(std::memory_order_acquire); }
+
+bool replayUpcall(const char *name, ReplayedValue &out) {
+  if (!isReplaying()) {
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lock(replayMutex);
+    auto queue = replayResults.find(name);
+    if (queue != replayResults.end() && !queue->second.empty()) {
+      out = std::move(queue->second.front());
+      queue->second.pop_front();
+    } else {
+      out = ReplayedValue();
+    }
+    upcallsReplayed++;
+  }
+  replayProgress.notify_all();
+  return true;
+}
+
+LiveFlowScope::LiveFlowScope() {
+  std::lock_guard<std::mutex> lock(modeMutex);
+  admitted_ = !replayClaimed;
+  if (admitted_) {
+    liveFlows++;
+  }
+}
+
+LiveFlowScope::~LiveFlowScope() {
+  if (admitted_) {
+    std::lock_guard<std::mutex> lock(modeMutex);
+    liveFlows--;
+  }
+}
+
+} // namespace opacity_bridge
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+
+namespace opacity_bridge {
+
+// Record-and-replay of webview flows.
+//
+// While recording, every upcall (name, arguments, result), every webview
+// event handed to libsdk and every opacity_get is appended to a JSON Lines
+// file, one object per line with a "t_ns" offset from the start of the
+// recording and a global "seq". Recordings contain secure storage values and
+// page contents, so treat them as secrets.
+//
+// While replaying, upcalls are answered from the recording instead of
+// calling into Kotlin, matched by upcall name in recorded order, and the
+// recorded webview events are emitted to libsdk from a background thread.
+// Each event waits until the upcalls recorded before it have been replayed,
+// then goes out immediately or after the originally recorded gap.
+//
+// Replay mode is process-wide, so it would also answer the upcalls of any
+// live flow. Live flows and replays exclude each other: a replay is refused
+// while a flow runs, and a flow is refused while a replay runs.
+
+// A recorded upcall result. `isNull` distinguishes a null string result
+// from an empty one.
+struct ReplayedValue {
+  bool isNull = true;
+  std::string text;
+
+  // The result as the upcall's return type. Strings are copies handed off to
+  // libsdk, or nullptr for a null result.
+  template <typename T> T as() const;
+};
+
+template <> void ReplayedValue::as<void>() const;
+template <> const char *ReplayedValue::as<const char *>() const;
+template <> bool ReplayedValue::as<bool>() const;
+template <> int32_t ReplayedValue::as<int32_t>() const;
+template <> float ReplayedValue::as<float>() const;
+
+// Returns the recorded result from the enclosing upcall while replaying.
+// `Result` is the upcall's return type.
+#define REPLAY_UPCALL(name, Result)                                            \
+  do {                                                                         \
+    opacity_bridge::ReplayedValue replayed;                                    \
+    if (opacity_bridge::replayUpcall(name, replayed)) {                        \
+      return replayed.as<Result>();                                            \
+    }                                                                          \
+  } while (0)
+
+// The opacity_get captured in a recording and its outcome.
+struct RecordedFlow {
+  std::string name;
+  bool hasParams = false;
+  std::string params;
+  int32_t status = 0;
+  std::string payload;
+
+  // Whether a replayed run ended the same way: same status and, compared as
+  // canonical JSON, the same payload.
+  bool matches(int32_t replayedStatus, std::string_view replayedPayload) const;
+};
+
+bool startRecording(const char *path);
+void stopRecording();
+bool isRecording();
+
+// No-ops unless recording. `args` may contain nullptr for null strings.
+void recordUpcall(const char *name, std::initializer_list<const char *> args);
+void recordStringUpcall(const char *name,
+                        std::initializer_list<const char *> args,
+                        const char *result);
+void recordNumberUpcall(const char *name,
+                        std::initializer_list<const char *> args, double result);
+void recordBoolUpcall(const char *name, std::initializer_list<const char *> args,
+                      bool result);
+void recordWebviewEvent(std::string_view json);
+void recordFlow(const char *name, const char *params, int32_t status,
+                std::string_view payload);
+
+using EmitEventFn = void (*)(const char *json);
+
+enum class ReplayStart { Started, NoFlow, Busy };
+
+// Loads a recording and switches upcalls to replay. Fills `flow` with the
+// first recorded opacity_get for the caller to run. Returns NoFlow if the
+// file could not be read or holds no flow, and Busy while a live flow or
+// another replay runs; only after Started must the caller call stopReplay.
+ReplayStart startReplay(const char *path, bool originalTiming,
+                        EmitEventFn emit, RecordedFlow &flow);
+void stopReplay();
+bool isReplaying();
+
+// Returns true and fills `out` when replay is active. Upcalls with no
+// recorded result left replay as null/zero rather than reaching Kotlin.
+bool replayUpcall(const char *name, ReplayedValue &out);
+
+// Held around a live opacity_get. Not admitted while a replay runs, in which
+// case the flow must not execute.
+class LiveFlowScope {
+public:
+  LiveFlowScope();
+  ~LiveFlowScope();
+
+  LiveFlowScope(const LiveFlowScope &) = delete;
+  LiveFlowScope &operator=(const LiveFlowScope &) = delete;
+
+  bool admitted() const { return admitted_; }
+
+private:
+  bool admitted_;
+};
+
+} // namespace opacity_bridge
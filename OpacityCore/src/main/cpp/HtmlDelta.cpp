@@ -0,0 +1,311 @@
+#include "HtmlDelta.h"
+#include "BridgeUtil.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace opacity_bridge {
+
+namespace {
+
+// Chunks average ~2 KiB, which keeps small DOM edits to one or two chunks
+// without paying a field header per handful of bytes.
+constexpr size_t kMinChunkSize = 512;
+constexpr size_t kMaxChunkSize = 16 * 1024;
+constexpr uint64_t kChunkBoundaryMask = 0x7FFull << 53;
+// Snapshots are kept for the most recently navigated URLs only.
+constexpr size_t kMaxSnapshots = 8;
+
+constexpr uint64_t splitMix64(uint64_t &state) {
+  uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+constexpr std::array<uint64_t, 256> makeGearTable() {
+  std::array<uint64_t, 256> table{};
+  uint64_t state = 0x4F70616369747921ull;
+  for (auto &entry : table) {
+    entry = splitMix64(state);
+  }
+  return table;
+}
+
+constexpr std::array<uint64_t, 256> kGear = makeGearTable();
+
+struct Chunk {
+  uint64_t hash;
+  uint32_t offset;
+  uint32_t length;
+};
+
+std::vector<Chunk> chunkHtml(std::string_view html) {
+  std::vector<Chunk> chunks;
+  chunks.reserve(html.size() / 2048 + 1);
+  size_t start = 0;
+  while (start < html.size()) {
+    size_t remaining = html.size() - start;
+    size_t length = remaining;
+    if (remaining > kMinChunkSize) {
+      size_t limit = std::min(remaining, kMaxChunkSize);
+      uint64_t rolling = 0;
+      length = limit;
+      for (size_t i = kMinChunkSize; i < limit; i++) {
+        rolling = (rolling << 1) +
+                  kGear[static_cast<unsigned char>(html[start + i])];
+        if ((rolling & kChunkBoundaryMask) == 0) {
+          length = i + 1;
+          break;
+        }
+      }
+    }
+    chunks.push_back({fnv1a(html.data() + start, length),
+                      static_cast<uint32_t>(start),
+                      static_cast<uint32_t>(length)});
+    start += length;
+  }
+  return chunks;
+}
+
+struct Snapshot {
+  uint64_t id = 0;
+  uint64_t lastUsed = 0;
+  std::string html;
+  std::unordered_map<uint64_t, Chunk> chunksByHash;
+};
+
+std::atomic<bool> deltaEnabled{false};
+
+std::mutex snapshotsMutex;
+std::unordered_map<std::string, Snapshot> snapshots;
+uint64_t nextSnapshotId = 0;
+uint64_t useClock = 0;
+
+std::atomic<uint64_t> statEvents{0};
+std::atomic<uint64_t> statHtmlBytes{0};
+std::atomic<uint64_t> statSentBytes{0};
+std::atomic<uint64_t> statChunks{0};
+std::atomic<uint64_t> statReusedChunks{0};
+
+std::string encodeU64(uint64_t value) {
+  std::string out(8, '\0');
+  for (int i = 0; i < 8; i++) {
+    out[i] = static_cast<char>((value >> (8 * i)) & 0xFF);
+  }
+  return out;
+}
+
+std::string encodeRange(uint32_t offset, uint32_t length) {
+  std::string out(8, '\0');
+  for (int i = 0; i < 4; i++) {
+    out[i] = static_cast<char>((offset >> (8 * i)) & 0xFF);
+    out[4 + i] = static_cast<char>((length >> (8 * i)) & 0xFF);
+  }
+  return out;
+}
+
+void evictLeastRecentlyUsed() {
+  while (snapshots.size() > kMaxSnapshots) {
+    auto oldest = snapshots.begin();
+    for (auto it = snapshots.begin(); it != snapshots.end(); ++it) {
+      if (it->second.lastUsed < oldest->second.lastUsed) {
+        oldest = it;
+      }
+    }
+    snapshots.erase(oldest);
+  }
+}
+
+const Snapshot *mostRecentSnapshotLocked() {
+  const Snapshot *latest = nullptr;
+  for (const auto &entry : snapshots) {
+    if (entry.second.id != 0 &&
+        (latest == nullptr || entry.second.lastUsed > latest->lastUsed)) {
+      latest = &entry.second;
+    }
+  }
+  return latest;
+}
+
+size_t retainedBytesLocked() {
+  size_t retained = 0;
+  for (const auto &entry : snapshots) {
+    retained += entry.second.html.capacity() +
+                entry.second.chunksByHash.size() * sizeof(Chunk);
+  }
+  return retained;
+}
+
+// Appends HtmlChunkRef / HtmlChunk fields describing `html` relative to
+// `base`, merging runs of adjacent chunks into a single field.
+void appendDelta(std::string &out, std::string_view html,
+                 const std::vector<Chunk> &chunks, const Snapshot &base) {
+  bool haveRef = false;
+  uint32_t refOffset = 0, refLength = 0;
+  bool haveLiteral = false;
+  uint32_t literalOffset = 0, literalLength = 0;
+
+  auto flushRef = [&] {
+    if (haveRef) {
+      appendWebviewEventField(out, WebviewEventTag::HtmlChunkRef,
+                              encodeRange(refOffset, refLength));
+      haveRef = false;
+    }
+  };
+  auto flushLiteral = [&] {
+    if (haveLiteral) {
+      appendWebviewEventField(out, WebviewEventTag::HtmlChunk,
+                              html.substr(literalOffset, literalLength));
+      haveLiteral = false;
+    }
+  };
+
+  for (const Chunk &chunk : chunks) {
+    auto match = base.chunksByHash.find(chunk.hash);
+    bool reused = match != base.chunksByHash.end() &&
+                  match->second.length == chunk.length &&
+                  memcmp(base.html.data() + match->second.offset,
+                         html.data() + chunk.offset, chunk.length) == 0;
+    if (reused) {
+      statReusedChunks.fetch_add(1, std::memory_order_relaxed);
+      flushLiteral();
+      if (haveRef && refOffset + refLength == match->second.offset) {
+        refLength += chunk.length;
+      } else {
+        flushRef();
+        haveRef = true;
+        refOffset = match->second.offset;
+        refLength = chunk.length;
+      }
+    } else {
+      flushRef();
+      if (haveLiteral) {
+        literalLength += chunk.length;
+      } else {
+        haveLiteral = true;
+        literalOffset = chunk.offset;
+        literalLength = chunk.length;
+      }
+    }
+  }
+  flushRef();
+  flushLiteral();
+}
+
+} // namespace
+
+bool isHtmlDeltaEnabled() {
+  return deltaEnabled.load(std::memory_order_relaxed);
+}
+
+void setHtmlDeltaEnabled(bool enabled) {
+  deltaEnabled.store(enabled, std::memory_order_relaxed);
+  if (!enabled) {
+    clearHtmlSnapshots();
+  }
+}
+
+bool rewriteNavigationFrame(const WebviewEvent &event, std::string &out) {
+  if (!isHtmlDeltaEnabled() || event.kind != WebviewEventKind::Navigation) {
+    return false;
+  }
+
+  std::string_view url, html;
+  bool hasHtml = false;
+  for (const auto &field : event.fields) {
+    if (field.tag == WebviewEventTag::Url) {
+      url = field.value;
+    } else if (field.tag == WebviewEventTag::HtmlBody) {
+      html = field.value;
+      hasHtml = true;
+    }
+  }
+  if (!hasHtml || url.empty() || html.size() > UINT32_MAX) {
+    return false;
+  }
+
+  std::vector<Chunk> chunks = chunkHtml(html);
+
+  beginWebviewEventFrame(out, event.kind);
+  out.reserve(html.size() / 4 + 256);
+  for (const auto &field : event.fields) {
+    if (field.tag != WebviewEventTag::HtmlBody) {
+      appendWebviewEventField(out, field.tag, field.value);
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(snapshotsMutex);
+  uint64_t id = ++nextSnapshotId;
+  appendWebviewEventField(out, WebviewEventTag::HtmlSnapshotId, encodeU64(id));
+
+  // Single-page apps change the URL with pushState while most of the
+  // document stays put, so a new URL is diffed against the page navigated
+  // to last.
+  Snapshot &snapshot = snapshots[std::string(url)];
+  const Snapshot *base =
+      snapshot.id != 0 ? &snapshot : mostRecentSnapshotLocked();
+  if (base != nullptr) {
+    appendWebviewEventField(out, WebviewEventTag::HtmlBaseSnapshotId,
+                            encodeU64(base->id));
+    appendDelta(out, html, chunks, *base);
+  } else {
+    appendWebviewEventField(out, WebviewEventTag::HtmlBody, html);
+  }
+
+  snapshot.id = id;
+  snapshot.lastUsed = ++useClock;
+  snapshot.html.assign(html.data(), html.size());
+  snapshot.chunksByHash.clear();
+  snapshot.chunksByHash.reserve(chunks.size());
+  for (const Chunk &chunk : chunks) {
+    snapshot.chunksByHash.emplace(chunk.hash, chunk);
+  }
+  evictLeastRecentlyUsed();
+
+  statEvents.fetch_add(1, std::memory_order_relaxed);
+  statHtmlBytes.fetch_add(html.size(), std::memory_order_relaxed);
+  statSentBytes.fetch_add(out.size(), std::memory_order_relaxed);
+  statChunks.fetch_add(chunks.size(), std::memory_order_relaxed);
+  return true;
+}
+
+size_t htmlSnapshotBytes() {
+  std::lock_guard<std::mutex> lock(snapshotsMutex);
+  return retainedBytesLocked();
+}
+
+size_t clearHtmlSnapshots() {
+  std::lock_guard<std::mutex> lock(snapshotsMutex);
+  size_t released = retainedBytesLocked();
+  snapshots.clear();
+  return released;
+}
+
+std::string htmlDeltaStatsJson() {
+  size_t retained;
+  {
+    std::lock_guard<std::mutex> lock(snapshotsMutex);
+    retained = retainedBytesLocked();
+  }
+
+  char buf[256];
+  snprintf(buf, sizeof(buf),
+           "{\"events\":%llu,\"html_bytes\":%llu,\"sent_bytes\":%llu,"
+           "\"chunks\":%llu,\"reused_chunks\":%llu,\"retained_bytes\":%zu}",
+           static_cast<unsigned long long>(statEvents.load()),
+           static_cast<unsigned long long>(statHtmlBytes.load()),
+           static_cast<unsigned long long>(statSentBytes.load()),
+           static_cast<unsigned long long>(statChunks.load()),
+           static_cast<unsigned long long>(statReusedChunks.load()),
+           retained);
+  return buf;
+}
+
+} // namespace opacity_bridge
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "WebviewEventFrame.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace opacity_bridge {
+
+// Opt-in HTML delta mode for navigation frames.
+//
+// Each html_body is split into content-defined chunks with a gear rolling
+// hash, so an edit only changes the chunks around it. The last snapshot per
+// URL is kept, and later navigation frames are rewritten to carry
+// HtmlSnapshotId, HtmlBaseSnapshotId and a sequence of HtmlChunkRef (byte
+// ranges of the base snapshot) and HtmlChunk (new bytes) fields in place of
+// HtmlBody. The base is the snapshot of the same URL, or the most recent one
+// for a URL not seen before. Concatenating the parts in order rebuilds the
+// page. The first page of a session is sent whole, tagged with its id.
+//
+// Frames only reach libsdk in this form through emit_webview_event_v2; with
+// a libsdk that lacks it the bridge refuses to enable delta mode.
+bool isHtmlDeltaEnabled();
+void setHtmlDeltaEnabled(bool enabled);
+
+// Returns true and fills `out` with the rewritten frame when `event` is a
+// navigation event carrying an HTML body and delta mode is on.
+bool rewriteNavigationFrame(const WebviewEvent &event, std::string &out);
+
+// Bytes held by retained snapshots.
+size_t htmlSnapshotBytes();
+// Drops every retained snapshot and returns the bytes released.
+size_t clearHtmlSnapshots();
+
+// {"events":..,"html_bytes":..,"sent_bytes":..,"chunks":..,"reused_chunks":..,
+//  "retained_bytes":..}
+std::string htmlDeltaStatsJson();
+
+} // namespace opacity_bridge
@@ -0,0 +1,370 @@
+#include "Json.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+namespace opacity_bridge {
+
+namespace {
+
+// Deep enough for any flow params or overlay definition, shallow enough that
+// a hostile document can't exhaust the stack.
+constexpr int kMaxDepth = 64;
+
+class JsonParser {
+public:
+  explicit JsonParser(std::string_view input) : input_(input) {}
+
+  bool parseDocument(JsonValue &out) {
+    if (!parseValue(out, 0)) {
+      return false;
+    }
+    skipWhitespace();
+    return pos_ == input_.size();
+  }
+
+private:
+  std::string_view input_;
+  size_t pos_ = 0;
+
+  void skipWhitespace() {
+    while (pos_ < input_.size() &&
+           (input_[pos_] == ' ' || input_[pos_] == '\n' ||
+            input_[pos_] == '\r' || input_[pos_] == '\t')) {
+      pos_++;
+    }
+  }
+
+  bool consume(char expected) {
+    skipWhitespace();
+    if (pos_ < input_.size() && input_[pos_] == expected) {
+      pos_++;
+      return true;
+    }
+    return false;
+  }
+
+  bool consumeLiteral(std::string_view literal) {
+    if (input_.substr(pos_, literal.size()) != literal) {
+      return false;
+    }
+    pos_ += literal.size();
+    return true;
+  }
+
+  bool parseValue(JsonValue &out, int depth) {
+    if (depth > kMaxDepth) {
+      return false;
+    }
+    skipWhitespace();
+    if (pos_ >= input_.size()) {
+      return false;
+    }
+
+    char c = input_[pos_];
+    switch (c) {
+    case '{':
+      return parseObject(out, depth);
+    case '[':
+      return parseArray(out, depth);
+    case '"':
+      out.type = JsonValue::Type::String;
+      return parseString(out.text);
+    case 't':
+      out.type = JsonValue::Type::Bool;
+      out.boolean = true;
+      return consumeLiteral("true");
+    case 'f':
+      out.type = JsonValue::Type::Bool;
+      out.boolean = false;
+      return consumeLiteral("false");
+    case 'n':
+      out.type = JsonValue::Type::Null;
+      return consumeLiteral("null");
+    default:
+      return parseNumber(out);
+    }
+  }
+
+  bool parseObject(JsonValue &out, int depth) {
+    out.type = JsonValue::Type::Object;
+    pos_++;
+    if (consume('}')) {
+      return true;
+    }
+    do {
+      skipWhitespace();
+      std::string key;
+      if (pos_ >= input_.size() || input_[pos_] != '"' || !parseString(key)) {
+        return false;
+      }
+      if (!consume(':')) {
+        return false;
+      }
+      out.members.emplace_back(std::move(key), JsonValue());
+      if (!parseValue(out.members.back().second, depth + 1)) {
+        return false;
+      }
+    } while (consume(','));
+    return consume('}');
+  }
+
+  bool parseArray(JsonValue &out, int depth) {
+    out.type = JsonValue::Type::Array;
+    pos_++;
+    if (consume(']')) {
+      return true;
+    }
+    do {
+      out.items.emplace_back();
+      if (!parseValue(out.items.back(), depth + 1)) {
+        return false;
+      }
+    } while (consume(','));
+    return consume(']');
+  }
+
+  bool parseNumber(JsonValue &out) {
+    size_t start = pos_;
+    if (pos_ < input_.size() && input_[pos_] == '-') {
+      pos_++;
+    }
+    size_t digits = pos_;
+    while (pos_ < input_.size() &&
+           ((input_[pos_] >= '0' && input_[pos_] <= '9') ||
+            input_[pos_] == '.' || input_[pos_] == 'e' ||
+            input_[pos_] == 'E' || input_[pos_] == '+' ||
+            input_[pos_] == '-')) {
+      pos_++;
+    }
+    if (pos_ == digits) {
+      return false;
+    }
+    out.type = JsonValue::Type::Number;
+    out.text.assign(input_.substr(start, pos_ - start));
+    return true;
+  }
+
+  bool parseHex4(uint32_t &out) {
+    if (input_.size() - pos_ < 4) {
+      return false;
+    }
+    out = 0;
+    for (int i = 0; i < 4; i++) {
+      char c = input_[pos_++];
+      out <<= 4;
+      if (c >= '0' && c <= '9') {
+        out |= c - '0';
+      } else if (c >= 'a' && c <= 'f') {
+        out |= c - 'a' + 10;
+      } else if (c >= 'A' && c <= 'F') {
+        out |= c - 'A' + 10;
+      } else {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static void appendUtf8(std::string &out, uint32_t codepoint) {
+    if (codepoint < 0x80) {
+      out.push_back(static_cast<char>(codepoint));
+    } else if (codepoint < 0x800) {
+      out.push_back(static_cast<char>(0xC0 | (codepoint >> 6)));
+      out.push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+    } else if (codepoint < 0x10000) {
+      out.push_back(static_cast<char>(0xE0 | (codepoint >> 12)));
+      out.push_back(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F)));
+      out.push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+    } else {
+      out.push_back(static_cast<char>(0xF0 | (codepoint >> 18)));
+      out.push_back(static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F)));
+      out.push_back(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F)));
+      out.push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+    }
+  }
+
+  bool parseString(std::string &out) {
+    pos_++; // opening quote
+    while (pos_ < input_.size()) {
+      char c = input_[pos_++];
+      if (c == '"') {
+        return true;
+      }
+      if (c != '\\') {
+        out.push_back(c);
+        continue;
+      }
+      if (pos_ >= input_.size()) {
+        return false;
+      }
+      char escape = input_[pos_++];
+      switch (escape) {
+      case '"':
+      case '\\':
+      case '/':
+        out.push_back(escape);
+        break;
+      case 'b':
+        out.push_back('\b');
+        break;
+      case 'f':
+        out.push_back('\f');
+        break;
+      case 'n':
+        out.push_back('\n');
+        break;
+      case 'r':
+        out.push_back('\r');
+        break;
+      case 't':
+        out.push_back('\t');
+        break;
+      case 'u': {
+        uint32_t codepoint;
+        if (!parseHex4(codepoint)) {
+          return false;
+        }
+        if (codepoint >= 0xD800 && codepoint < 0xDC00 &&
+            input_.substr(pos_, 2) == "\\u") {
+          size_t save = pos_;
+          pos_ += 2;
+          uint32_t low;
+          if (parseHex4(low) && low >= 0xDC00 && low < 0xE000) {
+            codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+          } else {
+            pos_ = save;
+          }
+        }
+        appendUtf8(out, codepoint);
+        break;
+      }
+      default:
+        return false;
+      }
+    }
+    return false;
+  }
+};
+
+} // namespace
+
+const JsonValue *JsonValue::find(std::string_view key) const {
+  for (const auto &member : members) {
+    if (member.first == key) {
+      return &member.second;
+    }
+  }
+  return nullptr;
+}
+
+bool parseJson(std::string_view input, JsonValue &out) {
+  out = JsonValue();
+  return JsonParser(input).parseDocument(out);
+}
+
+void appendCanonicalJson(std::string &out, const JsonValue &value) {
+  switch (value.type) {
+  case JsonValue::Type::Null:
+    out.append("null");
+    break;
+  case JsonValue::Type::Bool:
+    out.append(value.boolean ? "true" : "false");
+    break;
+  case JsonValue::Type::Number:
+    out.append(value.text);
+    break;
+  case JsonValue::Type::String:
+    appendJsonString(out, value.text);
+    break;
+  case JsonValue::Type::Array:
+    out.push_back('[');
+    for (size_t i = 0; i < value.items.size(); i++) {
+      if (i > 0) {
+        out.push_back(',');
+      }
+      appendCanonicalJson(out, value.items[i]);
+    }
+    out.push_back(']');
+    break;
+  case JsonValue::Type::Object: {
+    std::vector<const std::pair<std::string, JsonValue> *> sorted;
+    sorted.reserve(value.members.size());
+    for (const auto &member : value.members) {
+      sorted.push_back(&member);
+    }
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [](const auto *a, const auto *b) {
+                       return a->first < b->first;
+                     });
+    out.push_back('{');
+    for (size_t i = 0; i < sorted.size(); i++) {
+      if (i > 0) {
+        out.push_back(',');
+      }
+      appendJsonString(out, sorted[i]->first);
+      out.push_back(':');
+      appendCanonicalJson(out, sorted[i]->second);
+    }
+    out.push_back('}');
+    break;
+  }
+  }
+}
+
+void appendJsonString(std::string &out, std::string_view value) {
+  static const char kHex[] = "0123456789abcdef";
+
+  out.reserve(out.size() + value.size() + 2);
+  out.push_back('"');
+  for (char c : value) {
+    switch (c) {
+    case '"':
+      out.append("\\\"");
+      break;
+    case '\\':
+      out.append("\\\\");
+      break;
+    case '\n':
+      out.append("\\n");
+      break;
+    case '\r':
+      out.append("\\r");
+      break;
+    case '\t':
+      out.append("\\t");
+      break;
+    case '\b':
+      out.append("\\b");
+      break;
+    case '\f':
+      out.append("\\f");
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+        out.append("\\u00");
+        out.push_back(kHex[(c >> 4) & 0xF]);
+        out.push_back(kHex[c & 0xF]);
+      } else {
+        out.push_back(c);
+      }
+    }
+  }
+  out.push_back('"');
+}
+
+void appendJsonInteger(std::string &out, const char *key, long long value) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "\"%s\":%lld", key, value);
+  out.append(buf);
+}
+
+void appendJsonNumber(std::string &out, const char *key, double value) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "\"%s\":%.3f", key, value);
+  out.append(buf);
+}
+
+} // namespace opacity_bridge
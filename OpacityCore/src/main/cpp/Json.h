@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace opacity_bridge {
+
+// Minimal JSON DOM for the few places the bridge has to look inside a
+// payload. Numbers keep their source text so they round-trip unchanged.
+struct JsonValue {
+  enum class Type { Null, Bool, Number, String, Array, Object };
+
+  Type type = Type::Null;
+  bool boolean = false;
+  // Unescaped UTF-8 for strings, source text for numbers.
+  std::string text;
+  std::vector<JsonValue> items;
+  // In document order; duplicate keys are kept.
+  std::vector<std::pair<std::string, JsonValue>> members;
+
+  // First member named `key`, or nullptr. Only meaningful for objects.
+  const JsonValue *find(std::string_view key) const;
+};
+
+// Parses a complete document. Returns false on malformed input or trailing
+// garbage.
+bool parseJson(std::string_view input, JsonValue &out);
+
+// Serializes `value` without whitespace and with object members sorted by
+// key, so equal documents produce identical bytes.
+void appendCanonicalJson(std::string &out, const JsonValue &value);
+
+// Appends `value` to `out` as a quoted JSON string literal. Input is expected
+// to be UTF-8; multi-byte sequences are copied through unchanged.
+void appendJsonString(std::string &out, std::string_view value);
+
+// Append a `"key":value` member; `key` must not need escaping. Numbers are
+// printed with three decimals.
+void appendJsonInteger(std::string &out, const char *key, long long value);
+void appendJsonNumber(std::string &out, const char *key, double value);
+
+} // namespace opacity_bridge
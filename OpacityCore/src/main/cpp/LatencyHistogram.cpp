@@ -0,0 +1,61 @@
+#include "LatencyHistogram.h"
+#include "BridgeUtil.h"
+#include "Json.h"
+
+#include <algorithm>
+
+namespace opacity_bridge {
+
+namespace {
+
+int bucketFor(uint64_t nanos) {
+  int bucket = 0;
+  while (nanos > 1 && bucket < LatencyHistogram::kBuckets - 1) {
+    nanos >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+} // namespace
+
+void LatencyHistogram::record(uint64_t nanos) {
+  buckets_[bucketFor(nanos)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  totalNanos_.fetch_add(nanos, std::memory_order_relaxed);
+  atomicMax(maxNanos_, nanos);
+}
+
+uint64_t LatencyHistogram::percentileNanos(double percentile) const {
+  uint64_t total = count();
+  if (total == 0) {
+    return 0;
+  }
+  auto rank = static_cast<uint64_t>(total * percentile / 100.0);
+  uint64_t seen = 0;
+  for (int i = 0; i < kBuckets; i++) {
+    seen += buckets_[i].load(std::memory_order_relaxed);
+    if (seen > rank) {
+      return std::min(1ull << (i + 1), static_cast<unsigned long long>(maxNanos()));
+    }
+  }
+  return maxNanos();
+}
+
+void LatencyHistogram::appendJson(std::string &out) const {
+  uint64_t calls = count();
+  out.push_back('{');
+  appendJsonInteger(out, "count", static_cast<long long>(calls));
+  out.push_back(',');
+  appendJsonNumber(out, "mean_us",
+                   calls == 0 ? 0.0 : totalNanos() / 1000.0 / calls);
+  out.push_back(',');
+  appendJsonNumber(out, "p50_us", percentileNanos(50) / 1000.0);
+  out.push_back(',');
+  appendJsonNumber(out, "p99_us", percentileNanos(99) / 1000.0);
+  out.push_back(',');
+  appendJsonNumber(out, "max_us", maxNanos() / 1000.0);
+  out.push_back('}');
+}
+
+} // namespace opacity_bridge
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace opacity_bridge {
+
+// Log2-bucketed latency histogram. Recording is a couple of relaxed atomic
+// adds so it is safe to use from any thread on every call.
+class LatencyHistogram {
+public:
+  static constexpr int kBuckets = 40;
+
+  void record(uint64_t nanos);
+  uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+  uint64_t totalNanos() const {
+    return totalNanos_.load(std::memory_order_relaxed);
+  }
+  uint64_t maxNanos() const { return maxNanos_.load(std::memory_order_relaxed); }
+  // Upper bound of the bucket holding the given percentile (0-100), capped
+  // at the largest value seen.
+  uint64_t percentileNanos(double percentile) const;
+  // Appends {"count":..,"mean_us":..,"p50_us":..,"p99_us":..,"max_us":..}.
+  void appendJson(std::string &out) const;
+
+private:
+  std::atomic<uint64_t> buckets_[kBuckets] = {};
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> totalNanos_{0};
+  std::atomic<uint64_t> maxNanos_{0};
+};
+
+} // namespace opacity_bridge
@@ -0,0 +1,237 @@
+#include "MemoryAccounting.h"
+#include "BridgeUtil.h"
+#include "HtmlDelta.h"
+#include "Json.h"
+#include "RequestCoalescer.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+#include <mutex>
+
+namespace opacity_bridge {
+
+namespace {
+
+constexpr int kMaxMemorySites = 96;
+
+// ComponentCallbacks2.TRIM_MEMORY_* values.
+constexpr int kTrimRunningModerate = 5;
+constexpr int kTrimRunningLow = 10;
+constexpr int kTrimRunningCritical = 15;
+constexpr int kTrimUiHidden = 20;
+constexpr int kTrimBackground = 40;
+constexpr int kTrimModerate = 60;
+
+// M_PURGE from bionic's malloc.h.
+constexpr int kMallocPurge = -101;
+
+std::atomic<MemorySite *> memorySites[kMaxMemorySites];
+std::atomic<int> memorySiteCount{0};
+
+std::atomic<uint64_t> budgetBytes{0};
+std::atomic<uint64_t> trims{0};
+std::atomic<uint64_t> releasedBytes{0};
+
+int64_t liveSiteBytes() {
+  int64_t total = 0;
+  int count = memorySiteCount.load(std::memory_order_acquire);
+  for (int i = 0; i < count && i < kMaxMemorySites; i++) {
+    MemorySite *site = memorySites[i].load(std::memory_order_acquire);
+    if (site != nullptr) {
+      total += site->liveBytes.load(std::memory_order_relaxed);
+    }
+  }
+  return total;
+}
+
+// Hands freed pages back to the kernel instead of keeping them in the
+// allocator's arenas. mallopt is only declared from API 26, above minSdk,
+// and M_PURGE only understood from 28, so it is looked up at run time.
+void purgeAllocator() {
+#ifdef __ANDROID__
+  using MalloptFn = int (*)(int, int);
+  static auto mallopt =
+      reinterpret_cast<MalloptFn>(dlsym(RTLD_DEFAULT, "mallopt"));
+  if (mallopt != nullptr) {
+    mallopt(kMallocPurge, 0);
+  }
+#endif
+}
+
+} // namespace
+
+MemorySite::MemorySite(const char *name) : name(name) {}
+
+MemorySite &memorySite(const char *name) {
+  // Only taken the first time each call site runs.
+  static std::mutex registryMutex;
+  std::lock_guard<std::mutex> lock(registryMutex);
+  int count = memorySiteCount.load(std::memory_order_acquire);
+  for (int i = 0; i < count; i++) {
+    MemorySite *site = memorySites[i].load(std::memory_order_acquire);
+    if (strcmp(site->name, name) == 0) {
+      return *site;
+    }
+  }
+  auto *site = new MemorySite(name);
+  if (count < kMaxMemorySites) {
+    memorySites[count].store(site, std::memory_order_release);
+    memorySiteCount.store(count + 1, std::memory_order_release);
+  }
+  return *site;
+}
+
+void noteAllocated(MemorySite &site, size_t bytes) {
+  auto signedBytes = static_cast<int64_t>(bytes);
+  site.allocations.fetch_add(1, std::memory_order_relaxed);
+  site.allocatedBytes.fetch_add(bytes, std::memory_order_relaxed);
+  site.liveCount.fetch_add(1, std::memory_order_relaxed);
+  atomicMax(site.highWaterBytes,
+            site.liveBytes.fetch_add(signedBytes, std::memory_order_relaxed) +
+                signedBytes);
+}
+
+void noteReleased(MemorySite &site, size_t bytes) {
+  site.liveCount.fetch_sub(1, std::memory_order_relaxed);
+  site.liveBytes.fetch_sub(static_cast<int64_t>(bytes),
+                           std::memory_order_relaxed);
+}
+
+char *handOffString(MemorySite &site, const char *value) {
+  size_t bytes = strlen(value) + 1;
+  auto *copy = static_cast<char *>(malloc(bytes));
+  if (copy == nullptr) {
+    return nullptr;
+  }
+  memcpy(copy, value, bytes);
+  site.allocations.fetch_add(1, std::memory_order_relaxed);
+  site.allocatedBytes.fetch_add(bytes, std::memory_order_relaxed);
+  site.handedOffBytes.fetch_add(bytes, std::memory_order_relaxed);
+  return copy;
+}
+
+ScopedUtfChars::ScopedUtfChars(MemorySite &site, JNIEnv *env, jstring value)
+    : site_(site), env_(env), value_(value) {
+  if (value_ == nullptr) {
+    return;
+  }
+  chars_ = env_->GetStringUTFChars(value_, nullptr);
+  if (chars_ != nullptr) {
+    bytes_ = strlen(chars_) + 1;
+    noteAllocated(site_, bytes_);
+  }
+}
+
+ScopedUtfChars::~ScopedUtfChars() {
+  if (chars_ != nullptr) {
+    env_->ReleaseStringUTFChars(value_, chars_);
+    noteReleased(site_, bytes_);
+  }
+}
+
+size_t bridgeMemoryBytes() {
+  int64_t live = std::max<int64_t>(liveSiteBytes(), 0);
+  return static_cast<size_t>(live) + htmlSnapshotBytes() + flowCacheBytes();
+}
+
+void setMemoryBudget(size_t bytes) {
+  budgetBytes.store(bytes, std::memory_order_relaxed);
+  enforceMemoryBudget();
+}
+
+void enforceMemoryBudget() {
+  uint64_t budget = budgetBytes.load(std::memory_order_relaxed);
+  if (budget == 0) {
+    return;
+  }
+  // Pinned strings go away on their own once their calls return; only
+  // trim when there are caches to give back.
+  size_t cached = htmlSnapshotBytes() + flowCacheBytes();
+  int64_t live = std::max<int64_t>(liveSiteBytes(), 0);
+  if (cached > 0 && static_cast<uint64_t>(live) + cached > budget) {
+    trimBridgeMemory(kTrimRunningCritical);
+  }
+}
+
+size_t trimBridgeMemory(int level) {
+  size_t released = 0;
+  // Snapshots only save bandwidth on the next navigation of a URL, so they
+  // are the first to go.
+  if (level >= kTrimRunningModerate) {
+    released += clearHtmlSnapshots();
+  }
+  // UI_HIDDEN is not memory pressure; cached flow results stay useful when
+  // the app comes back.
+  if ((level >= kTrimRunningLow && level < kTrimUiHidden) ||
+      level >= kTrimBackground) {
+    released += clearFlowCache();
+  }
+  if (level == kTrimRunningCritical || level >= kTrimModerate) {
+    purgeAllocator();
+  }
+  trims.fetch_add(1, std::memory_order_relaxed);
+  releasedBytes.fetch_add(released, std::memory_order_relaxed);
+  return released;
+}
+
+std::string memoryStatsJson() {
+  size_t snapshotBytes = htmlSnapshotBytes();
+  size_t cacheBytes = flowCacheBytes();
+  int64_t live = liveSiteBytes();
+
+  std::string out = "{";
+  appendJsonInteger(out, "budget_bytes",
+                    static_cast<long long>(budgetBytes.load()));
+  out.push_back(',');
+  appendJsonInteger(out, "total_bytes",
+                    static_cast<long long>(live + snapshotBytes + cacheBytes));
+  out.push_back(',');
+  appendJsonInteger(out, "html_snapshot_bytes",
+                    static_cast<long long>(snapshotBytes));
+  out.push_back(',');
+  appendJsonInteger(out, "flow_cache_bytes",
+                    static_cast<long long>(cacheBytes));
+  out.push_back(',');
+  appendJsonInteger(out, "trims", static_cast<long long>(trims.load()));
+  out.push_back(',');
+  appendJsonInteger(out, "released_bytes",
+                    static_cast<long long>(releasedBytes.load()));
+  out.append(",\"sites\":{");
+
+  int count = memorySiteCount.load(std::memory_order_acquire);
+  bool first = true;
+  for (int i = 0; i < count && i < kMaxMemorySites; i++) {
+    MemorySite *site = memorySites[i].load(std::memory_order_acquire);
+    if (site == nullptr) {
+      continue;
+    }
+    if (!first) {
+      out.push_back(',');
+    }
+    first = false;
+    out.push_back('"');
+    out.append(site->name);
+    out.append("\":{");
+    appendJsonInteger(out, "live_bytes", site->liveBytes.load());
+    out.push_back(',');
+    appendJsonInteger(out, "live_count", site->liveCount.load());
+    out.push_back(',');
+    appendJsonInteger(out, "high_water_bytes", site->highWaterBytes.load());
+    out.push_back(',');
+    appendJsonInteger(out, "allocations",
+                      static_cast<long long>(site->allocations.load()));
+    out.push_back(',');
+    appendJsonInteger(out, "allocated_bytes",
+                      static_cast<long long>(site->allocatedBytes.load()));
+    out.push_back(',');
+    appendJsonInteger(out, "handed_off_bytes",
+                      static_cast<long long>(site->handedOffBytes.load()));
+    out.push_back('}');
+  }
+  out.append("}}");
+  return out;
+}
+
+} // namespace opacity_bridge
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <jni.h>
+#include <string>
+
+namespace opacity_bridge {
+
+// Native memory accounting for the bridge.
+//
+// Allocations made in OpacityCore.cpp are tagged with a MemorySite, looked
+// up once per call site by MEMORY_SITE, which keeps live bytes and count,
+// the high-water mark of live bytes and lifetime totals. Call sites using
+// the same name share one MemorySite. Strings
+// returned to libsdk are counted as handed off: libsdk frees them, so they
+// never show up as live here. Buffers the bridge builds and frees within a
+// call, such as rendered event JSON and flow results on their way to
+// Kotlin, are charged while the call runs. Retained HTML snapshots and
+// cached flow results are reported next to the sites and count towards the
+// budget. Allocations inside libsdk and the JVM are not seen.
+struct MemorySite {
+  explicit MemorySite(const char *name);
+
+  const char *name;
+  std::atomic<int64_t> liveBytes{0};
+  std::atomic<int64_t> liveCount{0};
+  std::atomic<int64_t> highWaterBytes{0};
+  std::atomic<uint64_t> allocations{0};
+  std::atomic<uint64_t> allocatedBytes{0};
+  std::atomic<uint64_t> handedOffBytes{0};
+};
+
+// Site registered under `name`, created on first use. `name` must be a
+// string literal.
+MemorySite &memorySite(const char *name);
+
+void noteAllocated(MemorySite &site, size_t bytes);
+void noteReleased(MemorySite &site, size_t bytes);
+
+// malloc'd copy of `value` for libsdk to own and free.
+char *handOffString(MemorySite &site, const char *value);
+
+// Pins the modified UTF-8 chars of a Java string until destruction and
+// accounts for them at `site`. A null jstring gives a null c_str().
+class ScopedUtfChars {
+public:
+  ScopedUtfChars(MemorySite &site, JNIEnv *env, jstring value);
+  ~ScopedUtfChars();
+
+  ScopedUtfChars(const ScopedUtfChars &) = delete;
+  ScopedUtfChars &operator=(const ScopedUtfChars &) = delete;
+
+  const char *c_str() const { return chars_; }
+
+private:
+  MemorySite &site_;
+  JNIEnv *env_;
+  jstring value_;
+  const char *chars_ = nullptr;
+  size_t bytes_ = 0;
+};
+
+// Charges `bytes` to `site` as live until destruction.
+class ScopedMemoryCharge {
+public:
+  ScopedMemoryCharge(MemorySite &site, size_t bytes)
+      : site_(site), bytes_(bytes) {
+    noteAllocated(site_, bytes_);
+  }
+  ~ScopedMemoryCharge() { noteReleased(site_, bytes_); }
+
+  ScopedMemoryCharge(const ScopedMemoryCharge &) = delete;
+  ScopedMemoryCharge &operator=(const ScopedMemoryCharge &) = delete;
+
+private:
+  MemorySite &site_;
+  size_t bytes_;
+};
+
+// Live tracked bytes plus retained snapshots and cached results.
+size_t bridgeMemoryBytes();
+
+// Caps bridgeMemoryBytes(); 0 removes the cap.
+void setMemoryBudget(size_t bytes);
+// Trims as for TRIM_MEMORY_RUNNING_CRITICAL when over budget. Must be called
+// without any bridge lock held.
+void enforceMemoryBudget();
+
+// Releases caches according to a ComponentCallbacks2.TRIM_MEMORY_* level
+// and returns the bytes released.
+size_t trimBridgeMemory(int level);
+
+// {"budget_bytes":..,"total_bytes":..,"html_snapshot_bytes":..,
+//  "flow_cache_bytes":..,"trims":..,"released_bytes":..,"sites":{..}}
+std::string memoryStatsJson();
+
+} // namespace opacity_bridge
+
+#define MEMORY_SITE(name)                                                      \
+  ([]() -> opacity_bridge::MemorySite & {                                      \
+    static opacity_bridge::MemorySite &site =                                 \
+        opacity_bridge::memorySite(name);                                      \
+    return site;                                                               \
+  }())
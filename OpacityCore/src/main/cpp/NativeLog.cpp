@@ -0,0 +1,380 @@
+#include "NativeLog.h"
+#include "BridgeUtil.h"
+
+#include <android/log.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace opacity_bridge {
+
+namespace {
+
+constexpr const char *kLogTag = "Opacity SDK";
+constexpr size_t kRecordsPerThread = 128;
+constexpr size_t kSiteCapacity = 32;
+constexpr size_t kMessageCapacity = 464;
+constexpr size_t kSiteSlots = 64;
+// How long the drain thread lets records pile up after a wakeup, so a burst
+// is written in one pass.
+constexpr auto kDrainBatchDelay = std::chrono::milliseconds(20);
+
+struct LogRecord {
+  uint64_t nanos;
+  LogLevel level;
+  char site[kSiteCapacity];
+  char message[kMessageCapacity];
+};
+
+// Single producer (the owning thread), single consumer (the drain thread).
+// A ring outlives its thread: it is released when the thread exits and
+// handed to a new thread once the drain thread has emptied it.
+struct ThreadLogRing {
+  std::atomic<long> tid{0};
+  std::atomic<uint64_t> head{0};
+  std::atomic<uint64_t> tail{0};
+  LogRecord records[kRecordsPerThread];
+};
+
+struct LogSite {
+  // FNV-1a of the site name, 0 while the slot is free.
+  std::atomic<uint64_t> hash{0};
+  std::atomic<bool> named{false};
+  char name[kSiteCapacity];
+  std::atomic<uint64_t> windowSecond{0};
+  std::atomic<uint32_t> count{0};
+  std::atomic<uint32_t> suppressed{0};
+};
+
+std::atomic<bool> debugEnabled{false};
+std::atomic<bool> drainStarted{false};
+// Set by the first record after a drain; only that writer takes drainMutex
+// to wake the drain thread. Both are leaked: the detached drain thread is
+// still waiting on them when static destructors run at exit.
+std::atomic<bool> drainPending{false};
+std::mutex &drainMutex = *new std::mutex();
+std::condition_variable &drainWakeup = *new std::condition_variable();
+
+std::atomic<uint64_t> statWritten{0};
+std::atomic<uint64_t> statDropped{0};
+std::atomic<uint64_t> statRateLimited{0};
+
+// Every ring made so far, and those released by exited threads. The mutex
+// is only taken when a thread takes or releases its ring and by the drain
+// thread to copy the list. Leaked so that threads exiting during static
+// destruction can still release their ring.
+std::mutex &ringsMutex = *new std::mutex();
+std::vector<ThreadLogRing *> &rings = *new std::vector<ThreadLogRing *>();
+std::vector<ThreadLogRing *> &freeRings = *new std::vector<ThreadLogRing *>();
+
+LogSite sites[kSiteSlots];
+
+std::mutex sinkMutex;
+FILE *sinkFile = nullptr;
+
+void drainLoop();
+
+void ensureDrainThread() {
+  if (drainStarted.load(std::memory_order_acquire) ||
+      drainStarted.exchange(true)) {
+    return;
+  }
+  std::thread(drainLoop).detach();
+}
+
+void signalDrain() {
+  if (drainPending.load(std::memory_order_relaxed) ||
+      drainPending.exchange(true, std::memory_order_acq_rel)) {
+    return;
+  }
+  ensureDrainThread();
+  std::lock_guard<std::mutex> lock(drainMutex);
+  drainWakeup.notify_one();
+}
+
+// Releases the thread's ring when the thread exits.
+struct RingOwner {
+  ThreadLogRing *ring = nullptr;
+
+  ~RingOwner() {
+    if (ring != nullptr) {
+      std::lock_guard<std::mutex> lock(ringsMutex);
+      freeRings.push_back(ring);
+    }
+  }
+};
+
+ThreadLogRing *acquireRing() {
+  std::lock_guard<std::mutex> lock(ringsMutex);
+  // A released ring is only reused once drained, or its remaining records
+  // would be written under the new thread's id.
+  for (auto it = freeRings.begin(); it != freeRings.end(); ++it) {
+    ThreadLogRing *ring = *it;
+    if (ring->tail.load(std::memory_order_acquire) ==
+        ring->head.load(std::memory_order_relaxed)) {
+      freeRings.erase(it);
+      return ring;
+    }
+  }
+  ThreadLogRing *ring = new ThreadLogRing();
+  rings.push_back(ring);
+  return ring;
+}
+
+ThreadLogRing *currentThreadRing() {
+  thread_local RingOwner owner;
+  if (owner.ring == nullptr) {
+    owner.ring = acquireRing();
+    owner.ring->tid.store(syscall(SYS_gettid), std::memory_order_relaxed);
+  }
+  return owner.ring;
+}
+
+size_t copyTruncated(char *dst, size_t capacity, const char *src,
+                     size_t length) {
+  size_t n = length < capacity - 1 ? length : capacity - 1;
+  memcpy(dst, src, n);
+  dst[n] = '\0';
+  return n;
+}
+
+LogSite *findSite(const char *site) {
+  uint64_t hash = fnv1a(site, strlen(site));
+  if (hash == 0) {
+    hash = 1;
+  }
+
+  for (size_t i = 0; i < kSiteSlots; i++) {
+    LogSite &slot = sites[(hash + i) % kSiteSlots];
+    uint64_t current = slot.hash.load(std::memory_order_acquire);
+    if (current == hash) {
+      return &slot;
+    }
+    if (current == 0 &&
+        slot.hash.compare_exchange_strong(current, hash,
+                                          std::memory_order_acq_rel)) {
+      copyTruncated(slot.name, kSiteCapacity, site, strlen(site));
+      slot.named.store(true, std::memory_order_release);
+      return &slot;
+    }
+    if (current == hash) {
+      return &slot;
+    }
+  }
+  // Table full: sites beyond kSiteSlots are not rate limited.
+  return nullptr;
+}
+
+bool admitSite(const char *site, uint64_t nanos) {
+  LogSite *slot = findSite(site);
+  if (slot == nullptr) {
+    return true;
+  }
+  uint64_t second = nanos / 1000000000ull;
+  uint64_t window = slot->windowSecond.load(std::memory_order_relaxed);
+  if (window != second &&
+      slot->windowSecond.compare_exchange_strong(window, second,
+                                                 std::memory_order_relaxed)) {
+    slot->count.store(0, std::memory_order_relaxed);
+  }
+  if (slot->count.fetch_add(1, std::memory_order_relaxed) < kLogSiteBurst) {
+    return true;
+  }
+  if (slot->suppressed.fetch_add(1, std::memory_order_relaxed) == 0) {
+    // The summary line is written by the drain thread.
+    signalDrain();
+  }
+  statRateLimited.fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
+
+// Reserves the next slot of the calling thread's ring, or returns nullptr
+// if the site is over its rate or the ring is full.
+LogRecord *beginRecord(LogLevel level, const char *site, uint64_t nanos) {
+  if (!admitSite(site, nanos)) {
+    return nullptr;
+  }
+  ThreadLogRing *ring = currentThreadRing();
+  uint64_t head = ring->head.load(std::memory_order_relaxed);
+  if (head - ring->tail.load(std::memory_order_acquire) >= kRecordsPerThread) {
+    statDropped.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  LogRecord &record = ring->records[head % kRecordsPerThread];
+  record.nanos = nanos;
+  record.level = level;
+  copyTruncated(record.site, kSiteCapacity, site, strlen(site));
+  return &record;
+}
+
+void commitRecord() {
+  ThreadLogRing *ring = currentThreadRing();
+  ring->head.fetch_add(1, std::memory_order_release);
+  statWritten.fetch_add(1, std::memory_order_relaxed);
+  signalDrain();
+}
+
+char levelLetter(LogLevel level) {
+  switch (level) {
+  case LogLevel::Debug:
+    return 'D';
+  case LogLevel::Info:
+    return 'I';
+  case LogLevel::Warn:
+    return 'W';
+  case LogLevel::Error:
+    return 'E';
+  }
+  return '?';
+}
+
+void emitLine(LogLevel level, long tid, uint64_t nanos, const char *site,
+              const char *message) {
+  std::lock_guard<std::mutex> lock(sinkMutex);
+  if (sinkFile != nullptr) {
+    fprintf(sinkFile, "%llu.%06llu %ld %c %s: %s\n",
+            static_cast<unsigned long long>(nanos / 1000000000ull),
+            static_cast<unsigned long long>(nanos % 1000000000ull / 1000),
+            tid, levelLetter(level), site, message);
+    return;
+  }
+  __android_log_print(static_cast<int>(level), kLogTag, "[%s] %s", site,
+                      message);
+}
+
+void drainOnce() {
+  std::vector<ThreadLogRing *> snapshot;
+  {
+    std::lock_guard<std::mutex> lock(ringsMutex);
+    snapshot = rings;
+  }
+
+  for (ThreadLogRing *ring : snapshot) {
+    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    for (; tail != head; tail++) {
+      const LogRecord &record = ring->records[tail % kRecordsPerThread];
+      emitLine(record.level, ring->tid.load(std::memory_order_relaxed),
+               record.nanos, record.site, record.message);
+    }
+    ring->tail.store(tail, std::memory_order_release);
+  }
+
+  for (LogSite &slot : sites) {
+    if (!slot.named.load(std::memory_order_acquire) ||
+        slot.suppressed.load(std::memory_order_relaxed) == 0) {
+      continue;
+    }
+    uint32_t suppressed = slot.suppressed.exchange(0);
+    char message[64];
+    snprintf(message, sizeof(message), "%u records suppressed by rate limit",
+             suppressed);
+    emitLine(LogLevel::Warn, 0, monotonicNanos(), slot.name, message);
+  }
+
+  std::lock_guard<std::mutex> lock(sinkMutex);
+  if (sinkFile != nullptr) {
+    fflush(sinkFile);
+  }
+}
+
+void drainLoop() {
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(drainMutex);
+      drainWakeup.wait(lock, [] {
+        return drainPending.load(std::memory_order_acquire);
+      });
+    }
+    std::this_thread::sleep_for(kDrainBatchDelay);
+    // Cleared before draining so a record committed during the pass signals
+    // again instead of waiting for the next one.
+    drainPending.store(false, std::memory_order_release);
+    drainOnce();
+  }
+}
+
+} // namespace
+
+void setDebugLogsEnabled(bool enabled) {
+  debugEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool isLogLevelEnabled(LogLevel level) {
+  return level != LogLevel::Debug ||
+         debugEnabled.load(std::memory_order_relaxed);
+}
+
+void writeLog(LogLevel level, const char *site, const char *message,
+              size_t messageLength) {
+  if (!isLogLevelEnabled(level)) {
+    return;
+  }
+  LogRecord *record = beginRecord(level, site, monotonicNanos());
+  if (record == nullptr) {
+    return;
+  }
+  copyTruncated(record->message, kMessageCapacity, message, messageLength);
+  commitRecord();
+}
+
+void writeLogf(LogLevel level, const char *site, const char *format, ...) {
+  if (!isLogLevelEnabled(level)) {
+    return;
+  }
+  LogRecord *record = beginRecord(level, site, monotonicNanos());
+  if (record == nullptr) {
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  if (vsnprintf(record->message, kMessageCapacity, format, args) < 0) {
+    record->message[0] = '\0';
+  }
+  va_end(args);
+  commitRecord();
+}
+
+bool setLogFile(const char *path) {
+  FILE *file = nullptr;
+  if (path != nullptr) {
+    file = fopen(path, "a");
+    if (file == nullptr) {
+      return false;
+    }
+  }
+  std::lock_guard<std::mutex> lock(sinkMutex);
+  if (sinkFile != nullptr) {
+    fclose(sinkFile);
+  }
+  sinkFile = file;
+  return true;
+}
+
+std::string logStatsJson() {
+  size_t threads;
+  {
+    std::lock_guard<std::mutex> lock(ringsMutex);
+    threads = rings.size();
+  }
+
+  char buf[192];
+  snprintf(buf, sizeof(buf),
+           "{\"written\":%llu,\"dropped\":%llu,\"rate_limited\":%llu,"
+           "\"threads\":%zu,\"debug\":%s}",
+           static_cast<unsigned long long>(statWritten.load()),
+           static_cast<unsigned long long>(statDropped.load()),
+           static_cast<unsigned long long>(statRateLimited.load()), threads,
+           debugEnabled.load() ? "true" : "false");
+  return buf;
+}
+
+} // namespace opacity_bridge
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace opacity_bridge {
+
+// Asynchronous logger for the bridge and the WebView callbacks.
+//
+// Callers format into a fixed-size record in their own thread's ring and
+// return; a background thread, started by the first record and asleep
+// while there is nothing to write, drains the rings to logcat or to a file.
+// Logging never waits: when a ring is full the record is dropped and
+// counted. Debug records are only kept while the current flow has browser
+// debug logs enabled, and each call site is limited to kLogSiteBurst
+// records per second, with the excess reported as a summary line.
+enum class LogLevel : uint8_t {
+  // Values match android_LogPriority.
+  Debug = 3,
+  Info = 4,
+  Warn = 5,
+  Error = 6,
+};
+
+constexpr uint32_t kLogSiteBurst = 20;
+
+// Whether Debug records are kept. Refreshed from
+// is_browser_debug_logs_enabled when a browser flow starts and cleared when
+// it closes.
+void setDebugLogsEnabled(bool enabled);
+
+// Cheap pre-check so callers can skip formatting filtered records.
+bool isLogLevelEnabled(LogLevel level);
+
+// `site` names the call site for rate limiting and is copied, truncated to
+// 31 bytes. `message` is truncated to fit the record.
+void writeLog(LogLevel level, const char *site, const char *message,
+              size_t messageLength);
+void writeLogf(LogLevel level, const char *site, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+// Sends drained records to `path` (appending) instead of logcat, or back to
+// logcat when `path` is nullptr. Returns false if the file can't be opened.
+bool setLogFile(const char *path);
+
+// JSON counters: records written, dropped on full rings, rate limited.
+std::string logStatsJson();
+
+} // namespace opacity_bridge
@@ -1,6 +1,20 @@
+#include "BridgeMetrics.h"
+#include "FlowRecorder.h"
+#include "HtmlDelta.h"
+#include "Json.h"
+#include "MemoryAccounting.h"
+#include "NativeLog.h"
+#include "OverlayPageMatcher.h"
+#include "RequestCoalescer.h"
+#include "RequestScheduler.h"
+#include "TraceRecorder.h"
+#include "WebviewEventFrame.h"
 #include "sdk.h"
 #include <android/log.h>
 #include <arpa/inet.h>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
 #include <future>
 #include <ifaddrs.h>
 #include <jni.h>
@@ -8,39 +22,41 @@
 #include <string>
 #include <sys/types.h>
 #include <thread>
+#include <vector>
 
 JavaVM *java_vm;
 jobject java_object;
+// Set once opacity_init is entered; libsdk may read the environment after.
+static std::atomic<bool> sdk_init_started{false};
+
+static pthread_key_t detach_key;
+static pthread_once_t detach_key_once = PTHREAD_ONCE_INIT;
+static bool detach_key_created = false;
+
+// Thread Specific Data destructor: runs when a thread GetJniEnv attached
+// exits and detaches it from the VM.
+static void DetachExitingThread(void *ts_env) {
+  if (ts_env != nullptr) {
+    java_vm->DetachCurrentThread();
+    opacity_bridge::noteThreadDetached();
+  }
+}
 
 void DeferThreadDetach(JNIEnv *env) {
-  static pthread_key_t thread_key;
-
-  // Set up a Thread Specific Data key, and a callback that
-  // will be executed when a thread is destroyed.
-  // This is only done once, across all threads, and the value
-  // associated with the key for any given thread will initially
-  // be NULL.
-  // static auto run_once = [] {
-  //   const auto err = pthread_key_create(&thread_key, [](void *ts_env) {
-  //     if (ts_env) {
-  //       java_vm->DetachCurrentThread();
-  //     }
-  //   });
-  //   if (err) {
-  //     // Failed to create TSD key. Throw an exception if you want to.
-  //   }
-  //   return 0;
-  // }();
-
-  // For the callback to actually be executed when a thread exits
-  // we need to associate a non-NULL value with the key on that thread.
-  // We can use the JNIEnv* as that value.
-  const auto ts_env = pthread_getspecific(thread_key);
-  if (!ts_env) {
-    if (pthread_setspecific(thread_key, env)) {
-      // Failed to set thread-specific value for key. Throw an exception if you
-      // want to.
-    }
+  // The key is created once, across all threads, and the value associated
+  // with it for any given thread is initially NULL.
+  pthread_once(&detach_key_once, [] {
+    detach_key_created =
+        pthread_key_create(&detach_key, DetachExitingThread) == 0;
+  });
+  if (!detach_key_created) {
+    return;
+  }
+
+  // For the destructor to actually run when the thread exits, the key needs
+  // a non-NULL value on that thread. We can use the JNIEnv* as that value.
+  if (pthread_getspecific(detach_key) == nullptr) {
+    pthread_setspecific(detach_key, env);
   }
 }
 
@@ -54,6 +70,7 @@ JNIEnv *GetJniEnv() {
   auto get_env_result = java_vm->GetEnv((void **)&env, JNI_VERSION_1_6);
   if (get_env_result == JNI_EDETACHED) {
     if (java_vm->AttachCurrentThread(&env, nullptr) == JNI_OK) {
+      opacity_bridge::noteThreadAttached();
       DeferThreadDetach(env);
     } else {
       // Failed to attach thread. Throw an exception if you want to.
@@ -64,6 +81,13 @@ JNIEnv *GetJniEnv() {
   return env;
 }
 
+// Upcall prologue: answers from the recording while replaying, otherwise
+// attaches the thread as `env` and opens the upcall's metrics scope.
+#define BEGIN_UPCALL(name, Result)                                             \
+  REPLAY_UPCALL(name, Result);                                                 \
+  JNIEnv *env = GetJniEnv();                                                   \
+  UPCALL_SCOPE(env, name)
+
 extern "C" JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *jvm, void *reserved) {
   java_vm = jvm;
   return JNI_VERSION_1_6;
@@ -73,6 +97,65 @@ jstring string2jstring(JNIEnv *env, const char *str) {
   return (*env).NewStringUTF(str);
 }
 
+// Copies a Java string into a malloc'd C string handed off to libsdk and
+// releases the JNI chars and local ref right away.
+static char *copyJString(opacity_bridge::MemorySite &site, JNIEnv *env,
+                         jstring value) {
+  char *copy;
+  {
+    opacity_bridge::ScopedUtfChars chars(site, env, value);
+    copy = opacity_bridge::handOffString(site, chars.c_str());
+  }
+  env->DeleteLocalRef(value);
+  return copy;
+}
+
+// Copies a Java string into `buffer` without allocating, truncating values
+// that don't fit. Returns the number of bytes written, excluding the NUL.
+static size_t copyJStringInto(JNIEnv *env, jstring value, char *buffer,
+                              size_t capacity) {
+  jsize chars = env->GetStringLength(value);
+  jsize utfLength = env->GetStringUTFLength(value);
+  if (static_cast<size_t>(utfLength) >= capacity) {
+    // A UTF-16 unit encodes to at most 3 bytes of modified UTF-8. The region
+    // copy writes no terminator, so the buffer is zeroed to find its end.
+    chars = static_cast<jsize>((capacity - 1) / 3);
+    utfLength = -1;
+    memset(buffer, 0, capacity);
+  }
+  env->GetStringUTFRegion(value, 0, chars, buffer);
+  size_t written = utfLength >= 0 ? static_cast<size_t>(utfLength)
+                                  : strnlen(buffer, capacity - 1);
+  buffer[written] = '\0';
+  return written;
+}
+
+// Returns a string upcall result to libsdk: a copy of `value`, or of
+// `fallback` when Kotlin returned null (nullptr if `fallback` is null).
+// The copy is accounted and recorded under the site's name.
+static const char *upcallString(opacity_bridge::MemorySite &site,
+                                std::initializer_list<const char *> args,
+                                JNIEnv *env, jstring value,
+                                const char *fallback) {
+  char *result = nullptr;
+  if (value != nullptr) {
+    result = copyJString(site, env, value);
+  } else if (fallback != nullptr) {
+    result = opacity_bridge::handOffString(site, fallback);
+  }
+  opacity_bridge::recordStringUpcall(site.name, args, result);
+  return result;
+}
+
+// Upcalls only ever see the OpacityCore object, so one global ref is kept
+// for the lifetime of the process instead of one per init call.
+static void retainJavaObject(JNIEnv *env, jobject thiz) {
+  if (java_object != nullptr) {
+    return;
+  }
+  java_object = env->NewGlobalRef(thiz);
+}
+
 static jstring ownedCStringToJString(JNIEnv *env, const char *raw) {
   if (raw == nullptr) {
     return env->NewStringUTF("");
@@ -86,8 +169,13 @@ static jstring ownedCStringToJString(JNIEnv *env, const char *raw) {
 extern "C" const char *get_browser_overlay_bootstrap_script(void)
     __attribute__((weak));
 
+// Typed counterpart of emit_webview_event, see WebviewEventFrame.h. Older
+// libsdk builds don't export it, in which case frames are rendered to JSON.
+extern "C" void emit_webview_event_v2(const uint8_t *frame, size_t length)
+    __attribute__((weak));
+
 extern "C" void secure_set(const char *key, const char *value) {
-  JNIEnv *env = GetJniEnv();
+  BEGIN_UPCALL("secure_set", void);
   // Get the Kotlin class
   jclass jOpacityCore = env->GetObjectClass(java_object);
 
@@ -97,10 +185,11 @@ extern "C" void secure_set(const char *key, const char *value) {
 
   env->CallVoidMethod(java_object, set_method, string2jstring(env, key),
                       string2jstring(env, value));
+  opacity_bridge::recordUpcall("secure_set", {key, value});
 }
 
 extern "C" const char *secure_get(const char *key) {
-  JNIEnv *env = GetJniEnv();
+  BEGIN_UPCALL("secure_get", const char *);
   // Get the Kotlin class
   jclass jOpacityCore = env->GetObjectClass(java_object);
 
@@ -111,16 +200,11 @@ extern "C" const char *secure_get(const char *key) {
   auto res = (jstring)env->CallObjectMethod(java_object, set_method,
                                             string2jstring(env, key));
 
-  if (res == nullptr) {
-    return nullptr;
-  }
-
-  const char *val_str = env->GetStringUTFChars(res, nullptr);
-  return val_str;
+  return upcallString(MEMORY_SITE("secure_get"), {key}, env, res, nullptr);
 }
 
 extern "C" void android_prepare_request(const char *url) {
-  JNIEnv *env = GetJniEnv();
+  BEGIN_UPCALL("android_prepare_request", void);
   // Get the Kotlin class
   jclass jOpacityCore = env->GetObjectClass(java_object);
 
@@ -131,10 +215,11 @@ extern "C" void android_prepare_request(const char *url) {
   // Call the method with the necessary parameters
   jstring jurl = env->NewStringUTF(url);
   env->CallVoidMethod(java_object, openBrowserMethod, jurl);
+  opacity_bridge::recordUpcall("android_prepare_request", {url});
 }
 
 extern "C" void android_set_request_header(const char *key, const char *value) {
-  JNIEnv *env = GetJniEnv();
+  BEGIN_UPCALL("android_set_request_header", void);
   // Get the Kotlin class
   jclass jOpacityCore = env->GetObjectClass(java_object);
 
@@ -147,10 +232,11 @@ extern "C" void android_set_request_header(const char *key, const char *value) {
   jstring jkey = env->NewStringUTF(key);
   jstring jvalue = env->NewStringUTF(value);
   env->CallVoidMethod(java_object, method, jkey, jvalue);
+  opacity_bridge::recordUpcall("android_set_request_header", {key, value});
 }
 
 extern "C" void android_present_webview(bool shouldIntercept) {
-  JNIEnv *env = GetJniEnv();
+  BEGIN_UPCALL("android_present_webview", void);
   // Get the Kotlin class
   jclass jOpacityCore = env->GetObjectClass(java_object);
 
@@ -160,10 +246,12 @@ extern "C" void android_present_webview(bool shouldIntercept) {
   // Call the method with the necessary parameters
   jboolean jshouldIntercept = shouldIntercept ? JNI_TRUE : JNI_FALSE;
   env->CallVoidMethod(java_object, method, jshouldIntercept);
+  opacity_bridge::recordUpcall("android_present_webview",
+                               {shouldIntercept ? "true" : "false"});
 }
 
 extern "C" void android_set_cookie(const char *url, const char *value) {
-  JNIEnv *env = GetJniEnv();
+  BEGIN_UPCALL("android_set_cookie", void);
   jclass jOpacityCore = env->GetObjectClass(java_object);
 
   jmethodID method =
@@ -173,10 +261,11 @@ extern "C" void android_set_cookie(const char *url, const char *value) {
   jstring jurl = env->NewStringUTF(url);
   jstring jvalue = env->NewStringUTF(value);
   env->CallVoidMethod(java_object, method, jurl, jvalue);
+  opacity_bridge::recordUpcall("android_set_cookie", {url, value});
 }
 
 extern "C" void android_webview_change_url(const char *url) {
-  JNIEnv *env = GetJniEnv();
+  BEGIN_UPCALL("android_webview_change_url", void);
   // Get the Kotlin class
   jclass jOpacityCore = env->GetObjectClass(java_object);
 
@@ -186,9 +275,13 @@ extern "C" void android_webview_change_url(const char *url) {
 
   jstring jurl = env->NewStringUTF(url);
   env->CallVoidMethod(java_object, method, jurl);
+  opacity_bridge::recordUpcall("android_webview_change_url", {url});
 }
 
 extern "C" const char *get_ip_address() {
+  REPLAY_UPCALL("get_ip_address", const char *);
+  // No JNI involved, so no local frame either.
+  UPCALL_SCOPE(nullptr, "get_ip_address");
   struct ifaddrs *ifAddrStruct = nullptr;
   void *tmpAddrPtr = nullptr;
   std::string ipAddress = "Unavailable";
@@ -216,8 +309,9 @@ extern "C" const char *get_ip_address() {
   }
 
   // Allocate memory for the string and copy its content
-  char *result = new char[ipAddress.size() + 1];
-  std::strcpy(result, ipAddress.c_str());
+  char *result = opacity_bridge::handOffString(MEMORY_SITE("get_ip_address"),
+                                               ipAddress.c_str());
+  opacity_bridge::recordStringUpcall("get_ip_address", {}, result);
 
   // TODO this will leak! The problem is on iOS inet_ntoa is used which returns
   // a static memory address while there on android we need to manage the memory
@@ -227,189 +321,155 @@ extern "C" const char *get_ip_address() {
 }
 
 extern "C" bool android_is_app_foregrounded() {
-  JNIEnv *env = GetJniEnv();
+  BEGIN_UPCALL("android_is_app_foregrounded", bool);
   jclass jOpacityCore = env->GetObjectClass(java_object);
   jmethodID method = env->GetMethodID(jOpacityCore, "isAppForegrounded", "()Z");
-  return env->CallBooleanMethod(java_object, method);
+  jboolean result = env->CallBooleanMethod(java_object, method);
+  opacity_bridge::recordBoolUpcall("android_is_app_foregrounded", {},
+                                   result == JNI_TRUE);
+  return result;
 }
 
 extern "C" const char *android_get_os_version() {
-  JNIEnv *env = GetJniEnv();
+  BEGIN_UPCALL("android_get_os_version", const char *);
   jclass jOpacityCore = env->GetObjectClass(java_object);
   jmethodID method =
       env->GetMethodID(jOpacityCore, "getOsVersion", "()Ljava/lang/String;");
   auto res = (jstring)env->CallObjectMethod(java_object, method);
 
-  if (res == nullptr) {
-    return "";
-  }
-
-  const char *val_str = env->GetStringUTFChars(res, nullptr);
-  return val_str;
+  return upcallString(MEMORY_SITE("android_get_os_version"), {}, env, res, "");
 }
 
 extern "C" const char *android_get_device_manufacturer() {
-  JNIEnv *env = GetJniEnv();
+  BEGIN_UPCALL("android_get_device_manufacturer", const char *);
   jclass jOpacityCore = env->GetObjectClass(java_object);
   jmethodID method = env->GetMethodID(jOpacityCore, "getDeviceManufacturer",
                                       "()Ljava/lang/String;");
   auto res = (jstring)env->CallObjectMethod(java_object, method);
 
-  if (res == nullptr) {
-    return "";
-  }
-
-  const char *val_str = env->GetStringUTFChars(res, nullptr);
-  return val_str;
+  return upcallString(MEMORY_SITE("android_get_device_manufacturer"), {}, env,
+                      res, "");
 }
 
 extern "C" const char *android_get_device_model() {
-  JNIEnv *env = GetJniEnv();
+  BEGIN_UPCALL("android_get_device_model", const char *);
   jclass jOpacityCore = env->GetObjectClass(java_object);
   jmethodID method =
       env->GetMethodID(jOpacityCore, "getDeviceModel", "()Ljava/lang/String;");
   auto res = (jstring)env->CallObjectMethod(java_object, method);
 
-  if (res == nullptr) {
-    return "";
-  }
-
-  const char *val_str = env->GetStringUTFChars(res, nullptr);
-  return val_str;
+  return upcallString(MEMORY_SITE("android_get_device_model"), {}, env,
+                      res, "");
 }
 
 extern "C" const char *android_get_device_locale() {
-  JNIEnv *env = GetJniEnv();
+  BEGIN_UPCALL("android_get_device_locale", const char *);
   jclass jOpacityCore = env->GetObjectClass(java_object);
   jmethodID method =
       env->GetMethodID(jOpacityCore, "getDeviceLocale", "()Ljava/lang/String;");
   auto res = (jstring)env->CallObjectMethod(java_object, method);
 
-  if (res == nullptr) {
-    return "";
-  }
-
-  const char *val_str = env->GetStringUTFChars(res, nullptr);
-  return val_str;
+  return upcallString(MEMORY_SITE("android_get_device_locale"), {}, env,
+                      res, "");
 }
 
 extern "C" int android_get_sdk_version() {
-  JNIEnv *env = GetJniEnv();
+  BEGIN_UPCALL("android_get_sdk_version", int32_t);
   jclass jOpacityCore = env->GetObjectClass(java_object);
   jmethodID method = env->GetMethodID(jOpacityCore, "getSdkVersion", "()I");
-  return env->CallIntMethod(java_object, method);
+  jint result = env->CallIntMethod(java_object, method);
+  opacity_bridge::recordNumberUpcall("android_get_sdk_version", {}, result);
+  return result;
 }
 
 extern "C" int android_get_screen_width() {
-  JNIEnv *env = GetJniEnv();
+  BEGIN_UPCALL("android_get_screen_width", int32_t);
   jclass jOpacityCore = env->GetObjectClass(java_object);
   jmethodID method = env->GetMethodID(jOpacityCore, "getScreenWidth", "()I");
-  return env->CallIntMethod(java_object, method);
+  jint result = env->CallIntMethod(java_object, method);
+  opacity_bridge::recordNumberUpcall("android_get_screen_width", {}, result);
+  return result;
 }
 
 extern "C" int android_get_screen_height() {
-  JNIEnv *env = GetJniEnv();
+  BEGIN_UPCALL("android_get_screen_height", int32_t);
   jclass jOpacityCore = env->GetObjectClass(java_object);
   jmethodID method = env->GetMethodID(jOpacityCore, "getScreenHeight", "()I");
-  return env->CallIntMethod(java_object, method);
+  jint result = env->CallIntMethod(java_object, method);
+  opacity_bridge::recordNumberUpcall("android_get_screen_height", {}, result);
+  return result;
 }
 
 extern "C" float android_get_screen_density() {
-  JNIEnv *env = GetJniEnv();
+  BEGIN_UPCALL("android_get_screen_density", float);
   jclass jOpacityCore = env->GetObjectClass(java_object);
   jmethodID method = env->GetMethodID(jOpacityCore, "getScreenDensity", "()F");
-  return env->CallFloatMethod(java_object, method);
+  jfloat result = env->CallFloatMethod(java_object, method);
+  opacity_bridge::recordNumberUpcall("android_get_screen_density", {}, result);
+  return result;
 }
 
 extern "C" int android_get_screen_dpi() {
-  JNIEnv *env = GetJniEnv();
+  BEGIN_UPCALL("android_get_screen_dpi", int32_t);
   jclass jOpacityCore = env->GetObjectClass(java_object);
   jmethodID method = env->GetMethodID(jOpacityCore, "getScreenDpi", "()I");
-  return env->CallIntMethod(java_object, method);
+  jint result = env->CallIntMethod(java_object, method);
+  opacity_bridge::recordNumberUpcall("android_get_screen_dpi", {}, result);
+  return result;
 }
 
 extern "C" const char *android_get_device_cpu() {
-  JNIEnv *env = GetJniEnv();
+  BEGIN_UPCALL("android_get_device_cpu", const char *);
   jclass jOpacityCore = env->GetObjectClass(java_object);
   jmethodID method =
       env->GetMethodID(jOpacityCore, "getDeviceCpu", "()Ljava/lang/String;");
   auto jCpu = (jstring)env->CallObjectMethod(java_object, method);
-  if (jCpu == nullptr) {
-    return strdup("");
-  }
-  const char *cpu = env->GetStringUTFChars(jCpu, nullptr);
-  char *result = strdup(cpu);
-  env->ReleaseStringUTFChars(jCpu, cpu);
-  env->DeleteLocalRef(jCpu);
-  return result;
+  return upcallString(MEMORY_SITE("android_get_device_cpu"), {}, env, jCpu, "");
 }
 
 extern "C" const char *android_get_device_codename() {
-  JNIEnv *env = GetJniEnv();
+  BEGIN_UPCALL("android_get_device_codename", const char *);
   jclass jOpacityCore = env->GetObjectClass(java_object);
   jmethodID method = env->GetMethodID(jOpacityCore, "getDeviceCodename",
                                       "()Ljava/lang/String;");
   auto jCodename = (jstring)env->CallObjectMethod(java_object, method);
-  if (jCodename == nullptr) {
-    return strdup("");
-  }
-  const char *codename = env->GetStringUTFChars(jCodename, nullptr);
-  char *result = strdup(codename);
-  env->ReleaseStringUTFChars(jCodename, codename);
-  env->DeleteLocalRef(jCodename);
-  return result;
+  return upcallString(MEMORY_SITE("android_get_device_codename"), {}, env,
+                      jCodename, "");
 }
 
 extern "C" const char *android_get_bootloader() {
-  JNIEnv *env = GetJniEnv();
+  BEGIN_UPCALL("android_get_bootloader", const char *);
   jclass jOpacityCore = env->GetObjectClass(java_object);
   jmethodID method = env->GetMethodID(jOpacityCore, "getBootloader",
                                       "()Ljava/lang/String;");
   auto jBootloader = (jstring)env->CallObjectMethod(java_object, method);
-  if (jBootloader == nullptr) {
-    return strdup("");
-  }
-  const char *bootloader = env->GetStringUTFChars(jBootloader, nullptr);
-  char *result = strdup(bootloader);
-  env->ReleaseStringUTFChars(jBootloader, bootloader);
-  env->DeleteLocalRef(jBootloader);
-  return result;
+  return upcallString(MEMORY_SITE("android_get_bootloader"), {}, env,
+                      jBootloader, "");
 }
 
 extern "C" const char *android_get_radio() {
-  JNIEnv *env = GetJniEnv();
+  BEGIN_UPCALL("android_get_radio", const char *);
   jclass jOpacityCore = env->GetObjectClass(java_object);
   jmethodID method = env->GetMethodID(jOpacityCore, "getRadio",
                                       "()Ljava/lang/String;");
   auto jRadio = (jstring)env->CallObjectMethod(java_object, method);
-  if (jRadio == nullptr) {
-    return strdup("");
-  }
-  const char *radio = env->GetStringUTFChars(jRadio, nullptr);
-  char *result = strdup(radio);
-  env->ReleaseStringUTFChars(jRadio, radio);
-  env->DeleteLocalRef(jRadio);
-  return result;
+  return upcallString(MEMORY_SITE("android_get_radio"), {}, env, jRadio, "");
 }
 
 extern "C" const char *android_get_build_time() {
-  JNIEnv *env = GetJniEnv();
+  BEGIN_UPCALL("android_get_build_time", const char *);
   jclass jOpacityCore = env->GetObjectClass(java_object);
   jmethodID method = env->GetMethodID(jOpacityCore, "getBuildTime",
                                       "()Ljava/lang/String;");
   auto jBuildTime = (jstring)env->CallObjectMethod(java_object, method);
-  if (jBuildTime == nullptr) {
-    return strdup("");
-  }
-  const char *buildTime = env->GetStringUTFChars(jBuildTime, nullptr);
-  char *result = strdup(buildTime);
-  env->ReleaseStringUTFChars(jBuildTime, buildTime);
-  env->DeleteLocalRef(jBuildTime);
-  return result;
+  return upcallString(MEMORY_SITE("android_get_build_time"), {}, env,
+                      jBuildTime, "");
 }
 
 extern "C" void android_close_webview() {
-  JNIEnv *env = GetJniEnv();
+  // libsdk resets the flow's debug_logs flag on close_browser.
+  opacity_bridge::setDebugLogsEnabled(false);
+  BEGIN_UPCALL("android_close_webview", void);
   // Get the Kotlin class
   jclass jOpacityCore = env->GetObjectClass(java_object);
 
@@ -418,10 +478,11 @@ extern "C" void android_close_webview() {
 
   // Call the method with the necessary parameters
   env->CallVoidMethod(java_object, method);
+  opacity_bridge::recordUpcall("android_close_webview", {});
 }
 
 extern "C" const char *android_get_browser_cookies_for_current_url() {
-  JNIEnv *env = GetJniEnv();
+  BEGIN_UPCALL("android_get_browser_cookies_for_current_url", const char *);
 
   jclass jOpacityCore = env->GetObjectClass(java_object);
 
@@ -429,17 +490,14 @@ extern "C" const char *android_get_browser_cookies_for_current_url() {
       jOpacityCore, "getBrowserCookiesForCurrentUrl", "()Ljava/lang/String;");
   auto res = (jstring)env->CallObjectMethod(java_object, method);
 
-  if (res == nullptr) {
-    return nullptr;
-  }
-
-  const char *val_str = env->GetStringUTFChars(res, nullptr);
-  return val_str;
+  return upcallString(
+      MEMORY_SITE("android_get_browser_cookies_for_current_url"), {}, env, res,
+      nullptr);
 }
 
 extern "C" const char *android_eval_js(const char *js,
                                        double timeout_in_seconds) {
-  JNIEnv *env = GetJniEnv();
+  BEGIN_UPCALL("android_eval_js", const char *);
   jclass jOpacityCore = env->GetObjectClass(java_object);
   jmethodID method = env->GetMethodID(
       jOpacityCore, "evalJs", "(Ljava/lang/String;J)Ljava/lang/String;");
@@ -448,19 +506,13 @@ extern "C" const char *android_eval_js(const char *js,
   auto result =
       (jstring)env->CallObjectMethod(java_object, method, jjs, timeout_ms);
   env->DeleteLocalRef(jjs);
-  if (result == nullptr) {
-    return strdup("{\"result\":null}");
-  }
-  const char *str = env->GetStringUTFChars(result, nullptr);
-  char *copy = strdup(str);
-  env->ReleaseStringUTFChars(result, str);
-  env->DeleteLocalRef(result);
-  return copy;
+  return upcallString(MEMORY_SITE("android_eval_js"), {js}, env,
+                      result, "{\"result\":null}");
 }
 
 extern "C" const char *
 android_get_browser_cookies_for_domain(const char *domain) {
-  JNIEnv *env = GetJniEnv();
+  BEGIN_UPCALL("android_get_browser_cookies_for_domain", const char *);
 
   jclass jOpacityCore = env->GetObjectClass(java_object);
   jmethodID method =
@@ -468,22 +520,22 @@ android_get_browser_cookies_for_domain(const char *domain) {
                        "(Ljava/lang/String;)Ljava/lang/String;");
   jstring jdomain = env->NewStringUTF(domain);
   auto res = (jstring)env->CallObjectMethod(java_object, method, jdomain);
-  if (res == nullptr) {
-    return nullptr;
-  }
-  const char *val_str = env->GetStringUTFChars(res, nullptr);
-  //    opacity_core::free_string(domain); // Free the domain string
-  return val_str; // Caller must free this memory
+  // Caller must free this memory
+  return upcallString(MEMORY_SITE("android_get_browser_cookies_for_domain"),
+                      {domain}, env, res, nullptr);
 }
 
 extern "C" JNIEXPORT jint JNICALL
 Java_com_opacitylabs_opacitycore_OpacityCore_init(
     JNIEnv *env, jobject thiz, jstring api_key, jboolean dry_run,
     jint environment_enum, jboolean show_errors_in_webview) {
-  java_object = env->NewGlobalRef(thiz);
+  DOWNCALL_SCOPE("opacity_init");
+  sdk_init_started.store(true);
+  retainJavaObject(env, thiz);
   char *err;
-  const char *api_key_str = env->GetStringUTFChars(api_key, nullptr);
-  int result = opacity_core::opacity_init(api_key_str, dry_run,
+  opacity_bridge::ScopedUtfChars api_key_str(MEMORY_SITE("opacity_init"), env,
+                                             api_key);
+  int result = opacity_core::opacity_init(api_key_str.c_str(), dry_run,
                                   static_cast<int>(environment_enum),
                                   show_errors_in_webview, &err);
   if (result != opacity_core::OPACITY_OK) {
@@ -502,16 +554,21 @@ Java_com_opacitylabs_opacitycore_OpacityCore_nativeInitializeOpenTelemetry(
         jstring j_grafana_instance_id,
         jstring j_grafana_api_token
         ) {
-  java_object = env->NewGlobalRef(thiz);
+  DOWNCALL_SCOPE("opacity_initialize_open_telemetry");
+  retainJavaObject(env, thiz);
   char *err;
-  const char *open_telemetry_endpoint = env->GetStringUTFChars(j_open_telemetry_endpoint, nullptr);
-  const char *grafana_instance_id = env->GetStringUTFChars(j_grafana_instance_id, nullptr);
-  const char *grafana_api_token = env->GetStringUTFChars(j_grafana_api_token, nullptr);
+  auto &memory = MEMORY_SITE("opacity_initialize_open_telemetry");
+  opacity_bridge::ScopedUtfChars open_telemetry_endpoint(
+      memory, env, j_open_telemetry_endpoint);
+  opacity_bridge::ScopedUtfChars grafana_instance_id(memory, env,
+                                                     j_grafana_instance_id);
+  opacity_bridge::ScopedUtfChars grafana_api_token(memory, env,
+                                                   j_grafana_api_token);
 
   int result = opacity_core::opacity_initialize_open_telemetry(
-          open_telemetry_endpoint,
-          grafana_instance_id,
-          grafana_api_token, &err);
+          open_telemetry_endpoint.c_str(),
+          grafana_instance_id.c_str(),
+          grafana_api_token.c_str(), &err);
 
   if (result != opacity_core::OPACITY_OK) {
     jclass exceptionClass = env->FindClass("java/lang/Exception");
@@ -524,11 +581,84 @@ Java_com_opacitylabs_opacitycore_OpacityCore_nativeInitializeOpenTelemetry(
 extern "C" JNIEXPORT void JNICALL
 Java_com_opacitylabs_opacitycore_OpacityCore_emitWebviewEvent(
     JNIEnv *env, jobject thiz, jstring event_json) {
-  const char *json = env->GetStringUTFChars(event_json, nullptr);
-  opacity_core::emit_webview_event(json);
+  DOWNCALL_SCOPE("emit_webview_event");
+  opacity_bridge::ScopedUtfChars json(MEMORY_SITE("emit_webview_event"), env,
+                                      event_json);
+  opacity_bridge::recordWebviewEvent(json.c_str());
+  opacity_core::emit_webview_event(json.c_str());
+  opacity_bridge::enforceMemoryBudget();
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_opacitylabs_opacitycore_OpacityCore_emitWebviewEventFrame(
+    JNIEnv *env, jobject thiz, jobject frame, jint length) {
+  DOWNCALL_SCOPE("emit_webview_event_frame");
+  auto *data = static_cast<const uint8_t *>(env->GetDirectBufferAddress(frame));
+  if (data == nullptr || length <= 0 ||
+      length > env->GetDirectBufferCapacity(frame)) {
+    opacity_bridge::writeLogf(opacity_bridge::LogLevel::Error,
+                              "emitWebviewEventFrame", "invalid frame buffer");
+    return;
+  }
+
+  bool needsDecode = emit_webview_event_v2 == nullptr ||
+                     opacity_bridge::isHtmlDeltaEnabled() ||
+                     opacity_bridge::isRecording();
+  opacity_bridge::WebviewEvent event;
+  if (needsDecode &&
+      !opacity_bridge::decodeWebviewEventFrame(data, static_cast<size_t>(length),
+                                               event)) {
+    opacity_bridge::writeLogf(opacity_bridge::LogLevel::Error,
+                              "emitWebviewEventFrame", "malformed frame");
+    return;
+  }
+
+  // Recordings always hold the full JSON event so they replay against any
+  // libsdk build, regardless of delta mode.
+  if (opacity_bridge::isRecording()) {
+    std::string json = opacity_bridge::webviewEventToJson(event);
+    opacity_bridge::ScopedMemoryCharge charge(MEMORY_SITE("webview_event_json"),
+                                              json.capacity());
+    opacity_bridge::recordWebviewEvent(json);
+  }
+
+  if (emit_webview_event_v2 != nullptr) {
+    std::string delta;
+    if (needsDecode && opacity_bridge::rewriteNavigationFrame(event, delta)) {
+      opacity_bridge::ScopedMemoryCharge charge(MEMORY_SITE("html_delta_frame"),
+                                                delta.capacity());
+      emit_webview_event_v2(reinterpret_cast<const uint8_t *>(delta.data()),
+                            delta.size());
+    } else {
+      emit_webview_event_v2(data, static_cast<size_t>(length));
+    }
+    opacity_bridge::enforceMemoryBudget();
+    return;
+  }
+
+  // Delta mode can't be on here, see setHtmlDeltaEnabled.
+  std::string json = opacity_bridge::webviewEventToJson(event);
+  opacity_bridge::ScopedMemoryCharge charge(MEMORY_SITE("webview_event_json"),
+                                            json.capacity());
+  opacity_core::emit_webview_event(json.c_str());
+  opacity_bridge::enforceMemoryBudget();
 }
 
-jobject createOpacityResponse(JNIEnv *env, int status, char *res, char *err) {
+// Copies an opacity_get outcome out of libsdk-owned memory and frees it.
+static opacity_bridge::FlowResult takeFlowResult(int status, char *res,
+                                                 char *err) {
+  opacity_bridge::FlowResult result;
+  result.status = status;
+  char *payload = status == opacity_core::OPACITY_OK ? res : err;
+  if (payload != nullptr) {
+    result.payload = payload;
+    opacity_core::opacity_free_string(payload);
+  }
+  return result;
+}
+
+jobject createOpacityResponse(JNIEnv *env,
+                              const opacity_bridge::FlowResult &result) {
   jclass opacityResponseClass =
       env->FindClass("com/opacitylabs/opacitycore/OpacityResponse");
 
@@ -538,18 +668,16 @@ jobject createOpacityResponse(JNIEnv *env, int status, char *res, char *err) {
 
   jobject opacityResponse;
   jstring jres, jerr;
-  if (status == opacity_core::OPACITY_OK) {
-    jres = env->NewStringUTF(res);
+  if (result.status == opacity_core::OPACITY_OK) {
+    jres = env->NewStringUTF(result.payload.c_str());
     jerr = env->NewStringUTF(nullptr);
-    opacity_core::opacity_free_string(res);
   } else {
     jres = env->NewStringUTF(nullptr);
-    jerr = env->NewStringUTF(err);
-    opacity_core::opacity_free_string(err);
+    jerr = env->NewStringUTF(result.payload.c_str());
   }
 
-  opacityResponse =
-      env->NewObject(opacityResponseClass, constructor, status, jres, jerr);
+  opacityResponse = env->NewObject(opacityResponseClass, constructor,
+                                   result.status, jres, jerr);
 
   return opacityResponse;
 }
@@ -558,18 +686,60 @@ extern "C" JNIEXPORT jobject JNICALL
 Java_com_opacitylabs_opacitycore_OpacityCore_getNative(JNIEnv *env,
                                                        jobject thiz,
                                                        jstring name,
-                                                       jstring params) {
-  char *res, *err;
-  const char *name_str = env->GetStringUTFChars(name, nullptr);
-  const char *params_str =
-      params != nullptr ? env->GetStringUTFChars(params, nullptr) : nullptr;
-  int status = opacity_core::opacity_get(name_str, params_str, &res, &err);
-  return createOpacityResponse(env, status, res, err);
+                                                       jstring params,
+                                                       jint priority) {
+  DOWNCALL_SCOPE("opacity_get");
+  auto &memory = MEMORY_SITE("opacity_get");
+  opacity_bridge::ScopedUtfChars name_chars(memory, env, name);
+  opacity_bridge::ScopedUtfChars params_chars(memory, env, params);
+  const char *name_str = name_chars.c_str();
+  const char *params_str = params_chars.c_str();
+  auto request_priority =
+      priority == static_cast<jint>(opacity_bridge::RequestPriority::Background)
+          ? opacity_bridge::RequestPriority::Background
+          : opacity_bridge::RequestPriority::Interactive;
+
+  // Only the call that actually executes takes a scheduler slot; coalesced
+  // and cached callers never queue, but an interactive joiner raises the
+  // priority the execution is admitted with.
+  opacity_bridge::FlowResult result = opacity_bridge::runCoalesced(
+      name_str, params_str, request_priority,
+      [&](opacity_bridge::AdmissionPriority &admission) {
+        opacity_bridge::LiveFlowScope live;
+        if (!live.admitted()) {
+          return opacity_bridge::FlowResult{
+              opacity_core::OPACITY_GENERIC_ERROR,
+              "{\"code\":\"ReplayInProgress\",\"description\":\"A "
+              "recorded flow is being replayed, try again later\"}"};
+        }
+        opacity_bridge::AdmissionTicket ticket =
+            opacity_bridge::admitRequest(admission);
+        if (!ticket.admitted()) {
+          return opacity_bridge::FlowResult{
+              opacity_core::OPACITY_GENERIC_ERROR,
+              "{\"code\":\"Overloaded\",\"description\":\"Too many "
+              "requests are waiting to run, try again later\"}"};
+        }
+        char *res = nullptr, *err = nullptr;
+        int status =
+            opacity_core::opacity_get(name_str, params_str, &res, &err);
+        opacity_bridge::FlowResult result = takeFlowResult(status, res, err);
+        opacity_bridge::recordFlow(name_str, params_str, result.status,
+                                   result.payload);
+        return result;
+      });
+
+  // Each caller holds its own copy until it is turned into Java strings.
+  opacity_bridge::ScopedMemoryCharge charge(MEMORY_SITE("flow_result"),
+                                            result.payload.capacity());
+  opacity_bridge::enforceMemoryBudget();
+  return createOpacityResponse(env, result);
 }
 
 extern "C" JNIEXPORT jstring JNICALL
 Java_com_opacitylabs_opacitycore_OpacityCore_getSdkVersions(JNIEnv *env,
                                                             jobject thiz) {
+  DOWNCALL_SCOPE("get_api_version");
   const char *res = opacity_core::get_api_version();
   jstring jres = env->NewStringUTF(res);
   //    opacity_core::free_string(res);
@@ -579,12 +749,14 @@ Java_com_opacitylabs_opacitycore_OpacityCore_getSdkVersions(JNIEnv *env,
 extern "C" JNIEXPORT jboolean JNICALL
 Java_com_opacitylabs_opacitycore_OpacityCore_isBrowserOverlayEnabled(
     JNIEnv *env, jobject thiz) {
+  DOWNCALL_SCOPE("is_browser_overlay_enabled");
   return opacity_core::is_browser_overlay_enabled() ? JNI_TRUE : JNI_FALSE;
 }
 
 extern "C" JNIEXPORT jstring JNICALL
 Java_com_opacitylabs_opacitycore_OpacityCore_getBrowserOverlayObserverScript(
     JNIEnv *env, jobject thiz) {
+  DOWNCALL_SCOPE("get_browser_overlay_observer_script");
   return ownedCStringToJString(
       env, opacity_core::get_browser_overlay_observer_script());
 }
@@ -592,6 +764,7 @@ Java_com_opacitylabs_opacitycore_OpacityCore_getBrowserOverlayObserverScript(
 extern "C" JNIEXPORT jstring JNICALL
 Java_com_opacitylabs_opacitycore_OpacityCore_getBrowserOverlayBootstrapScript(
     JNIEnv *env, jobject thiz) {
+  DOWNCALL_SCOPE("get_browser_overlay_bootstrap_script");
   if (get_browser_overlay_bootstrap_script == nullptr) {
     return env->NewStringUTF("");
   }
@@ -602,6 +775,7 @@ Java_com_opacitylabs_opacitycore_OpacityCore_getBrowserOverlayBootstrapScript(
 extern "C" JNIEXPORT jstring JNICALL
 Java_com_opacitylabs_opacitycore_OpacityCore_getBrowserOverlayRendererScript(
     JNIEnv *env, jobject thiz) {
+  DOWNCALL_SCOPE("get_browser_overlay_renderer_script");
   return ownedCStringToJString(
       env, opacity_core::get_browser_overlay_renderer_script());
 }
@@ -609,5 +783,326 @@ Java_com_opacitylabs_opacitycore_OpacityCore_getBrowserOverlayRendererScript(
 extern "C" JNIEXPORT jboolean JNICALL
 Java_com_opacitylabs_opacitycore_OpacityCore_isBrowserDebugLogsEnabled(
     JNIEnv *env, jobject thiz) {
-  return opacity_core::is_browser_debug_logs_enabled() ? JNI_TRUE : JNI_FALSE;
+  DOWNCALL_SCOPE("is_browser_debug_logs_enabled");
+  // Asked once per browser flow, which is when the flow's setting is known.
+  bool enabled = opacity_core::is_browser_debug_logs_enabled();
+  opacity_bridge::setDebugLogsEnabled(enabled);
+  return enabled ? JNI_TRUE : JNI_FALSE;
+}
+
+// The browser closed without libsdk's close_browser, e.g. the user left it.
+extern "C" JNIEXPORT void JNICALL
+Java_com_opacitylabs_opacitycore_OpacityCore_nativeDisableBrowserDebugLogs(
+    JNIEnv *env, jobject thiz) {
+  opacity_bridge::setDebugLogsEnabled(false);
+}
+
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_opacitylabs_opacitycore_OpacityCore_getBridgeStats(JNIEnv *env,
+                                                            jobject thiz) {
+  return env->NewStringUTF(opacity_bridge::bridgeStatsJson().c_str());
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_opacitylabs_opacitycore_OpacityCore_nativeSetTracingEnabled(
+    JNIEnv *env, jobject thiz, jboolean enabled) {
+  opacity_bridge::setTracingEnabled(enabled == JNI_TRUE);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_opacitylabs_opacitycore_OpacityCore_nativeTraceComplete(
+    JNIEnv *env, jobject thiz, jstring name, jlong start_nanos,
+    jlong end_nanos) {
+  char buffer[opacity_bridge::kTraceNameCapacity];
+  size_t length = copyJStringInto(env, name, buffer, sizeof(buffer));
+  opacity_bridge::traceComplete("kotlin", buffer, length,
+                                static_cast<uint64_t>(start_nanos),
+                                static_cast<uint64_t>(end_nanos));
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_opacitylabs_opacitycore_OpacityCore_nativeTraceInstant(JNIEnv *env,
+                                                                jobject thiz,
+                                                                jstring name) {
+  char buffer[opacity_bridge::kTraceNameCapacity];
+  size_t length = copyJStringInto(env, name, buffer, sizeof(buffer));
+  opacity_bridge::traceInstant("kotlin", buffer, length);
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_opacitylabs_opacitycore_OpacityCore_dumpTrace(JNIEnv *env,
+                                                       jobject thiz,
+                                                       jstring path) {
+  opacity_bridge::ScopedUtfChars path_str(MEMORY_SITE("dump_trace"), env, path);
+  bool written = opacity_bridge::dumpTrace(path_str.c_str());
+  return written ? JNI_TRUE : JNI_FALSE;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_opacitylabs_opacitycore_OpacityCore_clearTrace(JNIEnv *env,
+                                                        jobject thiz) {
+  opacity_bridge::clearTrace();
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_opacitylabs_opacitycore_OpacityCore_setHtmlDeltaEnabled(
+    JNIEnv *env, jobject thiz, jboolean enabled) {
+  // Delta frames can't be expressed as emit_webview_event JSON, so without
+  // the v2 entry point turning them on would only add a decode per event.
+  if (enabled == JNI_TRUE && emit_webview_event_v2 == nullptr) {
+    opacity_bridge::writeLogf(opacity_bridge::LogLevel::Warn,
+                              "setHtmlDeltaEnabled",
+                              "libsdk has no emit_webview_event_v2, html "
+                              "delta mode stays off");
+    opacity_bridge::setHtmlDeltaEnabled(false);
+    return JNI_FALSE;
+  }
+  opacity_bridge::setHtmlDeltaEnabled(enabled == JNI_TRUE);
+  return enabled;
+}
+
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_opacitylabs_opacitycore_OpacityCore_getHtmlDeltaStats(JNIEnv *env,
+                                                               jobject thiz) {
+  return env->NewStringUTF(opacity_bridge::htmlDeltaStatsJson().c_str());
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_opacitylabs_opacitycore_OpacityCore_setFlowCacheTtl(JNIEnv *env,
+                                                             jobject thiz,
+                                                             jstring name,
+                                                             jlong ttl_ms) {
+  opacity_bridge::ScopedUtfChars name_str(MEMORY_SITE("set_flow_cache_ttl"),
+                                          env, name);
+  opacity_bridge::setFlowCacheTtl(name_str.c_str(), ttl_ms);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_opacitylabs_opacitycore_OpacityCore_invalidateFlowCache(
+    JNIEnv *env, jobject thiz, jstring name) {
+  opacity_bridge::ScopedUtfChars name_str(MEMORY_SITE("invalidate_flow_cache"),
+                                          env, name);
+  opacity_bridge::invalidateFlowCache(name_str.c_str());
+}
+
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_opacitylabs_opacitycore_OpacityCore_getRequestCacheStats(
+    JNIEnv *env, jobject thiz) {
+  return env->NewStringUTF(opacity_bridge::requestCacheStatsJson().c_str());
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_opacitylabs_opacitycore_OpacityCore_nativeConfigureScheduler(
+    JNIEnv *env, jobject thiz, jint max_in_flight, jint max_background_in_flight,
+    jint max_queued) {
+  opacity_bridge::SchedulerConfig config;
+  config.maxInFlight = max_in_flight;
+  config.maxBackgroundInFlight = max_background_in_flight;
+  config.maxQueued = max_queued;
+  opacity_bridge::configureScheduler(config);
+}
+
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_opacitylabs_opacitycore_OpacityCore_getSchedulerStats(JNIEnv *env,
+                                                               jobject thiz) {
+  return env->NewStringUTF(opacity_bridge::schedulerStatsJson().c_str());
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_opacitylabs_opacitycore_OpacityCore_loadBrowserOverlayPages(
+    JNIEnv *env, jobject thiz) {
+  DOWNCALL_SCOPE("get_browser_overlay_pages_json");
+  const char *json = opacity_core::get_browser_overlay_pages_json();
+  if (json == nullptr) {
+    opacity_bridge::clearOverlayPages();
+    return -1;
+  }
+  int pages = opacity_bridge::loadOverlayPages(json);
+  opacity_core::opacity_free_string((char *)json);
+  return pages;
+}
+
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_opacitylabs_opacitycore_OpacityCore_matchBrowserOverlayPage(
+    JNIEnv *env, jobject thiz, jstring url) {
+  std::string page_id;
+  bool matched;
+  {
+    opacity_bridge::ScopedUtfChars url_str(
+        MEMORY_SITE("match_browser_overlay_page"), env, url);
+    matched = opacity_bridge::matchOverlayPage(url_str.c_str(), page_id);
+  }
+  return matched ? env->NewStringUTF(page_id.c_str()) : nullptr;
+}
+
+extern "C" JNIEXPORT jobjectArray JNICALL
+Java_com_opacitylabs_opacitycore_OpacityCore_getBrowserOverlayPageOrigins(
+    JNIEnv *env, jobject thiz) {
+  std::vector<std::string> origins = opacity_bridge::overlayPageOrigins();
+  jclass stringClass = env->FindClass("java/lang/String");
+  jobjectArray result = env->NewObjectArray(static_cast<jsize>(origins.size()),
+                                            stringClass, nullptr);
+  for (size_t i = 0; result != nullptr && i < origins.size(); i++) {
+    jstring origin = env->NewStringUTF(origins[i].c_str());
+    env->SetObjectArrayElement(result, static_cast<jsize>(i), origin);
+    env->DeleteLocalRef(origin);
+  }
+  env->DeleteLocalRef(stringClass);
+  return result;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_opacitylabs_opacitycore_OpacityCore_recordBlockedWait(
+    JNIEnv *env, jobject thiz, jint kind, jint outcome, jlong nanos) {
+  opacity_bridge::recordBlockedWait(kind, outcome,
+                                    static_cast<uint64_t>(nanos));
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_opacitylabs_opacitycore_OpacityCore_recordPrepareToFirstPaint(
+    JNIEnv *env, jobject thiz, jlong nanos, jboolean warm) {
+  opacity_bridge::recordPrepareToFirstPaint(static_cast<uint64_t>(nanos),
+                                            warm == JNI_TRUE);
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_opacitylabs_opacitycore_OpacityCore_nativeStartRecording(
+    JNIEnv *env, jobject thiz, jstring path) {
+  opacity_bridge::ScopedUtfChars path_str(MEMORY_SITE("start_recording"), env,
+                                          path);
+  bool started = opacity_bridge::startRecording(path_str.c_str());
+  return started ? JNI_TRUE : JNI_FALSE;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_opacitylabs_opacitycore_OpacityCore_nativeStopRecording(JNIEnv *env,
+                                                                 jobject thiz) {
+  opacity_bridge::stopRecording();
+}
+
+// Runs the flow in a recording straight through opacity_get. The coalescer,
+// flow cache and scheduler are skipped so every replay really executes
+// libsdk. Returns {"status":..,"payload":..,"matches_recording":..}, or null
+// if the recording holds no flow. Throws IllegalStateException while a live
+// flow or another replay runs.
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_opacitylabs_opacitycore_OpacityCore_replayNative(
+    JNIEnv *env, jobject thiz, jstring path, jboolean original_timing) {
+  DOWNCALL_SCOPE("opacity_get_replay");
+  opacity_bridge::RecordedFlow flow;
+  {
+    opacity_bridge::ScopedUtfChars path_str(MEMORY_SITE("replay"), env, path);
+    opacity_bridge::ReplayStart started = opacity_bridge::startReplay(
+        path_str.c_str(), original_timing == JNI_TRUE,
+        opacity_core::emit_webview_event, flow);
+    if (started == opacity_bridge::ReplayStart::Busy) {
+      jclass exceptionClass = env->FindClass("java/lang/IllegalStateException");
+      env->ThrowNew(exceptionClass, "A flow or another replay is running");
+      return nullptr;
+    }
+    if (started != opacity_bridge::ReplayStart::Started) {
+      return nullptr;
+    }
+  }
+  char *res = nullptr, *err = nullptr;
+  int status = opacity_core::opacity_get(
+      flow.name.c_str(), flow.hasParams ? flow.params.c_str() : nullptr, &res,
+      &err);
+  opacity_bridge::FlowResult result = takeFlowResult(status, res, err);
+  opacity_bridge::ScopedMemoryCharge charge(MEMORY_SITE("flow_result"),
+                                            result.payload.capacity());
+  opacity_bridge::stopReplay();
+
+  std::string outcome = "{";
+  opacity_bridge::appendJsonInteger(outcome, "status", result.status);
+  outcome.append(",\"payload\":");
+  opacity_bridge::appendJsonString(outcome, result.payload);
+  outcome.append(",\"matches_recording\":");
+  outcome.append(flow.matches(result.status, result.payload) ? "true"
+                                                             : "false");
+  outcome.push_back('}');
+  opacity_bridge::enforceMemoryBudget();
+  return env->NewStringUTF(outcome.c_str());
+}
+
+// setenv races with getenv on other threads, so the override is only taken
+// before opacity_init has started libsdk's threads.
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_opacitylabs_opacitycore_OpacityCore_nativeSetBackendUrl(JNIEnv *env,
+                                                                 jobject thiz,
+                                                                 jstring url) {
+  if (sdk_init_started.load()) {
+    return JNI_FALSE;
+  }
+  if (url == nullptr) {
+    unsetenv("OPACITY_BACKEND_URL");
+    return JNI_TRUE;
+  }
+  opacity_bridge::ScopedUtfChars url_str(MEMORY_SITE("set_backend_url"), env,
+                                         url);
+  setenv("OPACITY_BACKEND_URL", url_str.c_str(), 1);
+  return JNI_TRUE;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_opacitylabs_opacitycore_OpacityCore_writeLog(JNIEnv *env,
+                                                      jobject thiz,
+                                                      jint level, jstring site,
+                                                      jstring message) {
+  auto log_level = static_cast<opacity_bridge::LogLevel>(level);
+  if (!opacity_bridge::isLogLevelEnabled(log_level)) {
+    return;
+  }
+  char site_buf[32];
+  char message_buf[512];
+  copyJStringInto(env, site, site_buf, sizeof(site_buf));
+  size_t length =
+      copyJStringInto(env, message, message_buf, sizeof(message_buf));
+  opacity_bridge::writeLog(log_level, site_buf, message_buf, length);
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_opacitylabs_opacitycore_OpacityCore_isLogLevelEnabled(JNIEnv *env,
+                                                               jobject thiz,
+                                                               jint level) {
+  return opacity_bridge::isLogLevelEnabled(
+             static_cast<opacity_bridge::LogLevel>(level))
+             ? JNI_TRUE
+             : JNI_FALSE;
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_opacitylabs_opacitycore_OpacityCore_setLogFile(JNIEnv *env,
+                                                        jobject thiz,
+                                                        jstring path) {
+  opacity_bridge::ScopedUtfChars path_str(MEMORY_SITE("set_log_file"), env,
+                                          path);
+  bool opened = opacity_bridge::setLogFile(path_str.c_str());
+  return opened ? JNI_TRUE : JNI_FALSE;
+}
+
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_opacitylabs_opacitycore_OpacityCore_getLogStats(JNIEnv *env,
+                                                         jobject thiz) {
+  return env->NewStringUTF(opacity_bridge::logStatsJson().c_str());
+}
+
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_opacitylabs_opacitycore_OpacityCore_getMemoryStats(JNIEnv *env,
+                                                            jobject thiz) {
+  return env->NewStringUTF(opacity_bridge::memoryStatsJson().c_str());
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_opacitylabs_opacitycore_OpacityCore_setMemoryBudget(JNIEnv *env,
+                                                             jobject thiz,
+                                                             jlong bytes) {
+  opacity_bridge::setMemoryBudget(bytes > 0 ? static_cast<size_t>(bytes) : 0);
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_opacitylabs_opacitycore_OpacityCore_nativeTrimMemory(JNIEnv *env,
+                                                              jobject thiz,
+                                                              jint level) {
+  return static_cast<jlong>(opacity_bridge::trimBridgeMemory(level));
 }
@@ -0,0 +1,215 @@
+#include "OverlayPageMatcher.h"
+#include "Json.h"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+
+namespace opacity_bridge {
+
+namespace {
+
+// Scheme, host and the rest (path, query and fragment) of a URL or pattern.
+struct UrlParts {
+  std::string_view scheme;
+  std::string_view host;
+  std::string_view rest;
+};
+
+struct CompiledPattern {
+  std::string scheme;
+  std::string host;
+  std::string rest;
+};
+
+struct OverlayPage {
+  std::string id;
+  std::vector<CompiledPattern> patterns;
+};
+
+struct OverlayPages {
+  std::vector<OverlayPage> pages;
+  std::vector<std::string> origins;
+};
+
+std::mutex pagesMutex;
+std::shared_ptr<const OverlayPages> loadedPages;
+
+// Iterative glob match with single-star backtracking, linear in practice.
+bool globMatch(std::string_view pattern, std::string_view text) {
+  size_t p = 0, t = 0;
+  size_t starP = std::string_view::npos, starT = 0;
+  while (t < text.size()) {
+    if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == text[t])) {
+      p++;
+      t++;
+    } else if (p < pattern.size() && pattern[p] == '*') {
+      starP = p++;
+      starT = t;
+    } else if (starP != std::string_view::npos) {
+      p = starP + 1;
+      t = ++starT;
+    } else {
+      return false;
+    }
+  }
+  while (p < pattern.size() && pattern[p] == '*') {
+    p++;
+  }
+  return p == pattern.size();
+}
+
+// A pattern's host ends at the first '/', since '?' is a wildcard there;
+// a URL's also ends at a query or fragment.
+UrlParts splitUrl(std::string_view url, const char *hostEnds) {
+  UrlParts parts;
+  size_t schemeEnd = url.find("://");
+  if (schemeEnd != std::string_view::npos) {
+    parts.scheme = url.substr(0, schemeEnd);
+    url.remove_prefix(schemeEnd + 3);
+  }
+  size_t hostEnd = url.find_first_of(hostEnds);
+  parts.host = url.substr(0, hostEnd);
+  if (hostEnd != std::string_view::npos) {
+    parts.rest = url.substr(hostEnd);
+  }
+  return parts;
+}
+
+bool patternMatches(const CompiledPattern &pattern, const UrlParts &url) {
+  return (pattern.scheme.empty() || globMatch(pattern.scheme, url.scheme)) &&
+         globMatch(pattern.host, url.host) &&
+         (pattern.rest.empty() || globMatch(pattern.rest, url.rest));
+}
+
+bool hasWildcard(std::string_view text) {
+  return text.find_first_of("*?") != std::string_view::npos;
+}
+
+// Appends the origin rules covering a pattern. Returns false when its
+// scheme or host is open beyond what a rule can express, i.e. only "*"
+// covers it.
+bool appendOrigins(const UrlParts &pattern,
+                   std::vector<std::string> &origins) {
+  if (!pattern.scheme.empty() && pattern.scheme != "http" &&
+      pattern.scheme != "https") {
+    return false;
+  }
+  std::string_view host = pattern.host;
+  if (host.size() > 2 && host.compare(0, 2, "*.") == 0) {
+    host.remove_prefix(2);
+  }
+  if (host.empty() || hasWildcard(host)) {
+    return false;
+  }
+
+  for (std::string_view scheme : {"https", "http"}) {
+    if (pattern.scheme.empty() || pattern.scheme == scheme) {
+      std::string origin(scheme);
+      origin.append("://");
+      origin.append(pattern.host);
+      origins.push_back(std::move(origin));
+    }
+  }
+  return true;
+}
+
+bool parseDefinition(std::string_view json, OverlayPages &out) {
+  JsonValue root;
+  if (!parseJson(json, root) || root.type != JsonValue::Type::Object) {
+    return false;
+  }
+  const JsonValue *pages = root.find("pages");
+  if (pages == nullptr || pages->type != JsonValue::Type::Array) {
+    return false;
+  }
+
+  bool anyHost = false;
+  for (const JsonValue &item : pages->items) {
+    if (item.type != JsonValue::Type::Object) {
+      return false;
+    }
+    const JsonValue *id = item.find("id");
+    const JsonValue *patterns = item.find("url_patterns");
+    if (id == nullptr || id->type != JsonValue::Type::String ||
+        patterns == nullptr || patterns->type != JsonValue::Type::Array) {
+      return false;
+    }
+
+    OverlayPage page;
+    page.id = id->text;
+    for (const JsonValue &pattern : patterns->items) {
+      if (pattern.type != JsonValue::Type::String || pattern.text.empty()) {
+        return false;
+      }
+      UrlParts parts = splitUrl(pattern.text, "/");
+      page.patterns.push_back({std::string(parts.scheme),
+                               std::string(parts.host),
+                               std::string(parts.rest)});
+      if (!anyHost && !appendOrigins(parts, out.origins)) {
+        anyHost = true;
+      }
+    }
+    out.pages.push_back(std::move(page));
+  }
+
+  if (anyHost) {
+    out.origins.assign(1, "*");
+  } else {
+    std::sort(out.origins.begin(), out.origins.end());
+    out.origins.erase(std::unique(out.origins.begin(), out.origins.end()),
+                      out.origins.end());
+  }
+  return true;
+}
+
+std::shared_ptr<const OverlayPages> currentPages() {
+  std::lock_guard<std::mutex> lock(pagesMutex);
+  return loadedPages;
+}
+
+} // namespace
+
+int loadOverlayPages(std::string_view json) {
+  auto pages = std::make_shared<OverlayPages>();
+  bool parsed = parseDefinition(json, *pages);
+
+  int count = parsed ? static_cast<int>(pages->pages.size()) : -1;
+  std::lock_guard<std::mutex> lock(pagesMutex);
+  if (parsed) {
+    loadedPages = std::move(pages);
+  } else {
+    loadedPages.reset();
+  }
+  return count;
+}
+
+void clearOverlayPages() {
+  std::lock_guard<std::mutex> lock(pagesMutex);
+  loadedPages.reset();
+}
+
+bool matchOverlayPage(std::string_view url, std::string &pageId) {
+  std::shared_ptr<const OverlayPages> pages = currentPages();
+  if (!pages) {
+    return false;
+  }
+
+  UrlParts parts = splitUrl(url, "/?#");
+  for (const OverlayPage &page : pages->pages) {
+    for (const CompiledPattern &pattern : page.patterns) {
+      if (patternMatches(pattern, parts)) {
+        pageId = page.id;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+std::vector<std::string> overlayPageOrigins() {
+  std::shared_ptr<const OverlayPages> pages = currentPages();
+  return pages ? pages->origins : std::vector<std::string>();
+}
+
+} // namespace opacity_bridge
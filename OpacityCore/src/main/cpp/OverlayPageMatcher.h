@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace opacity_bridge {
+
+// Compiled form of get_browser_overlay_pages_json, answering which overlay
+// page applies to a URL without a round trip through JavaScript.
+//
+// The definition is {"pages":[{"id":"...","url_patterns":["...",...]}]}.
+// Any other shape, a page without a string id, or a pattern that isn't a
+// non-empty string rejects the whole definition.
+//
+// Patterns are globs, "[scheme://]host[/path]", where '*' matches any run
+// of characters and '?' one character. Each part is matched against the
+// same part of the URL, so a wildcard in the host never reaches into the
+// path. A pattern without a scheme matches any scheme, and one without a
+// path matches every page of its host.
+
+// Replaces the loaded definition. Returns the number of pages, or -1 if
+// `json` is malformed (the previous definition is dropped either way).
+int loadOverlayPages(std::string_view json);
+
+// Drops the loaded definition.
+void clearOverlayPages();
+
+// Id of the first page matching `url`. Returns false when nothing matches
+// or no definition is loaded.
+bool matchOverlayPage(std::string_view url, std::string &pageId);
+
+// Origin rules in the WebViewCompat.addDocumentStartJavaScript format
+// ("https://host", "https://*.host") covering every URL a loaded pattern
+// can match, or {"*"} when a pattern leaves the host open. Empty when no
+// definition is loaded.
+std::vector<std::string> overlayPageOrigins();
+
+} // namespace opacity_bridge
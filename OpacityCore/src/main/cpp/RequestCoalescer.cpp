@@ -0,0 +1,217 @@
+#include "RequestCoalescer.h"
+#include "BridgeUtil.h"
+#include "Json.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace opacity_bridge {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct InFlight {
+  explicit InFlight(RequestPriority priority) : priority(priority) {}
+
+  std::string key;
+  AdmissionPriority priority;
+  bool done = false;
+  FlowResult result;
+};
+
+struct CacheEntry {
+  std::string key;
+  std::string name;
+  Clock::time_point expiresAt;
+  FlowResult result;
+};
+
+std::mutex coalescerMutex;
+std::condition_variable inFlightDone;
+std::unordered_map<uint64_t, std::shared_ptr<InFlight>> inFlight;
+std::unordered_map<uint64_t, CacheEntry> cache;
+std::unordered_map<std::string, int64_t> flowTtlMillis;
+// Bumped on invalidation so results of calls started before it aren't cached.
+std::unordered_map<std::string, uint64_t> flowGeneration;
+uint64_t globalGeneration = 0;
+
+std::atomic<uint64_t> statHits{0};
+std::atomic<uint64_t> statMisses{0};
+std::atomic<uint64_t> statCoalesced{0};
+std::atomic<uint64_t> statExecutions{0};
+
+std::string canonicalKey(const char *name, const char *params) {
+  std::string key(name);
+  key.push_back('\0');
+  if (params == nullptr) {
+    key.append("null");
+    return key;
+  }
+  JsonValue value;
+  if (parseJson(params, value)) {
+    appendCanonicalJson(key, value);
+  } else {
+    key.append(params);
+  }
+  return key;
+}
+
+uint64_t generationLocked(const std::string &name) {
+  auto it = flowGeneration.find(name);
+  return globalGeneration + (it == flowGeneration.end() ? 0 : it->second);
+}
+
+size_t entryBytes(const CacheEntry &entry) {
+  return entry.key.capacity() + entry.name.capacity() +
+         entry.result.payload.capacity() + sizeof(CacheEntry);
+}
+
+void eraseFlowLocked(const std::string &name) {
+  for (auto it = cache.begin(); it != cache.end();) {
+    if (it->second.name == name) {
+      it = cache.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+} // namespace
+
+FlowResult
+runCoalesced(const char *name, const char *params, RequestPriority priority,
+             const std::function<FlowResult(AdmissionPriority &)> &execute) {
+  std::string flow(name);
+  std::string key = canonicalKey(name, params);
+  uint64_t hash = fnv1a(key.data(), key.size());
+
+  std::unique_lock<std::mutex> lock(coalescerMutex);
+  auto ttl = flowTtlMillis.find(flow);
+  bool cacheable = ttl != flowTtlMillis.end() && ttl->second > 0;
+  if (cacheable) {
+    auto cached = cache.find(hash);
+    if (cached != cache.end() && cached->second.key == key) {
+      if (Clock::now() < cached->second.expiresAt) {
+        statHits.fetch_add(1, std::memory_order_relaxed);
+        return cached->second.result;
+      }
+      cache.erase(cached);
+    }
+    statMisses.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  auto running = inFlight.find(hash);
+  if (running != inFlight.end() && running->second->key == key) {
+    statCoalesced.fetch_add(1, std::memory_order_relaxed);
+    std::shared_ptr<InFlight> shared = running->second;
+    shared->priority.raise(priority);
+    inFlightDone.wait(lock, [&] { return shared->done; });
+    return shared->result;
+  }
+
+  // On a hash collision with a different running key, run uncoalesced
+  // rather than hand out someone else's result.
+  auto mine = std::make_shared<InFlight>(priority);
+  bool joinable = running == inFlight.end();
+  if (joinable) {
+    mine->key = key;
+    inFlight.emplace(hash, mine);
+  }
+  uint64_t generation = generationLocked(flow);
+  lock.unlock();
+
+  statExecutions.fetch_add(1, std::memory_order_relaxed);
+  FlowResult result = execute(mine->priority);
+
+  lock.lock();
+  ttl = flowTtlMillis.find(flow);
+  // 0 is OPACITY_OK, the same check OpacityCore.get makes.
+  if (result.status == 0 && ttl != flowTtlMillis.end() && ttl->second > 0 &&
+      generation == generationLocked(flow)) {
+    CacheEntry &entry = cache[hash];
+    entry.key = key;
+    entry.name = flow;
+    entry.expiresAt = Clock::now() + std::chrono::milliseconds(ttl->second);
+    entry.result = result;
+  }
+  if (joinable) {
+    mine->result = result;
+    mine->done = true;
+    inFlight.erase(hash);
+    inFlightDone.notify_all();
+  }
+  return result;
+}
+
+void setFlowCacheTtl(const char *name, int64_t ttlMillis) {
+  std::lock_guard<std::mutex> lock(coalescerMutex);
+  std::string flow(name);
+  if (ttlMillis <= 0) {
+    flowTtlMillis.erase(flow);
+    eraseFlowLocked(flow);
+  } else {
+    flowTtlMillis[flow] = ttlMillis;
+  }
+}
+
+void invalidateFlowCache(const char *name) {
+  std::lock_guard<std::mutex> lock(coalescerMutex);
+  if (name == nullptr) {
+    globalGeneration++;
+    cache.clear();
+    return;
+  }
+  std::string flow(name);
+  flowGeneration[flow]++;
+  eraseFlowLocked(flow);
+}
+
+size_t flowCacheBytes() {
+  std::lock_guard<std::mutex> lock(coalescerMutex);
+  size_t bytes = 0;
+  for (const auto &entry : cache) {
+    bytes += entryBytes(entry.second);
+  }
+  return bytes;
+}
+
+size_t clearFlowCache() {
+  std::lock_guard<std::mutex> lock(coalescerMutex);
+  size_t released = 0;
+  for (const auto &entry : cache) {
+    released += entryBytes(entry.second);
+  }
+  globalGeneration++;
+  cache.clear();
+  return released;
+}
+
+std::string requestCacheStatsJson() {
+  size_t entries, bytes = 0;
+  {
+    std::lock_guard<std::mutex> lock(coalescerMutex);
+    entries = cache.size();
+    for (const auto &entry : cache) {
+      bytes += entryBytes(entry.second);
+    }
+  }
+
+  char buf[256];
+  snprintf(buf, sizeof(buf),
+           "{\"hits\":%llu,\"misses\":%llu,\"coalesced\":%llu,"
+           "\"executions\":%llu,\"cached_entries\":%zu,\"cached_bytes\":%zu}",
+           static_cast<unsigned long long>(statHits.load()),
+           static_cast<unsigned long long>(statMisses.load()),
+           static_cast<unsigned long long>(statCoalesced.load()),
+           static_cast<unsigned long long>(statExecutions.load()), entries,
+           bytes);
+  return buf;
+}
+
+} // namespace opacity_bridge
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "RequestScheduler.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace opacity_bridge {
+
+// Outcome of one opacity_get, copied out of libsdk-owned memory so it can be
+// handed to several callers. `payload` is the result JSON when `status` is
+// OPACITY_OK and the error JSON otherwise.
+struct FlowResult {
+  int32_t status = 0;
+  std::string payload;
+};
+
+// Single-flight and TTL cache layer in front of opacity_get.
+//
+// Calls are keyed on a 64-bit hash of the flow name plus its params in
+// canonical JSON form (sorted keys, no whitespace). While a call for a key
+// is running, identical calls wait for it and share its result instead of
+// starting another flow. Flows with a TTL set through setFlowCacheTtl also
+// serve successful results from cache until the TTL expires or the flow is
+// invalidated. Errors are never cached.
+//
+// `execute` gets the admission priority of the call. It starts as
+// `priority` and is raised when a more urgent caller joins, so the shared
+// execution never queues behind the class of whoever happened to start it.
+FlowResult
+runCoalesced(const char *name, const char *params, RequestPriority priority,
+             const std::function<FlowResult(AdmissionPriority &)> &execute);
+
+// A TTL of 0 disables caching for the flow and drops its cached entries.
+void setFlowCacheTtl(const char *name, int64_t ttlMillis);
+
+// Drops cached results for `name`, or for every flow when `name` is null.
+// Results of calls already in flight when this runs are not cached.
+void invalidateFlowCache(const char *name);
+
+// Bytes held by cached results.
+size_t flowCacheBytes();
+// Drops every cached result and returns the bytes released.
+size_t clearFlowCache();
+
+// {"hits":..,"misses":..,"coalesced":..,"executions":..,"cached_entries":..,
+//  "cached_bytes":..}
+std::string requestCacheStatsJson();
+
+} // namespace opacity_bridge
@@ -0,0 +1,192 @@
+#include "RequestScheduler.h"
+#include "BridgeUtil.h"
+#include "LatencyHistogram.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+
+namespace opacity_bridge {
+
+namespace {
+
+constexpr int kClasses = 2;
+
+struct ClassState {
+  std::deque<uint64_t> waiting;
+  int running = 0;
+  std::atomic<uint64_t> rejected{0};
+  LatencyHistogram queueTime;
+  LatencyHistogram runTime;
+};
+
+std::mutex schedulerMutex;
+std::condition_variable slotsChanged;
+SchedulerConfig config;
+ClassState classes[kClasses];
+uint64_t nextTicket = 0;
+int interactiveStreak = 0;
+std::atomic<uint64_t> raisedWhileQueued{0};
+
+ClassState &stateFor(RequestPriority priority) {
+  return classes[static_cast<int>(priority)];
+}
+
+const char *className(int index) {
+  return index == static_cast<int>(RequestPriority::Interactive) ? "interactive"
+                                                                  : "background";
+}
+
+bool hasFreeSlot(RequestPriority priority) {
+  int running = classes[0].running + classes[1].running;
+  if (running >= config.maxInFlight) {
+    return false;
+  }
+  return priority == RequestPriority::Interactive ||
+         stateFor(RequestPriority::Background).running <
+             config.maxBackgroundInFlight;
+}
+
+// Which class the next free slot goes to, given who is waiting.
+bool isNextToAdmit(RequestPriority priority) {
+  ClassState &interactive = stateFor(RequestPriority::Interactive);
+  ClassState &background = stateFor(RequestPriority::Background);
+  bool interactiveReady = !interactive.waiting.empty() &&
+                          hasFreeSlot(RequestPriority::Interactive);
+  bool backgroundReady = !background.waiting.empty() &&
+                         hasFreeSlot(RequestPriority::Background);
+
+  if (priority == RequestPriority::Interactive) {
+    return interactiveReady &&
+           (!backgroundReady || interactiveStreak < config.interactiveBurst);
+  }
+  return backgroundReady &&
+         (!interactiveReady || interactiveStreak >= config.interactiveBurst);
+}
+
+} // namespace
+
+void configureScheduler(const SchedulerConfig &newConfig) {
+  std::lock_guard<std::mutex> lock(schedulerMutex);
+  config.maxInFlight = std::max(1, newConfig.maxInFlight);
+  config.maxBackgroundInFlight =
+      std::max(1, std::min(newConfig.maxBackgroundInFlight, config.maxInFlight));
+  config.maxQueued = std::max(0, newConfig.maxQueued);
+  config.interactiveBurst = std::max(1, newConfig.interactiveBurst);
+  slotsChanged.notify_all();
+}
+
+AdmissionTicket::AdmissionTicket(RequestPriority priority,
+                                 uint64_t admittedAtNanos)
+    : priority_(priority), admittedAtNanos_(admittedAtNanos), admitted_(true) {}
+
+AdmissionTicket::AdmissionTicket(AdmissionTicket &&other) noexcept
+    : priority_(other.priority_), admittedAtNanos_(other.admittedAtNanos_),
+      admitted_(other.admitted_) {
+  other.admitted_ = false;
+}
+
+AdmissionTicket::~AdmissionTicket() {
+  if (!admitted_) {
+    return;
+  }
+  ClassState &state = stateFor(priority_);
+  state.runTime.record(monotonicNanos() - admittedAtNanos_);
+  std::lock_guard<std::mutex> lock(schedulerMutex);
+  state.running--;
+  slotsChanged.notify_all();
+}
+
+void AdmissionPriority::raise(RequestPriority priority) {
+  int current = value_.load(std::memory_order_relaxed);
+  while (static_cast<int>(priority) < current) {
+    if (value_.compare_exchange_weak(current, static_cast<int>(priority),
+                                     std::memory_order_acq_rel)) {
+      // Taking the lock orders the store with a waiter's predicate check.
+      std::lock_guard<std::mutex> lock(schedulerMutex);
+      slotsChanged.notify_all();
+      return;
+    }
+  }
+}
+
+AdmissionTicket admitRequest(AdmissionPriority &priority) {
+  uint64_t queuedAt = monotonicNanos();
+
+  std::unique_lock<std::mutex> lock(schedulerMutex);
+  RequestPriority current = priority.get();
+  uint64_t ticket = nextTicket++;
+  stateFor(current).waiting.push_back(ticket);
+  auto admissible = [&] {
+    RequestPriority raised = priority.get();
+    if (raised != current) {
+      std::deque<uint64_t> &from = stateFor(current).waiting;
+      from.erase(std::find(from.begin(), from.end(), ticket));
+      std::deque<uint64_t> &to = stateFor(raised).waiting;
+      to.insert(std::upper_bound(to.begin(), to.end(), ticket), ticket);
+      raisedWhileQueued.fetch_add(1, std::memory_order_relaxed);
+      current = raised;
+    }
+    return stateFor(current).waiting.front() == ticket &&
+           isNextToAdmit(current);
+  };
+  if (!admissible()) {
+    ClassState &state = stateFor(current);
+    if (static_cast<int>(state.waiting.size()) - 1 >= config.maxQueued) {
+      state.waiting.pop_back();
+      state.rejected.fetch_add(1, std::memory_order_relaxed);
+      return AdmissionTicket();
+    }
+    slotsChanged.wait(lock, admissible);
+  }
+  ClassState &state = stateFor(current);
+  state.waiting.pop_front();
+
+  state.running++;
+  if (current == RequestPriority::Interactive) {
+    interactiveStreak++;
+  } else {
+    interactiveStreak = 0;
+  }
+  // Others may now be admissible, e.g. the next background request once the
+  // streak was reset.
+  slotsChanged.notify_all();
+  lock.unlock();
+
+  uint64_t admittedAt = monotonicNanos();
+  state.queueTime.record(admittedAt - queuedAt);
+  return AdmissionTicket(current, admittedAt);
+}
+
+std::string schedulerStatsJson() {
+  std::string out;
+  out.reserve(1024);
+  char buf[160];
+  std::lock_guard<std::mutex> lock(schedulerMutex);
+  snprintf(buf, sizeof(buf),
+           "{\"max_in_flight\":%d,\"max_background_in_flight\":%d,"
+           "\"max_queued\":%d,\"raised_while_queued\":%llu",
+           config.maxInFlight, config.maxBackgroundInFlight, config.maxQueued,
+           static_cast<unsigned long long>(raisedWhileQueued.load()));
+  out.append(buf);
+  for (int i = 0; i < kClasses; i++) {
+    const ClassState &state = classes[i];
+    snprintf(buf, sizeof(buf),
+             ",\"%s\":{\"running\":%d,\"queued\":%zu,\"rejected\":%llu,"
+             "\"queue_time\":",
+             className(i), state.running, state.waiting.size(),
+             static_cast<unsigned long long>(state.rejected.load()));
+    out.append(buf);
+    state.queueTime.appendJson(out);
+    out.append(",\"run_time\":");
+    state.runTime.appendJson(out);
+    out.push_back('}');
+  }
+  out.push_back('}');
+  return out;
+}
+
+} // namespace opacity_bridge
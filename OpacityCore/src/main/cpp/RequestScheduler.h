@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace opacity_bridge {
+
+// Matches OpacityCore.Priority on the Kotlin side.
+enum class RequestPriority : int {
+  Interactive = 0,
+  Background = 1,
+};
+
+// Admission control in front of opacity_get.
+//
+// At most maxInFlight flows run at once, and background flows never take
+// more than maxBackgroundInFlight of those slots, so a burst of background
+// work always leaves room for a user-facing request. Waiting requests are
+// admitted FIFO within their class. Interactive requests go first, but
+// after interactiveBurst interactive admissions in a row a waiting
+// background request is let through so it can't starve. A request is
+// rejected straight away when maxQueued requests of its class are already
+// waiting.
+struct SchedulerConfig {
+  int maxInFlight = 4;
+  int maxBackgroundInFlight = 2;
+  int maxQueued = 32;
+  int interactiveBurst = 4;
+};
+
+void configureScheduler(const SchedulerConfig &config);
+
+// Holds a slot for the lifetime of the object once admitted.
+class AdmissionTicket {
+public:
+  AdmissionTicket() = default;
+  AdmissionTicket(RequestPriority priority, uint64_t admittedAtNanos);
+  AdmissionTicket(AdmissionTicket &&other) noexcept;
+  AdmissionTicket &operator=(AdmissionTicket &&other) = delete;
+  AdmissionTicket(const AdmissionTicket &) = delete;
+  ~AdmissionTicket();
+
+  bool admitted() const { return admitted_; }
+
+private:
+  RequestPriority priority_ = RequestPriority::Interactive;
+  uint64_t admittedAtNanos_ = 0;
+  bool admitted_ = false;
+};
+
+// Priority of a request that may be raised while it waits, e.g. when an
+// interactive caller joins a coalesced execution started in the background.
+class AdmissionPriority {
+public:
+  explicit AdmissionPriority(RequestPriority priority)
+      : value_(static_cast<int>(priority)) {}
+
+  RequestPriority get() const {
+    return static_cast<RequestPriority>(value_.load(std::memory_order_acquire));
+  }
+  // Raises to `priority` if that is more urgent and moves a waiting request
+  // to the queue of its new class, keeping its place by arrival time.
+  void raise(RequestPriority priority);
+
+private:
+  std::atomic<int> value_;
+};
+
+// Blocks until the request may run, or returns a ticket that is not
+// admitted when the queue for its class is full. The request is admitted
+// in whatever class `priority` holds when a slot frees up.
+AdmissionTicket admitRequest(AdmissionPriority &priority);
+
+// Per class queue/run time histograms, rejections and current occupancy.
+std::string schedulerStatsJson();
+
+} // namespace opacity_bridge
@@ -0,0 +1,226 @@
+#include "TraceRecorder.h"
+#include "BridgeUtil.h"
+#include "Json.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+namespace opacity_bridge {
+
+namespace {
+
+constexpr size_t kEventsPerThread = 1024;
+
+struct TraceEventData {
+  uint64_t startNanos;
+  uint64_t durationNanos;
+  const char *category;
+  char phase;
+  char name[kTraceNameCapacity];
+};
+
+// One ring slot, guarded by a seqlock so a dump never reads an event the
+// owning thread is overwriting. The sequence is odd while a write is in
+// progress and 2 * (n + 1) once event n of the thread is complete.
+struct TraceEvent {
+  std::atomic<uint64_t> sequence{0};
+  TraceEventData data;
+};
+
+struct ThreadTraceBuffer {
+  std::atomic<long> tid{0};
+  // Total events written; the ring index is head % kEventsPerThread. Only
+  // the owning thread writes, dumps read up to the published head.
+  std::atomic<uint64_t> head{0};
+  // Events before this index were dropped by clearTrace. Kept apart from
+  // head so that clearing never races with the writer.
+  std::atomic<uint64_t> clearedBefore{0};
+  TraceEvent events[kEventsPerThread];
+};
+
+std::atomic<bool> tracingEnabled{false};
+
+// Buffers are never freed, since a dump may run concurrently with a thread
+// exiting. Instead an exited thread releases its buffer and the next new
+// thread takes it over; its events stay in dumps until then. Leaked so that
+// threads exiting during static destruction can still release theirs.
+std::mutex &buffersMutex = *new std::mutex();
+std::vector<ThreadTraceBuffer *> &buffers =
+    *new std::vector<ThreadTraceBuffer *>();
+std::vector<ThreadTraceBuffer *> &freeBuffers =
+    *new std::vector<ThreadTraceBuffer *>();
+
+// Releases the thread's buffer when the thread exits.
+struct BufferOwner {
+  ThreadTraceBuffer *buffer = nullptr;
+
+  ~BufferOwner() {
+    if (buffer != nullptr) {
+      std::lock_guard<std::mutex> lock(buffersMutex);
+      freeBuffers.push_back(buffer);
+    }
+  }
+};
+
+ThreadTraceBuffer *acquireBuffer() {
+  std::lock_guard<std::mutex> lock(buffersMutex);
+  if (freeBuffers.empty()) {
+    ThreadTraceBuffer *buffer = new ThreadTraceBuffer();
+    buffers.push_back(buffer);
+    return buffer;
+  }
+  // The longest released buffer, whose events are the oldest. They are
+  // dropped as for clearTrace so they aren't dumped under the new thread.
+  ThreadTraceBuffer *buffer = freeBuffers.front();
+  freeBuffers.erase(freeBuffers.begin());
+  buffer->clearedBefore.store(buffer->head.load(std::memory_order_relaxed),
+                              std::memory_order_release);
+  return buffer;
+}
+
+ThreadTraceBuffer *currentThreadBuffer() {
+  thread_local BufferOwner owner;
+  if (owner.buffer == nullptr) {
+    owner.buffer = acquireBuffer();
+    owner.buffer->tid.store(syscall(SYS_gettid), std::memory_order_relaxed);
+  }
+  return owner.buffer;
+}
+
+void record(char phase, const char *category, const char *name,
+            size_t nameLength, uint64_t startNanos, uint64_t durationNanos) {
+  ThreadTraceBuffer *buffer = currentThreadBuffer();
+  uint64_t head = buffer->head.load(std::memory_order_relaxed);
+  TraceEvent &slot = buffer->events[head % kEventsPerThread];
+  slot.sequence.store(2 * head + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  TraceEventData &event = slot.data;
+  event.startNanos = startNanos;
+  event.durationNanos = durationNanos;
+  event.category = category;
+  event.phase = phase;
+  size_t length = std::min(nameLength, kTraceNameCapacity - 1);
+  memcpy(event.name, name, length);
+  event.name[length] = '\0';
+  slot.sequence.store(2 * head + 2, std::memory_order_release);
+  buffer->head.store(head + 1, std::memory_order_release);
+}
+
+void appendEvent(std::string &out, const TraceEventData &event, long pid,
+                 long tid) {
+  char numbers[160];
+  out.append("{\"name\":");
+  appendJsonString(out, event.name);
+  out.append(",\"cat\":");
+  appendJsonString(out, event.category);
+  if (event.phase == 'X') {
+    snprintf(numbers, sizeof(numbers),
+             ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%ld,\"tid\":%ld}",
+             event.startNanos / 1000.0, event.durationNanos / 1000.0, pid, tid);
+  } else {
+    snprintf(numbers, sizeof(numbers),
+             ",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%ld,\"tid\":%ld}",
+             event.startNanos / 1000.0, pid, tid);
+  }
+  out.append(numbers);
+}
+
+// Copies event `index` of a ring out of `slot`. Returns false if the slot
+// holds another event or was written to during the copy.
+bool readEvent(const TraceEvent &slot, uint64_t index, TraceEventData &out) {
+  uint64_t expected = 2 * index + 2;
+  if (slot.sequence.load(std::memory_order_acquire) != expected) {
+    return false;
+  }
+  out = slot.data;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return slot.sequence.load(std::memory_order_relaxed) == expected;
+}
+
+} // namespace
+
+bool isTracingEnabled() {
+  return tracingEnabled.load(std::memory_order_relaxed);
+}
+
+void setTracingEnabled(bool enabled) {
+  tracingEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+void traceComplete(const char *category, const char *name, size_t nameLength,
+                   uint64_t startNanos, uint64_t endNanos) {
+  if (!isTracingEnabled()) {
+    return;
+  }
+  record('X', category, name, nameLength, startNanos,
+         endNanos > startNanos ? endNanos - startNanos : 0);
+}
+
+void traceInstant(const char *category, const char *name, size_t nameLength) {
+  if (!isTracingEnabled()) {
+    return;
+  }
+  record('i', category, name, nameLength, monotonicNanos(), 0);
+}
+
+bool dumpTrace(const char *path) {
+  FILE *file = fopen(path, "w");
+  if (file == nullptr) {
+    return false;
+  }
+
+  std::vector<ThreadTraceBuffer *> snapshot;
+  {
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    snapshot = buffers;
+  }
+
+  long pid = getpid();
+  std::string chunk;
+  chunk.reserve(64 * 1024);
+  chunk.append("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  bool first = true;
+  for (ThreadTraceBuffer *buffer : snapshot) {
+    uint64_t head = buffer->head.load(std::memory_order_acquire);
+    uint64_t begin = std::max(
+        head > kEventsPerThread ? head - kEventsPerThread : 0,
+        buffer->clearedBefore.load(std::memory_order_acquire));
+    for (uint64_t i = begin; i < head; i++) {
+      TraceEventData event;
+      if (!readEvent(buffer->events[i % kEventsPerThread], i, event)) {
+        // Overwritten by the owning thread since head was read.
+        continue;
+      }
+      if (!first) {
+        chunk.push_back(',');
+      }
+      first = false;
+      appendEvent(chunk, event, pid,
+                  buffer->tid.load(std::memory_order_relaxed));
+      if (chunk.size() > 60 * 1024) {
+        fwrite(chunk.data(), 1, chunk.size(), file);
+        chunk.clear();
+      }
+    }
+  }
+  chunk.append("]}\n");
+  fwrite(chunk.data(), 1, chunk.size(), file);
+  return fclose(file) == 0;
+}
+
+void clearTrace() {
+  std::lock_guard<std::mutex> lock(buffersMutex);
+  for (ThreadTraceBuffer *buffer : buffers) {
+    buffer->clearedBefore.store(buffer->head.load(std::memory_order_acquire),
+                                std::memory_order_release);
+  }
+}
+
+} // namespace opacity_bridge
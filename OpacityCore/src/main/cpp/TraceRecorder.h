@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace opacity_bridge {
+
+// In-process trace recorder producing Chrome trace-event JSON, loadable in
+// chrome://tracing and ui.perfetto.dev.
+//
+// Each thread appends into its own fixed-size ring, so recording takes no
+// locks; the oldest events of a thread are overwritten once its ring is
+// full. Timestamps use CLOCK_MONOTONIC, the same clock as Kotlin's
+// System.nanoTime(), so spans measured on either side of the bridge line up.
+constexpr size_t kTraceNameCapacity = 64;
+
+bool isTracingEnabled();
+void setTracingEnabled(bool enabled);
+
+// Records a complete ("X") event. `name` is copied and truncated to
+// kTraceNameCapacity - 1 bytes; `category` must be a string literal.
+void traceComplete(const char *category, const char *name, size_t nameLength,
+                   uint64_t startNanos, uint64_t endNanos);
+// Records an instant ("i") event at the current time.
+void traceInstant(const char *category, const char *name, size_t nameLength);
+
+// Writes every buffered event to `path`. Returns false if the file could not
+// be written. Recording may continue while a dump is in progress; events
+// overwritten while the dump reads them are left out.
+bool dumpTrace(const char *path);
+// Drops all buffered events. Events recorded concurrently may survive.
+void clearTrace();
+
+} // namespace opacity_bridge
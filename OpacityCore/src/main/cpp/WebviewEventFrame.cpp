@@ -0,0 +1,187 @@
+#include "WebviewEventFrame.h"
+#include "Json.h"
+
+namespace opacity_bridge {
+
+namespace {
+
+uint32_t readU32(const uint8_t *p) {
+  return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+         (static_cast<uint32_t>(p[2]) << 16) |
+         (static_cast<uint32_t>(p[3]) << 24);
+}
+
+const char *eventName(WebviewEventKind kind) {
+  switch (kind) {
+  case WebviewEventKind::Navigation:
+    return "navigation";
+  case WebviewEventKind::LocationChanged:
+    return "location_changed";
+  case WebviewEventKind::InterceptedRequest:
+    return "intercepted_request";
+  case WebviewEventKind::Close:
+    return "close";
+  }
+  return "unknown";
+}
+
+void appendKey(std::string &out, const char *key) {
+  out.push_back(',');
+  out.push_back('"');
+  out.append(key);
+  out.append("\":");
+}
+
+} // namespace
+
+bool decodeWebviewEventFrame(const uint8_t *data, size_t length,
+                             WebviewEvent &out) {
+  if (data == nullptr || length < kWebviewEventFrameHeaderSize) {
+    return false;
+  }
+  if (data[0] != 'O' || data[1] != 'W' ||
+      data[2] != kWebviewEventFrameVersion) {
+    return false;
+  }
+
+  uint8_t kind = data[3];
+  if (kind < static_cast<uint8_t>(WebviewEventKind::Navigation) ||
+      kind > static_cast<uint8_t>(WebviewEventKind::Close)) {
+    return false;
+  }
+  out.kind = static_cast<WebviewEventKind>(kind);
+  out.fields.clear();
+
+  size_t offset = kWebviewEventFrameHeaderSize;
+  while (offset < length) {
+    if (length - offset < kWebviewEventFieldHeaderSize) {
+      return false;
+    }
+    auto tag = static_cast<WebviewEventTag>(data[offset]);
+    uint32_t fieldLength = readU32(data + offset + 1);
+    offset += kWebviewEventFieldHeaderSize;
+    if (fieldLength > length - offset) {
+      return false;
+    }
+    out.fields.push_back(
+        {tag, std::string_view(reinterpret_cast<const char *>(data + offset),
+                               fieldLength)});
+    offset += fieldLength;
+  }
+  return true;
+}
+
+void beginWebviewEventFrame(std::string &out, WebviewEventKind kind) {
+  out.clear();
+  out.push_back('O');
+  out.push_back('W');
+  out.push_back(static_cast<char>(kWebviewEventFrameVersion));
+  out.push_back(static_cast<char>(kind));
+}
+
+void appendWebviewEventField(std::string &out, WebviewEventTag tag,
+                             std::string_view value) {
+  auto length = static_cast<uint32_t>(value.size());
+  out.push_back(static_cast<char>(tag));
+  for (int shift = 0; shift < 32; shift += 8) {
+    out.push_back(static_cast<char>((length >> shift) & 0xFF));
+  }
+  out.append(value);
+}
+
+std::string webviewEventToJson(const WebviewEvent &event) {
+  size_t estimate = 64;
+  for (const auto &field : event.fields) {
+    estimate += field.value.size() + 16;
+  }
+
+  std::string out;
+  out.reserve(estimate);
+  out.append("{\"event\":\"");
+  out.append(eventName(event.kind));
+  out.push_back('"');
+
+  bool hasVisitedUrls = false;
+  bool hasCookies = false;
+  for (const auto &field : event.fields) {
+    switch (field.tag) {
+    case WebviewEventTag::Id:
+      appendKey(out, "id");
+      appendJsonString(out, field.value);
+      break;
+    case WebviewEventTag::Url:
+      appendKey(out, "url");
+      appendJsonString(out, field.value);
+      break;
+    case WebviewEventTag::HtmlBody:
+      appendKey(out, "html_body");
+      appendJsonString(out, field.value);
+      break;
+    case WebviewEventTag::RequestType:
+      appendKey(out, "request_type");
+      appendJsonString(out, field.value);
+      break;
+    case WebviewEventTag::Data:
+      appendKey(out, "data");
+      out.append(field.value.empty() ? std::string_view("null") : field.value);
+      break;
+    case WebviewEventTag::VisitedUrl:
+      hasVisitedUrls = true;
+      break;
+    case WebviewEventTag::Cookies:
+    case WebviewEventTag::CookieName:
+    case WebviewEventTag::CookieValue:
+      hasCookies = true;
+      break;
+    default:
+      // Delta fields only travel on the binary path.
+      break;
+    }
+  }
+
+  // Navigation events always carry the list, even when empty.
+  if (hasVisitedUrls || event.kind == WebviewEventKind::Navigation) {
+    appendKey(out, "visited_urls");
+    out.push_back('[');
+    bool first = true;
+    for (const auto &field : event.fields) {
+      if (field.tag != WebviewEventTag::VisitedUrl) {
+        continue;
+      }
+      if (!first) {
+        out.push_back(',');
+      }
+      appendJsonString(out, field.value);
+      first = false;
+    }
+    out.push_back(']');
+  }
+
+  if (hasCookies) {
+    appendKey(out, "cookies");
+    out.push_back('{');
+    bool first = true;
+    const std::string_view *pendingName = nullptr;
+    for (const auto &field : event.fields) {
+      if (field.tag == WebviewEventTag::CookieName) {
+        pendingName = &field.value;
+      } else if (field.tag == WebviewEventTag::CookieValue &&
+                 pendingName != nullptr) {
+        if (!first) {
+          out.push_back(',');
+        }
+        appendJsonString(out, *pendingName);
+        out.push_back(':');
+        appendJsonString(out, field.value);
+        pendingName = nullptr;
+        first = false;
+      }
+    }
+    out.push_back('}');
+  }
+
+  out.push_back('}');
+  return out;
+}
+
+} // namespace opacity_bridge
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace opacity_bridge {
+
+// Binary webview event ABI shared with WebviewEventFrame.kt.
+//
+// A frame is a 4 byte header followed by zero or more fields:
+//
+//   header: 'O' 'W' <version:u8> <kind:u8>
+//   field:  <tag:u8> <length:u32 little-endian> <length bytes>
+//
+// String fields are raw UTF-8 without a terminator. Repeatable fields
+// (visited URLs, cookie name/value pairs) appear once per element, in order.
+constexpr uint8_t kWebviewEventFrameVersion = 1;
+constexpr size_t kWebviewEventFrameHeaderSize = 4;
+constexpr size_t kWebviewEventFieldHeaderSize = 5;
+
+enum class WebviewEventKind : uint8_t {
+  Navigation = 1,
+  LocationChanged = 2,
+  InterceptedRequest = 3,
+  Close = 4,
+};
+
+enum class WebviewEventTag : uint8_t {
+  Id = 1,
+  Url = 2,
+  VisitedUrl = 3,
+  CookieName = 4,
+  CookieValue = 5,
+  HtmlBody = 6,
+  RequestType = 7,
+  // Raw JSON text, forwarded as-is.
+  Data = 8,
+  // HTML delta mode, see HtmlDelta.h. Ids are u64 little-endian.
+  HtmlSnapshotId = 9,
+  HtmlBaseSnapshotId = 10,
+  // <offset:u32> <length:u32> little-endian, a byte range of the base snapshot.
+  HtmlChunkRef = 11,
+  // Literal bytes of the new snapshot.
+  HtmlChunk = 12,
+  // Empty marker: the event carries a cookie object, possibly with no
+  // CookieName/CookieValue pairs, rendered as "cookies":{}.
+  Cookies = 13,
+};
+
+struct WebviewEventField {
+  WebviewEventTag tag;
+  std::string_view value;
+};
+
+// A decoded frame. Field values point into the frame buffer and are only
+// valid while that buffer is.
+struct WebviewEvent {
+  WebviewEventKind kind;
+  std::vector<WebviewEventField> fields;
+};
+
+// Returns false if the frame is truncated, has a bad header or an unknown
+// kind. Unknown field tags are kept so newer writers stay compatible.
+bool decodeWebviewEventFrame(const uint8_t *data, size_t length,
+                             WebviewEvent &out);
+
+// Encoding counterparts of the Kotlin writer, used when the bridge rewrites a
+// frame before handing it to libsdk.
+void beginWebviewEventFrame(std::string &out, WebviewEventKind kind);
+void appendWebviewEventField(std::string &out, WebviewEventTag tag,
+                             std::string_view value);
+
+// Renders the event in the JSON shape emit_webview_event has always received.
+std::string webviewEventToJson(const WebviewEvent &event);
+
+} // namespace opacity_bridge
@@ -0,0 +1,102 @@
+package com.opacitylabs.opacitycore
+
+import java.util.concurrent.ConcurrentHashMap
+import java.util.concurrent.CountDownLatch
+import java.util.concurrent.TimeUnit
+
+/**
+ * Tracks Rust threads parked in blocking upcalls (evalJs and the cookie getters) so they can
+ * be released together when the browser goes away, the flow is cancelled or a deadline
+ * passes, instead of each one sitting out its full timeout.
+ *
+ * Deadlines and cancellation belong to a browser flow, which starts at [beginFlow]. Once a
+ * flow is cancelled, later waits fail fast as cancelled until the next flow begins.
+ */
+internal object BlockingUpcalls {
+    /** Codes shared with the native blocked-wait metrics. */
+    enum class Kind(val code: Int) {
+        EVAL_JS(0),
+        COOKIES_FOR_CURRENT_URL(1),
+        COOKIES_FOR_DOMAIN(2),
+    }
+
+    enum class Outcome(val code: Int) {
+        COMPLETED(0),
+        TIMED_OUT(1),
+        CANCELLED(2),
+    }
+
+    private class Waiter(val latch: CountDownLatch) {
+        @Volatile
+        var cancelled = false
+    }
+
+    private val waiters = ConcurrentHashMap.newKeySet<Waiter>()
+
+    /** Deadline applied to each flow from its start, in milliseconds; 0 for none. */
+    @Volatile
+    private var flowBudgetMs = 0L
+
+    /** [System.nanoTime] after which waits of the current flow time out; 0 for none. */
+    @Volatile
+    private var deadlineNanos = 0L
+
+    @Volatile
+    private var flowCancelled = false
+
+    fun await(kind: Kind, latch: CountDownLatch, timeoutMs: Long): Outcome {
+        val start = System.nanoTime()
+        val waiter = Waiter(latch)
+        // Registered before checking the flag so a concurrent cancelAll can't be missed.
+        waiters.add(waiter)
+        var outcome = Outcome.TIMED_OUT
+        try {
+            var waitNanos = TimeUnit.MILLISECONDS.toNanos(timeoutMs)
+            val deadline = deadlineNanos
+            if (deadline != 0L) {
+                waitNanos = minOf(waitNanos, deadline - start)
+            }
+            if (flowCancelled) {
+                waiter.cancelled = true
+            }
+            val released = !waiter.cancelled && waitNanos > 0 &&
+                latch.await(waitNanos, TimeUnit.NANOSECONDS)
+            outcome = when {
+                waiter.cancelled -> Outcome.CANCELLED
+                released -> Outcome.COMPLETED
+                else -> Outcome.TIMED_OUT
+            }
+        } finally {
+            waiters.remove(waiter)
+            OpacityCore.recordBlockedWait(kind.code, outcome.code, System.nanoTime() - start)
+        }
+        return outcome
+    }
+
+    /** Starts a flow: clears a previous cancellation and starts the flow's deadline. */
+    fun beginFlow() {
+        val budgetMs = flowBudgetMs
+        deadlineNanos =
+            if (budgetMs > 0) System.nanoTime() + TimeUnit.MILLISECONDS.toNanos(budgetMs) else 0L
+        flowCancelled = false
+    }
+
+    /**
+     * Releases every thread currently waiting with [Outcome.CANCELLED], and fails later waits
+     * the same way until the next [beginFlow].
+     */
+    fun cancelAll() {
+        flowCancelled = true
+        for (waiter in waiters) {
+            if (waiter.latch.count > 0) {
+                waiter.cancelled = true
+                waiter.latch.countDown()
+            }
+        }
+    }
+
+    /** Applies from the next [beginFlow]. */
+    fun setFlowBudget(timeoutMs: Long) {
+        flowBudgetMs = maxOf(timeoutMs, 0L)
+    }
+}
@@ -5,7 +5,6 @@ import android.os.Parcel
 import android.os.Parcelable
 import org.json.JSONObject
 import java.util.concurrent.CountDownLatch
-import java.util.concurrent.TimeUnit
 
 
 class CookieResultReceiver() : Parcelable {
@@ -19,9 +18,10 @@ class CookieResultReceiver() : Parcelable {
         latch.countDown()
     }
 
-    fun waitForResult(timeoutMs: Long): JSONObject? {
-        latch.await(timeoutMs, TimeUnit.MILLISECONDS)
-        return cookies
+    /** Returns null when the wait timed out or was cancelled. */
+    fun waitForResult(kind: BlockingUpcalls.Kind, timeoutMs: Long): JSONObject? {
+        val outcome = BlockingUpcalls.await(kind, latch, timeoutMs)
+        return if (outcome == BlockingUpcalls.Outcome.COMPLETED) cookies else null
     }
 
     override fun writeToParcel(parcel: Parcel, flags: Int) {}
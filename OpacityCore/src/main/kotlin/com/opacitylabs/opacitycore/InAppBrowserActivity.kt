@@ -101,9 +101,15 @@ class InAppBrowserActivity : AppCompatActivity() {
     private val pendingPostBodies = java.util.concurrent.ConcurrentHashMap<String, String>()
     private var overlayEnabled = false
     private var overlayScriptsInstalledAtDocumentStart = false
+    // When the overlay pages definition compiles, scripts are installed only for the origins
+    // of its pages, or without document-start support evaluated only on pages it matches.
+    private var overlayPageMatcherLoaded = false
     private var overlayBootstrapScript: String? = null
     private var overlayObserverScript: String? = null
     private var overlayRendererScript: String? = null
+    // Whether this activity adopted a WebView built by WebViewPrewarmer.
+    private var prewarmed = false
+    private var clearHistoryOnPageFinished = false
 
     private val changeUrlReceiver =
         object : BroadcastReceiver() {
@@ -127,13 +133,13 @@ class InAppBrowserActivity : AppCompatActivity() {
                 val requestData = JSONObject(json)
                 emitInterceptedRequest(requestData)
             } catch (e: Exception) {
-                Log.e("Opacity SDK", "Error parsing intercepted request", e)
+                NativeLog.e("onInterceptedRequest", "Error parsing intercepted request", e)
             }
         }
 
         @JavascriptInterface
         fun storePostBody(url: String, body: String) {
-            Log.d("Opacity SDK", "storePostBody: url=$url (${body.length} bytes)")
+            NativeLog.d("storePostBody") { "url=$url (${body.length} bytes)" }
             pendingPostBodies[url] = body
         }
 
@@ -172,8 +178,11 @@ class InAppBrowserActivity : AppCompatActivity() {
             return
         }
 
+        val overlayOriginRules = overlayOriginRules(overlayPageMatcherLoaded)
+        if (overlayOriginRules.isEmpty()) {
+            return
+        }
         try {
-            val overlayOriginRules = setOf("*")
             WebViewCompat.addDocumentStartJavaScript(webView, bootstrap, overlayOriginRules)
             WebViewCompat.addDocumentStartJavaScript(webView, observer, overlayOriginRules)
             overlayScriptsInstalledAtDocumentStart = true
@@ -182,14 +191,24 @@ class InAppBrowserActivity : AppCompatActivity() {
         }
     }
 
-    private fun injectOverlayScriptsIntoPage(view: WebView?) {
+    private fun injectOverlayScriptsIntoPage(view: WebView?, url: String?) {
         if (!overlayEnabled || overlayScriptsInstalledAtDocumentStart) {
             return
         }
+        if (overlayPageMatcherLoaded &&
+            (url == null || OpacityCore.matchBrowserOverlayPage(url) == null)
+        ) {
+            return
+        }
 
         val target = view ?: webView
-        overlayBootstrapScript?.let { target.evaluateJavascript(it, null) }
-        overlayObserverScript?.let { target.evaluateJavascript(it, null) }
+        // Several page callbacks land here for one document; only the first runs the scripts.
+        target.evaluateJavascript(OVERLAY_FIRST_RUN_SCRIPT) { firstRun ->
+            if (firstRun == "true") {
+                overlayBootstrapScript?.let { target.evaluateJavascript(it, null) }
+                overlayObserverScript?.let { target.evaluateJavascript(it, null) }
+            }
+        }
     }
 
     private fun presentGeneratedOverlayWithMapperJson(mapperJson: String) {
@@ -205,6 +224,7 @@ class InAppBrowserActivity : AppCompatActivity() {
 
     @SuppressLint("WrongThread", "SetJavaScriptEnabled")
     override fun onCreate(savedInstanceState: Bundle?) {
+        val onCreateStart = System.nanoTime()
         super.onCreate(savedInstanceState)
 
         // Handle edge-to-edge display for Android 15+
@@ -259,19 +279,26 @@ class InAppBrowserActivity : AppCompatActivity() {
 
         OpacityCore.setActiveWebViewActivity(this)
         interceptExtensionEnabled = intent.getBooleanExtra("enableInterceptRequests", false)
-        // Clear cookies for private-mode-like behavior
-        CookieManager.getInstance().removeAllCookies(null)
-        CookieManager.getInstance().setAcceptCookie(true)
 
-        // Create WebView
-        webView = WebView(this).apply {
-            settings.javaScriptEnabled = true
-            settings.domStorageEnabled = true
-            settings.databaseEnabled = true
-            settings.javaScriptCanOpenWindowsAutomatically = true
-            settings.setSupportMultipleWindows(false)
+        val warm = WebViewPrewarmer.adopt(this)
+        prewarmed = warm != null
+        if (warm?.preloadedUrl == null) {
+            // Clear cookies for private-mode-like behavior
+            CookieManager.getInstance().removeAllCookies(null)
+            CookieManager.getInstance().setAcceptCookie(true)
+        }
 
-            addJavascriptInterface(OpacityJsBridge(), "OpacityNative")
+        if (warm != null) {
+            webView = warm.webView
+            warm.bridge.attach(OpacityJsBridge())
+            overlayScriptsInstalledAtDocumentStart = warm.overlayScriptsInstalledAtDocumentStart
+            clearHistoryOnPageFinished = warm.loadedPreconnectPage
+        } else {
+            // Create WebView
+            webView = WebView(this).apply {
+                applyBrowserSettings(this)
+                addJavascriptInterface(OpacityJsBridge(), "OpacityNative")
+            }
         }
 
         overlayEnabled = OpacityCore.isBrowserOverlayEnabled()
@@ -279,6 +306,7 @@ class InAppBrowserActivity : AppCompatActivity() {
             overlayBootstrapScript = OpacityCore.getBrowserOverlayBootstrapScript()
             overlayObserverScript = OpacityCore.getBrowserOverlayObserverScript()
             overlayRendererScript = OpacityCore.getBrowserOverlayRendererScript()
+            overlayPageMatcherLoaded = OpacityCore.loadBrowserOverlayPages() > 0
             installOverlayDocumentStartScriptsIfSupported()
         }
 
@@ -287,10 +315,9 @@ class InAppBrowserActivity : AppCompatActivity() {
         if (OpacityCore.isBrowserDebugLogsEnabled()) {
             webView.webChromeClient = object : WebChromeClient() {
                 override fun onConsoleMessage(consoleMessage: ConsoleMessage?): Boolean {
-                    Log.d(
-                        "Opacity SDK",
+                    NativeLog.d("onConsoleMessage") {
                         "JS ${consoleMessage?.messageLevel()}: ${consoleMessage?.message()}"
-                    )
+                    }
                     return true
                 }
             }
@@ -305,142 +332,18 @@ class InAppBrowserActivity : AppCompatActivity() {
         CookieManager.getInstance().setAcceptThirdPartyCookies(webView, true)
 
         webView.webViewClient = object : WebViewClient() {
-            /**
-            Uber breaks with the default webview because it automatically adds a X-Requested-With: header
-            which they detect, so we use this override which gives us the request before it's executed with
-            the option of executing it ourselves, which is where we can strip the header. This specific override
-            does not support POSTs as in there is no way to get the request body using this func, which is where
-            we use the INTERCEPT_SCRIPT to get the request body, send it back to kotlin, then we can start stripping,
-            the header for post requests also. for eg, it is needed for when we actually login (POST v2/submit-form)
-            to remove that header.
-
-            Similar to google signins, google have made it clear they do not want webviews to be logging in through OAuth
-            https://developers.googleblog.com/upcoming-security-changes-to-googles-oauth-20-authorization-endpoint-in-embedded-webviews/
-            They also check for the X-Requested-With header and the User-Agent, from testing they don't enforce the checks for any
-            of their POSTs, only GETs so we just intercept that.
-             */
             override fun shouldInterceptRequest(
                 view: WebView?,
                 request: WebResourceRequest?
-            ): WebResourceResponse? {
-
-                if (request == null) return null
-                val url = request.url?.toString() ?: return null
-
-                val scheme = request.url?.scheme?.lowercase()
-                if (scheme != "http" && scheme != "https") return null
-
-                // Only intercept Uber domains
-                val host = request.url?.host?.lowercase() ?: ""
-                if (!host.endsWith("uber.com") && !host.endsWith("accounts.google.com/v3/signin")) return null
-
-
-                // For submit-form POST, use the stored body from JS
-                val isSubmitForm =
-                    request.method == "POST" && url.contains("auth.uber.com/v2/submit-form")
-                val storedBody = if (isSubmitForm) pendingPostBodies.remove(url) else null
-                if (request.method != "GET" && request.method != "HEAD" && !isSubmitForm) return null
-                if (isSubmitForm) {
-                    Log.d(
-                        "Opacity SDK",
-                        "submit-form intercepted: storedBody=${if (storedBody != null) "${storedBody.length} bytes" else "MISSING"}"
-                    )
-                    if (storedBody == null) return null
-                }
-
-                try {
-                    val conn = java.net.URL(url).openConnection() as java.net.HttpURLConnection
-                    conn.requestMethod = request.method
-                    conn.instanceFollowRedirects = true
-                    conn.connectTimeout = 15000
-                    conn.readTimeout = 15000
-
-                    if (storedBody != null) {
-                        conn.doOutput = true
-                    }
-
-                    request.requestHeaders?.forEach { (key, value) ->
-                        if (!key.equals("x-requested-with", ignoreCase = true) &&
-                            !key.equals("accept-encoding", ignoreCase = true)
-                        ) {
-                            conn.setRequestProperty(key, value)
-                        }
-                    }
-
-                    val cookieStr = CookieManager.getInstance().getCookie(url)
-                    if (cookieStr != null) {
-                        conn.setRequestProperty("Cookie", cookieStr)
-                    }
-
-                    if (storedBody != null) {
-                        val bodyBytes = storedBody.toByteArray(Charsets.UTF_8)
-                        conn.setRequestProperty("Content-Length", bodyBytes.size.toString())
-                        conn.outputStream.use { it.write(bodyBytes) }
-                    }
-
-                    conn.connect()
-
-                    val responseCode = conn.responseCode
-                    if (responseCode in 300..399) {
-                        conn.disconnect()
-                        return null
-                    }
-
-                    val reasonPhrase = conn.responseMessage?.ifEmpty { "OK" } ?: "OK"
-                    val inputStream = try {
-                        conn.inputStream
-                    } catch (e: Exception) {
-                        conn.errorStream
-                    }
-
-                    conn.headerFields?.forEach { (key, values) ->
-                        if (key?.equals("Set-Cookie", ignoreCase = true) == true) {
-                            values.forEach { value ->
-                                CookieManager.getInstance().setCookie(url, value)
-                            }
-                        }
-                    }
-
-                    val contentType = conn.contentType ?: "text/html"
-                    val mimeType = contentType.split(";")[0].trim()
-                    val charsetMatch = Regex("charset=([^;\\s]+)").find(contentType)
-                    val charset = charsetMatch?.groupValues?.get(1)?.trim() ?: "UTF-8"
-
-                    val skipHeaders = setOf(
-                        "content-encoding",
-                        "transfer-encoding",
-                        "content-length",
-                        "connection"
-                    )
-                    val responseHeaders = mutableMapOf<String, String>()
-                    conn.headerFields?.forEach { (key, values) ->
-                        if (key != null && values.isNotEmpty() && !skipHeaders.contains(key.lowercase())) {
-                            responseHeaders[key] = values.last()
-                        }
-                    }
-
-                    return WebResourceResponse(
-                        mimeType,
-                        charset,
-                        responseCode,
-                        reasonPhrase,
-                        responseHeaders,
-                        inputStream
-                    )
-                } catch (e: Exception) {
-                    Log.e("Opacity SDK", "shouldInterceptRequest error for $url", e)
-                    return null
-                }
-            }
+            ): WebResourceResponse? =
+                reissueWithoutRequestedWith(request) { pendingPostBodies.remove(it) }
 
             override fun shouldOverrideUrlLoading(
                 view: WebView?,
                 request: WebResourceRequest?
             ): Boolean {
                 val url = request?.url?.toString() ?: return false
-                currentUrl = url
-                addToVisitedUrls(url)
-                emitNavigationEvent()
+                reportNavigation(url)
                 val scheme = request.url.scheme?.lowercase()
                 val isHttpLike = scheme == "http" || scheme == "https"
                 if (isHttpLike) {
@@ -455,36 +358,21 @@ class InAppBrowserActivity : AppCompatActivity() {
                 favicon: android.graphics.Bitmap?
             ) {
                 super.onPageStarted(view, url, favicon)
-                if (url != null) {
-                    currentUrl = url
-                    addToVisitedUrls(url)
-                }
+                handlePageStarted(view, url)
+            }
 
-                if (interceptExtensionEnabled) {
-                    view?.evaluateJavascript(INTERCEPT_SCRIPT, null)
+            override fun onPageCommitVisible(view: WebView?, url: String?) {
+                super.onPageCommitVisible(view, url)
+                if (url?.startsWith("data:") != true) {
+                    WebViewPrewarmer.markFirstPaint(prewarmed)
+                    // The new document is live here, unlike in onPageStarted.
+                    injectOverlayScriptsIntoPage(view, url)
                 }
-
-                injectOverlayScriptsIntoPage(view)
             }
 
             override fun onPageFinished(view: WebView?, url: String?) {
                 super.onPageFinished(view, url)
-                if (url != null) {
-                    currentUrl = url
-                    updateCookiesFromCookieManager(url)
-                }
-
-                injectOverlayScriptsIntoPage(view)
-
-                view?.evaluateJavascript("document.documentElement.outerHTML") { rawResult ->
-                    if (rawResult != null && rawResult != "null") {
-                        htmlBody = unescapeJsString(rawResult)
-                        emitNavigationEvent()
-                        htmlBody = ""
-                    } else {
-                        emitNavigationEvent()
-                    }
-                }
+                handlePageFinished(view, url)
             }
 
             override fun doUpdateVisitedHistory(
@@ -497,6 +385,11 @@ class InAppBrowserActivity : AppCompatActivity() {
                     addToVisitedUrls(url)
                     emitLocationEvent(url)
                 }
+
+                // Single-page apps change route without a new page load.
+                if (overlayPageMatcherLoaded && !isReload) {
+                    injectOverlayScriptsIntoPage(view, url)
+                }
             }
         }
 
@@ -537,27 +430,71 @@ class InAppBrowserActivity : AppCompatActivity() {
 
         val url = intent.getStringExtra("url")!!
 
-        // Inject cookies passed via intent extras
-        val cookieUrls = intent.getStringArrayExtra("cookieUrls")
-        val cookieValues = intent.getStringArrayExtra("cookieValues")
-        if (cookieUrls != null && cookieValues != null) {
-            val cookieManager = CookieManager.getInstance()
-            for (i in cookieUrls.indices) {
-                if (i < cookieValues.size) {
-                    cookieManager.setCookie(cookieUrls[i], cookieValues[i])
-                }
-            }
-            cookieManager.flush()
+        if (warm?.preloadedUrl != null) {
+            // Cookies, headers and the load were applied by the prewarmer; catch up on the
+            // page callbacks that reached its client instead of ours.
+            warm.replayPreload(
+                visited = ::addToVisitedUrls,
+                pageStarted = { handlePageStarted(webView, it) },
+                pageFinished = { handlePageFinished(webView, it) },
+                handedOff = ::reportNavigation
+            )
+        } else {
+            // Inject cookies passed via intent extras
+            resetCookies(
+                intent.getStringArrayExtra("cookieUrls"),
+                intent.getStringArrayExtra("cookieValues"),
+                clearExisting = false
+            )
+            webView.loadUrl(url, requestHeaders(headers))
         }
+        OpacityCore.traceComplete("InAppBrowserActivity.onCreate", onCreateStart, System.nanoTime())
+    }
 
-        val headerMap = mutableMapOf<String, String>()
-        headers?.keySet()?.forEach { key ->
-            if (key != "user-agent") {
-                headers.getString(key)?.let { headerMap[key] = it }
-            }
+    private fun handlePageStarted(view: WebView?, url: String?) {
+        if (url?.startsWith("data:") == true) {
+            // Preconnect page of a prewarmed WebView.
+            return
+        }
+        OpacityCore.traceInstant("onPageStarted")
+        if (url != null) {
+            currentUrl = url
+            addToVisitedUrls(url)
         }
 
-        webView.loadUrl(url, headerMap)
+        if (interceptExtensionEnabled) {
+            view?.evaluateJavascript(INTERCEPT_SCRIPT, null)
+        }
+    }
+
+    private fun handlePageFinished(view: WebView?, url: String?) {
+        if (url?.startsWith("data:") == true) {
+            return
+        }
+        OpacityCore.traceInstant("onPageFinished")
+        if (clearHistoryOnPageFinished) {
+            // Drop the preconnect page so back navigation can't return to it.
+            view?.clearHistory()
+            clearHistoryOnPageFinished = false
+        }
+        if (url != null) {
+            currentUrl = url
+            updateCookiesFromCookieManager(url)
+        }
+
+        injectOverlayScriptsIntoPage(view, url)
+
+        val outerHtmlStart = System.nanoTime()
+        view?.evaluateJavascript("document.documentElement.outerHTML") { rawResult ->
+            OpacityCore.traceComplete("outerHTML", outerHtmlStart, System.nanoTime())
+            if (rawResult != null && rawResult != "null") {
+                htmlBody = unescapeJsString(rawResult)
+                emitNavigationEvent()
+                htmlBody = ""
+            } else {
+                emitNavigationEvent()
+            }
+        }
     }
 
     /**
@@ -613,61 +550,75 @@ class InAppBrowserActivity : AppCompatActivity() {
     }
 
     private fun emitInterceptedRequest(requestData: JSONObject) {
-        val event: MutableMap<String, Any?> =
-            mutableMapOf(
-                "event" to "intercepted_request",
-                "request_type" to requestData.optString("request_type"),
-                "data" to requestData.opt("data"),
-                "id" to System.currentTimeMillis().toString()
-            )
-        val json = JSONObject(event).toString()
-        // Log.d("Opacity SDK", "emitInterceptedRequest: ${json.take(300)}")
-        OpacityCore.emitWebviewEvent(json)
+        val frame = WebviewEventFrame.writer()
+            .begin(WebviewEventFrame.Kind.INTERCEPTED_REQUEST)
+            .put(WebviewEventFrame.Tag.REQUEST_TYPE, requestData.optString("request_type"))
+        // A missing "data" key is left out of the event, an explicit null is kept.
+        when (val value = requestData.opt("data")) {
+            null -> {}
+            JSONObject.NULL -> frame.put(WebviewEventFrame.Tag.DATA, "null")
+            is String -> frame.put(WebviewEventFrame.Tag.DATA, JSONObject.quote(value))
+            else -> frame.put(WebviewEventFrame.Tag.DATA, value.toString())
+        }
+        frame.put(WebviewEventFrame.Tag.ID, System.currentTimeMillis().toString())
+            .emit()
     }
 
     private fun emitLocationEvent(url: String) {
-        val event: Map<String, Any?> =
-            mapOf(
-                "event" to "location_changed",
-                "url" to url,
-                "id" to System.currentTimeMillis().toString()
-            )
-        OpacityCore.emitWebviewEvent(JSONObject(event).toString())
+        WebviewEventFrame.writer()
+            .begin(WebviewEventFrame.Kind.LOCATION_CHANGED)
+            .put(WebviewEventFrame.Tag.URL, url)
+            .put(WebviewEventFrame.Tag.ID, System.currentTimeMillis().toString())
+            .emit()
     }
 
     private fun emitNavigationEvent() {
-        val event: MutableMap<String, Any?> =
-            mutableMapOf(
-                "event" to "navigation",
-                "url" to currentUrl,
-                "visited_urls" to visitedUrls,
-                "id" to System.currentTimeMillis().toString()
-            )
+        val frame = WebviewEventFrame.writer()
+            .begin(WebviewEventFrame.Kind.NAVIGATION)
+            .put(WebviewEventFrame.Tag.URL, currentUrl)
+            .put(WebviewEventFrame.Tag.ID, System.currentTimeMillis().toString())
+        for (url in visitedUrls) {
+            frame.put(WebviewEventFrame.Tag.VISITED_URL, url)
+        }
 
         try {
             val domain = java.net.URL(currentUrl).host
-            event["cookies"] = cookies[domain]
+            val domainCookies = cookies[domain]
+            if (domainCookies != null) {
+                frame.put(WebviewEventFrame.Tag.COOKIES, "")
+                val keys = domainCookies.keys()
+                while (keys.hasNext()) {
+                    val name = keys.next()
+                    frame.put(WebviewEventFrame.Tag.COOKIE_NAME, name)
+                    frame.put(WebviewEventFrame.Tag.COOKIE_VALUE, domainCookies.optString(name))
+                }
+            }
         } catch (e: Exception) {
             // If the URL is malformed (usually when it is a URI like "uberlogin://blabla")
             // we don't set any cookies
         }
 
-        if (htmlBody != "") {
-            event["html_body"] = htmlBody
-        }
-
-        OpacityCore.emitWebviewEvent(JSONObject(event).toString())
+        frame.putIfNotEmpty(WebviewEventFrame.Tag.HTML_BODY, htmlBody)
+        frame.emit()
         clearVisitedUrls()
     }
 
     private fun onClose() {
-        val event: Map<String, Any> =
-            mapOf("event" to "close", "id" to System.currentTimeMillis().toString())
-        OpacityCore.emitWebviewEvent(JSONObject(event).toString())
+        WebviewEventFrame.writer()
+            .begin(WebviewEventFrame.Kind.CLOSE)
+            .put(WebviewEventFrame.Tag.ID, System.currentTimeMillis().toString())
+            .emit()
         interceptExtensionEnabled = false
         finish()
     }
 
+    /** Reports a navigation the WebView is about to start, or hand off for app schemes. */
+    private fun reportNavigation(url: String) {
+        currentUrl = url
+        addToVisitedUrls(url)
+        emitNavigationEvent()
+    }
+
     private fun addToVisitedUrls(url: String) {
         if (visitedUrls.isNotEmpty() && visitedUrls.last() == url) {
             return
@@ -714,12 +665,204 @@ class InAppBrowserActivity : AppCompatActivity() {
                 "});" +
             "})()"
         }
+        val postedAt = System.nanoTime()
         Handler(Looper.getMainLooper()).post {
-            webView.evaluateJavascript(wrappedJs, null)
+            OpacityCore.traceComplete("dispatchWebViewEval.mainLooperHop", postedAt, System.nanoTime())
+            OpacityCore.traceSpan("dispatchWebViewEval.evaluateJavascript") {
+                webView.evaluateJavascript(wrappedJs, null)
+            }
         }
     }
 
     companion object {
+        /** Hosts whose requests shouldInterceptRequest re-issues without X-Requested-With. */
+        internal fun rewritesRequestsFor(host: String): Boolean =
+            host.endsWith("uber.com") || host.endsWith("accounts.google.com/v3/signin")
+
+        /**
+        shouldInterceptRequest for both the activity's WebView and a prewarmed one that hasn't
+        been adopted yet; [takePostBody] returns the body the intercept script stored for a URL.
+
+        Uber breaks with the default webview because it automatically adds a X-Requested-With: header
+        which they detect, so we use this override which gives us the request before it's executed with
+        the option of executing it ourselves, which is where we can strip the header. This specific override
+        does not support POSTs as in there is no way to get the request body using this func, which is where
+        we use the INTERCEPT_SCRIPT to get the request body, send it back to kotlin, then we can start stripping,
+        the header for post requests also. for eg, it is needed for when we actually login (POST v2/submit-form)
+        to remove that header.
+
+        Similar to google signins, google have made it clear they do not want webviews to be logging in through OAuth
+        https://developers.googleblog.com/upcoming-security-changes-to-googles-oauth-20-authorization-endpoint-in-embedded-webviews/
+        They also check for the X-Requested-With header and the User-Agent, from testing they don't enforce the checks for any
+        of their POSTs, only GETs so we just intercept that.
+         */
+        internal fun reissueWithoutRequestedWith(
+            request: WebResourceRequest?,
+            takePostBody: (url: String) -> String?
+        ): WebResourceResponse? {
+            if (request == null) return null
+            val url = request.url?.toString() ?: return null
+
+            val scheme = request.url?.scheme?.lowercase()
+            if (scheme != "http" && scheme != "https") return null
+
+            // Only intercept Uber domains
+            val host = request.url?.host?.lowercase() ?: ""
+            if (!rewritesRequestsFor(host)) return null
+
+
+            // For submit-form POST, use the stored body from JS
+            val isSubmitForm =
+                request.method == "POST" && url.contains("auth.uber.com/v2/submit-form")
+            val storedBody = if (isSubmitForm) takePostBody(url) else null
+            if (request.method != "GET" && request.method != "HEAD" && !isSubmitForm) return null
+            if (isSubmitForm) {
+                NativeLog.d("shouldInterceptRequest") {
+                    "submit-form intercepted: storedBody=${if (storedBody != null) "${storedBody.length} bytes" else "MISSING"}"
+                }
+                if (storedBody == null) return null
+            }
+
+            try {
+                val conn = java.net.URL(url).openConnection() as java.net.HttpURLConnection
+                conn.requestMethod = request.method
+                conn.instanceFollowRedirects = true
+                conn.connectTimeout = 15000
+                conn.readTimeout = 15000
+
+                if (storedBody != null) {
+                    conn.doOutput = true
+                }
+
+                request.requestHeaders?.forEach { (key, value) ->
+                    if (!key.equals("x-requested-with", ignoreCase = true) &&
+                        !key.equals("accept-encoding", ignoreCase = true)
+                    ) {
+                        conn.setRequestProperty(key, value)
+                    }
+                }
+
+                val cookieStr = CookieManager.getInstance().getCookie(url)
+                if (cookieStr != null) {
+                    conn.setRequestProperty("Cookie", cookieStr)
+                }
+
+                if (storedBody != null) {
+                    val bodyBytes = storedBody.toByteArray(Charsets.UTF_8)
+                    conn.setRequestProperty("Content-Length", bodyBytes.size.toString())
+                    conn.outputStream.use { it.write(bodyBytes) }
+                }
+
+                conn.connect()
+
+                val responseCode = conn.responseCode
+                if (responseCode in 300..399) {
+                    conn.disconnect()
+                    return null
+                }
+
+                val reasonPhrase = conn.responseMessage?.ifEmpty { "OK" } ?: "OK"
+                val inputStream = try {
+                    conn.inputStream
+                } catch (e: Exception) {
+                    conn.errorStream
+                }
+
+                conn.headerFields?.forEach { (key, values) ->
+                    if (key?.equals("Set-Cookie", ignoreCase = true) == true) {
+                        values.forEach { value ->
+                            CookieManager.getInstance().setCookie(url, value)
+                        }
+                    }
+                }
+
+                val contentType = conn.contentType ?: "text/html"
+                val mimeType = contentType.split(";")[0].trim()
+                val charsetMatch = Regex("charset=([^;\\s]+)").find(contentType)
+                val charset = charsetMatch?.groupValues?.get(1)?.trim() ?: "UTF-8"
+
+                val skipHeaders = setOf(
+                    "content-encoding",
+                    "transfer-encoding",
+                    "content-length",
+                    "connection"
+                )
+                val responseHeaders = mutableMapOf<String, String>()
+                conn.headerFields?.forEach { (key, values) ->
+                    if (key != null && values.isNotEmpty() && !skipHeaders.contains(key.lowercase())) {
+                        responseHeaders[key] = values.last()
+                    }
+                }
+
+                return WebResourceResponse(
+                    mimeType,
+                    charset,
+                    responseCode,
+                    reasonPhrase,
+                    responseHeaders,
+                    inputStream
+                )
+            } catch (e: Exception) {
+                NativeLog.e("shouldInterceptRequest", "Error for $url", e)
+                return null
+            }
+        }
+
+        internal fun applyBrowserSettings(webView: WebView) {
+            webView.settings.javaScriptEnabled = true
+            webView.settings.domStorageEnabled = true
+            webView.settings.databaseEnabled = true
+            webView.settings.javaScriptCanOpenWindowsAutomatically = true
+            webView.settings.setSupportMultipleWindows(false)
+        }
+
+        /**
+         * Origin rules for the document-start overlay scripts: those of the overlay pages
+         * definition when it loaded, every origin otherwise.
+         */
+        internal fun overlayOriginRules(matcherLoaded: Boolean): Set<String> =
+            if (matcherLoaded) OpacityCore.getBrowserOverlayPageOrigins().toSet() else setOf("*")
+
+        /** Extra request headers for loadUrl; the user agent is applied through settings. */
+        internal fun requestHeaders(headers: Bundle?): Map<String, String> {
+            val headerMap = mutableMapOf<String, String>()
+            headers?.keySet()?.forEach { key ->
+                if (key != "user-agent") {
+                    headers.getString(key)?.let { headerMap[key] = it }
+                }
+            }
+            return headerMap
+        }
+
+        /**
+         * Clears cookies for private-mode-like behaviour unless [clearExisting] is false, then
+         * sets the cookies the flow asked for.
+         */
+        internal fun resetCookies(
+            cookieUrls: Array<String>?,
+            cookieValues: Array<String>?,
+            clearExisting: Boolean = true
+        ) {
+            val cookieManager = CookieManager.getInstance()
+            if (clearExisting) {
+                cookieManager.removeAllCookies(null)
+                cookieManager.setAcceptCookie(true)
+            }
+            if (cookieUrls != null && cookieValues != null) {
+                for (i in cookieUrls.indices) {
+                    if (i < cookieValues.size) {
+                        cookieManager.setCookie(cookieUrls[i], cookieValues[i])
+                    }
+                }
+                cookieManager.flush()
+            }
+        }
+
+        // True the first time it runs in a document, false afterwards.
+        private const val OVERLAY_FIRST_RUN_SCRIPT =
+            "(function(){if(window.__opacityOverlayInjected)return false;" +
+                "window.__opacityOverlayInjected=true;return true})()"
+
         private const val INTERCEPT_SCRIPT = """
 (function() {
     const log = (requestType, data) => { try { OpacityNative.onInterceptedRequest(JSON.stringify({ request_type: requestType, data })); } catch(e) {} };
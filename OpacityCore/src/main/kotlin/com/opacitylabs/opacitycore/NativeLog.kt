@@ -0,0 +1,32 @@
+package com.opacitylabs.opacitycore
+
+import android.util.Log
+
+/**
+ * Logging for WebView callbacks that must not stall on logcat. Records go to the native
+ * logger (cpp/NativeLog.h), which buffers them per thread and writes them out from a
+ * background thread, rate limited per [site]. Debug records are only kept while the
+ * current flow has browser debug logs enabled, and the message lambda is not evaluated
+ * otherwise.
+ */
+internal object NativeLog {
+    /** Codes shared with the native LogLevel, equal to android.util.Log priorities. */
+    enum class Level(val code: Int) {
+        DEBUG(3),
+        INFO(4),
+        WARN(5),
+        ERROR(6),
+    }
+
+    inline fun d(site: String, message: () -> String) {
+        if (OpacityCore.isLogLevelEnabled(Level.DEBUG.code)) {
+            OpacityCore.writeLog(Level.DEBUG.code, site, message())
+        }
+    }
+
+    /** Appends [error]'s stack trace; records longer than the native limit are truncated. */
+    fun e(site: String, message: String, error: Throwable? = null) {
+        val text = if (error != null) "$message\n${Log.getStackTraceString(error)}" else message
+        OpacityCore.writeLog(Level.ERROR.code, site, text)
+    }
+}
@@ -1,7 +1,10 @@
 package com.opacitylabs.opacitycore
 
+import android.content.ComponentCallbacks2
 import android.content.Context
 import android.content.Intent
+import android.content.pm.ApplicationInfo
+import android.content.res.Configuration
 import android.os.Build
 import android.os.Bundle
 import android.os.Handler
@@ -9,7 +12,6 @@ import android.os.Looper
 import androidx.localbroadcastmanager.content.LocalBroadcastManager
 import java.util.concurrent.ConcurrentHashMap
 import java.util.concurrent.CountDownLatch
-import java.util.concurrent.TimeUnit
 import java.util.concurrent.atomic.AtomicInteger
 import com.opacitylabs.opacitycore.JsonConverter.Companion.mapToJsonElement
 import com.opacitylabs.opacitycore.JsonConverter.Companion.parseJsonElementToAny
@@ -17,7 +19,10 @@ import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.withContext
 import kotlinx.serialization.encodeToString
 import kotlinx.serialization.json.Json
+import kotlinx.serialization.json.boolean
+import kotlinx.serialization.json.int
 import kotlinx.serialization.json.jsonObject
+import kotlinx.serialization.json.jsonPrimitive
 
 object OpacityCore {
     enum class Environment(val code: Int) {
@@ -27,6 +32,31 @@ object OpacityCore {
         PRODUCTION(4),
     }
 
+    /**
+     * Scheduling class for [get]. Background requests are capped below the native in-flight
+     * limit so they always leave room for interactive ones. Identical concurrent requests share
+     * one execution, which is admitted at the most urgent priority among its callers.
+     */
+    enum class Priority(val code: Int) {
+        INTERACTIVE(0),
+        BACKGROUND(1),
+    }
+
+    /** How much of the browser [setWebViewWarmUp] prepares before it is presented. */
+    enum class WarmUp {
+        /** The browser builds its WebView when it is presented. */
+        OFF,
+
+        /** Build the WebView, its settings, JS bridge and overlay scripts at prepare time. */
+        WEBVIEW,
+
+        /** As [WEBVIEW], and resolve and preconnect to the page's origin. */
+        PRECONNECT,
+
+        /** As [PRECONNECT], and start loading the page as soon as it is presented. */
+        PRELOAD,
+    }
+
     private lateinit var appContext: Context
     private lateinit var cryptoManager: CryptoManager
     private lateinit var _url: String
@@ -41,7 +71,7 @@ object OpacityCore {
 
     private data class PendingEval(
         val latch: CountDownLatch = CountDownLatch(1),
-        var result: String = "{\"result\":null}"
+        @Volatile var result: String = "{\"result\":null}"
     )
 
     init {
@@ -67,10 +97,59 @@ object OpacityCore {
         return nativeInitializeOpenTelemetry(openTelemetryEndpoint, grafanaInstanceId, grafanaApiToken)
     }
 
+    /**
+     * Limits how many flows run at once. Requests beyond [maxInFlight] wait in per-priority
+     * FIFO queues; once [maxQueued] requests of a priority are waiting, further ones fail
+     * with an `Overloaded` error.
+     */
+    @JvmStatic
+    fun configureScheduler(maxInFlight: Int, maxBackgroundInFlight: Int, maxQueued: Int) {
+        nativeConfigureScheduler(maxInFlight, maxBackgroundInFlight, maxQueued)
+    }
+
     @JvmStatic
     fun setContext(context: Context) {
         appContext = context
         cryptoManager = CryptoManager(appContext.applicationContext)
+        if (!trimCallbacksRegistered) {
+            appContext.applicationContext.registerComponentCallbacks(trimCallbacks)
+            trimCallbacksRegistered = true
+        }
+    }
+
+    private var trimCallbacksRegistered = false
+
+    private val trimCallbacks = object : ComponentCallbacks2 {
+        override fun onTrimMemory(level: Int) {
+            trimMemory(level)
+        }
+
+        override fun onConfigurationChanged(newConfig: Configuration) {}
+
+        @Deprecated("Deprecated in Java")
+        override fun onLowMemory() {
+            trimMemory(ComponentCallbacks2.TRIM_MEMORY_COMPLETE)
+        }
+    }
+
+    /**
+     * Releases bridge-held caches for a [ComponentCallbacks2] trim level: retained HTML
+     * snapshots first, then cached flow results, and under critical pressure free pages held
+     * by the native allocator. A prewarmed WebView that was not presented yet is destroyed at
+     * the levels that clear cached flow results: RUNNING_LOW, RUNNING_CRITICAL and BACKGROUND
+     * or above, but not RUNNING_MODERATE or UI_HIDDEN. Called automatically once [setContext]
+     * has run. Returns the bytes released from the native caches.
+     */
+    @JvmStatic
+    fun trimMemory(level: Int): Long {
+        WebviewEventFrame.trimBuffers()
+        if (level in ComponentCallbacks2.TRIM_MEMORY_RUNNING_LOW until
+                ComponentCallbacks2.TRIM_MEMORY_UI_HIDDEN ||
+            level >= ComponentCallbacks2.TRIM_MEMORY_BACKGROUND
+        ) {
+            WebViewPrewarmer.releaseAsync()
+        }
+        return nativeTrimMemory(level)
     }
 
     fun isAppForegrounded(): Boolean {
@@ -159,9 +238,11 @@ object OpacityCore {
     }
 
     fun prepareInAppBrowser(url: String) {
+        BlockingUpcalls.beginFlow()
         headers = Bundle()
         pendingCookies = mutableListOf()
         _url = url
+        WebViewPrewarmer.onPrepare(appContext, url)
     }
 
     fun setBrowserHeader(key: String, value: String) {
@@ -173,6 +254,7 @@ object OpacityCore {
     }
 
     fun presentBrowser(shouldIntercept: Boolean) {
+        WebViewPrewarmer.onPresent(_url, headers, pendingCookies.toList(), shouldIntercept)
         val intent = Intent(appContext, InAppBrowserActivity::class.java)
         intent.putExtra("url", _url)
         intent.putExtra("headers", headers)
@@ -196,7 +278,11 @@ object OpacityCore {
         val resultReceiver = CookieResultReceiver()
         cookiesIntent.putExtra("receiver", resultReceiver)
         LocalBroadcastManager.getInstance(appContext).sendBroadcast(cookiesIntent)
-        val json = resultReceiver.waitForResult(1000) // Wait up to 1 second for the result
+        // Wait up to 1 second for the result
+        val json = resultReceiver.waitForResult(
+            BlockingUpcalls.Kind.COOKIES_FOR_CURRENT_URL,
+            1000
+        )
         return json?.toString()
     }
 
@@ -210,11 +296,14 @@ object OpacityCore {
         cookiesIntent.putExtra("receiver", resultsReceiver)
         cookiesIntent.putExtra("domain", domain)
         LocalBroadcastManager.getInstance(appContext).sendBroadcast(cookiesIntent)
-        val json = resultsReceiver.waitForResult(1000)
+        val json = resultsReceiver.waitForResult(BlockingUpcalls.Kind.COOKIES_FOR_DOMAIN, 1000)
         return json?.toString()
     }
 
     fun closeBrowser() {
+        nativeDisableBrowserDebugLogs()
+        BlockingUpcalls.cancelAll()
+        WebViewPrewarmer.releaseAsync()
         val closeIntent = Intent("com.opacitylabs.opacitycore.CLOSE_BROWSER")
         LocalBroadcastManager.getInstance(appContext).sendBroadcast(closeIntent)
     }
@@ -227,6 +316,41 @@ object OpacityCore {
 
     fun onBrowserDestroyed() {
         isBrowserActive = false
+        // Debug logs follow the flow that opened the browser.
+        nativeDisableBrowserDebugLogs()
+        BlockingUpcalls.cancelAll()
+    }
+
+    /**
+     * Releases every thread blocked in evalJs or a cookie getter right away. evalJs returns
+     * `{"error":"cancelled"}` and the cookie getters return no cookies, and later calls do the
+     * same without waiting until the next browser flow is prepared. Called when the browser
+     * closes; apps can also call it when they abandon a flow.
+     */
+    @JvmStatic
+    fun cancelBlockingUpcalls() {
+        BlockingUpcalls.cancelAll()
+    }
+
+    /**
+     * Opt-in: prepares the browser when libsdk calls android_prepare_request instead of when
+     * it is presented, taking WebView creation and, depending on [mode], connection setup
+     * and the first page load off the path the user waits on. Prepare-to-first-paint times
+     * for warm and cold browsers are reported by [getBridgeStats].
+     */
+    @JvmStatic
+    fun setWebViewWarmUp(mode: WarmUp) {
+        WebViewPrewarmer.mode = mode
+    }
+
+    /**
+     * Caps how long blocking upcalls of each browser flow may wait, [timeoutMs] from the flow's
+     * start (android_prepare_request), on top of their own timeouts. Waits past the deadline
+     * fail fast as timed out. Applies from the next flow; 0 removes the deadline.
+     */
+    @JvmStatic
+    fun setBlockingUpcallDeadline(timeoutMs: Long) {
+        BlockingUpcalls.setFlowBudget(timeoutMs)
     }
 
     fun setActiveWebViewActivity(activity: InAppBrowserActivity?) {
@@ -255,9 +379,53 @@ object OpacityCore {
         val pending = PendingEval()
         pendingEvals[id] = pending
         activity.dispatchWebViewEval(id, js, fireAndForget = false)
-        pending.latch.await(timeoutMs, TimeUnit.MILLISECONDS)
+        val outcome = BlockingUpcalls.await(BlockingUpcalls.Kind.EVAL_JS, pending.latch, timeoutMs)
         pendingEvals.remove(id)
-        return pending.result
+        return when (outcome) {
+            BlockingUpcalls.Outcome.COMPLETED -> pending.result
+            BlockingUpcalls.Outcome.TIMED_OUT -> "{\"error\":\"timeout\"}"
+            BlockingUpcalls.Outcome.CANCELLED -> "{\"error\":\"cancelled\"}"
+        }
+    }
+
+    /** Cached so trace helpers cost a field read, not a JNI call, while tracing is off. */
+    @Volatile
+    var isTracingEnabled = false
+        private set
+
+    /**
+     * Starts or stops recording bridge calls and Kotlin spans into the native trace buffers.
+     * Use [dumpTrace] to write them out as Chrome trace-event JSON.
+     */
+    @JvmStatic
+    fun enableTracing(enabled: Boolean) {
+        isTracingEnabled = enabled
+        nativeSetTracingEnabled(enabled)
+    }
+
+    /** Records a span measured with [System.nanoTime], which shares the native trace clock. */
+    fun traceComplete(name: String, startNanos: Long, endNanos: Long) {
+        if (isTracingEnabled) {
+            nativeTraceComplete(name, startNanos, endNanos)
+        }
+    }
+
+    fun traceInstant(name: String) {
+        if (isTracingEnabled) {
+            nativeTraceInstant(name)
+        }
+    }
+
+    inline fun <T> traceSpan(name: String, block: () -> T): T {
+        if (!isTracingEnabled) {
+            return block()
+        }
+        val start = System.nanoTime()
+        try {
+            return block()
+        } finally {
+            traceComplete(name, start, System.nanoTime())
+        }
     }
 
     private fun parseOpacityError(error: String?): OpacityError {
@@ -275,25 +443,96 @@ object OpacityCore {
     }
 
     @JvmStatic
-    suspend fun get(name: String, params: Map<String, Any?>?): Result<Map<String, Any?>> {
+    @JvmOverloads
+    suspend fun get(
+        name: String,
+        params: Map<String, Any?>?,
+        priority: Priority = Priority.INTERACTIVE
+    ): Result<Map<String, Any?>> {
         return withContext(Dispatchers.IO) {
             val paramsString = params?.let {
                 val jsonElement = mapToJsonElement(it)
                 Json.encodeToString(jsonElement)
             }
 
-            val res = getNative(name, paramsString)
-            if (res.status != 0) {
-                return@withContext Result.failure(parseOpacityError(res.err))
+            return@withContext toResult(getNative(name, paramsString, priority.code))
+        }
+    }
+
+    /** What a [replay] returned, and whether it ended the way the recorded run did. */
+    data class ReplayOutcome(
+        val result: Result<Map<String, Any?>>,
+        val matchesRecording: Boolean
+    )
+
+    /**
+     * Re-runs the flow captured by [startRecording] at [path] without a WebView: upcalls are
+     * answered from the recording and the recorded webview events are fed back to libsdk,
+     * either as fast as the flow consumes them or, with [originalTiming], at their recorded
+     * pace. The flow always executes, bypassing [setFlowCacheTtl] and request coalescing.
+     * libsdk's own backend calls are not recorded; point them at a stand-in with
+     * [setBackendUrlOverride].
+     *
+     * Debuggable apps only. Replay answers upcalls process-wide, so it fails with
+     * [IllegalStateException] while a [get] is running, and a [get] started during a replay
+     * fails with `ReplayInProgress`.
+     */
+    suspend fun replay(path: String, originalTiming: Boolean = false): Result<ReplayOutcome> {
+        checkDebuggable("replay")
+        return withContext(Dispatchers.IO) {
+            val json = replayNative(path, originalTiming)
+                ?: return@withContext Result.failure(
+                    IllegalArgumentException("No recorded flow in $path")
+                )
+            val outcome = Json.parseToJsonElement(json).jsonObject
+            val status = outcome["status"]!!.jsonPrimitive.int
+            val payload = outcome["payload"]!!.jsonPrimitive.content
+            val response = if (status == 0) {
+                OpacityResponse(status, payload, null)
+            } else {
+                OpacityResponse(status, null, payload)
             }
+            Result.success(
+                ReplayOutcome(
+                    toResult(response),
+                    outcome["matches_recording"]!!.jsonPrimitive.boolean
+                )
+            )
+        }
+    }
 
-            val map: Map<String, Any?> =
-                Json.parseToJsonElement(res.data!!).jsonObject.mapValues {
-                    parseJsonElementToAny(it.value)
-                }
+    /**
+     * Sends libsdk's backend traffic to [url] instead of the [Environment]'s backend, e.g. a
+     * local stand-in serving canned responses for [replay]; null restores the default. libsdk
+     * reads `OPACITY_BACKEND_URL` when it initializes, so call this after [setContext] and
+     * before [initialize]; later calls throw [IllegalStateException], since changing the
+     * environment races with libsdk's threads reading it. Debuggable apps only.
+     */
+    @JvmStatic
+    fun setBackendUrlOverride(url: String?) {
+        checkDebuggable("setBackendUrlOverride")
+        check(nativeSetBackendUrl(url)) { "setBackendUrlOverride must precede initialize" }
+    }
+
+    // Record, replay and the backend override expose secrets or reroute traffic.
+    private fun checkDebuggable(feature: String) {
+        check(
+            ::appContext.isInitialized &&
+                (appContext.applicationInfo.flags and ApplicationInfo.FLAG_DEBUGGABLE) != 0
+        ) { "$feature is only available in debuggable apps" }
+    }
 
-            return@withContext Result.success(map)
+    private fun toResult(res: OpacityResponse): Result<Map<String, Any?>> {
+        if (res.status != 0) {
+            return Result.failure(parseOpacityError(res.err))
         }
+
+        val map: Map<String, Any?> =
+            Json.parseToJsonElement(res.data!!).jsonObject.mapValues {
+                parseJsonElementToAny(it.value)
+            }
+
+        return Result.success(map)
     }
 
     private external fun init(
@@ -305,12 +544,136 @@ object OpacityCore {
 
     private external fun nativeInitializeOpenTelemetry(openTelemetryEndpoint: String, grafanaInstanceId: String, grafanaApiToken: String): Int
 
-    private external fun getNative(name: String, params: String?): OpacityResponse
+    private external fun nativeConfigureScheduler(
+        maxInFlight: Int,
+        maxBackgroundInFlight: Int,
+        maxQueued: Int
+    )
+
+    private external fun getNative(name: String, params: String?, priority: Int): OpacityResponse
     external fun getSdkVersions(): String
     external fun emitWebviewEvent(eventJson: String)
+    external fun emitWebviewEventFrame(frame: java.nio.ByteBuffer, length: Int)
     external fun isBrowserOverlayEnabled(): Boolean
     external fun getBrowserOverlayObserverScript(): String
     external fun getBrowserOverlayBootstrapScript(): String
     external fun getBrowserOverlayRendererScript(): String
+
+    /**
+     * Compiles the URL patterns of the current overlay pages definition natively. Returns
+     * the number of pages loaded, or -1 if the definition is missing or malformed.
+     */
+    external fun loadBrowserOverlayPages(): Int
+
+    /** Id of the overlay page whose patterns match [url], or null if none does. */
+    external fun matchBrowserOverlayPage(url: String): String?
+
+    /**
+     * Origin rules for `WebViewCompat.addDocumentStartJavaScript` covering every overlay page
+     * pattern; `["*"]` when a pattern leaves the host open, empty when nothing is loaded.
+     */
+    external fun getBrowserOverlayPageOrigins(): Array<String>
     external fun isBrowserDebugLogsEnabled(): Boolean
+
+    /**
+     * JSON snapshot of the native bridge counters: per upcall/downcall call counts and
+     * latency percentiles, in-flight calls, time spent blocked in evalJs and the cookie
+     * getters by outcome, threads attached now and in total, and process RSS. Intended for
+     * debug screens; JNI ref leaks are caught by the host soak harness in src/test/cpp instead.
+     */
+    external fun getBridgeStats(): String
+
+    /** Feeds the blocked-wait section of [getBridgeStats]; called by [BlockingUpcalls]. */
+    external fun recordBlockedWait(kind: Int, outcome: Int, nanos: Long)
+
+    /** Feeds the prepare_to_first_paint section of [getBridgeStats]. */
+    external fun recordPrepareToFirstPaint(nanos: Long, warm: Boolean)
+
+    private external fun nativeSetTracingEnabled(enabled: Boolean)
+    private external fun nativeTraceComplete(name: String, startNanos: Long, endNanos: Long)
+    private external fun nativeTraceInstant(name: String)
+
+    /** Writes the buffered trace to [path]. Returns false if the file could not be written. */
+    external fun dumpTrace(path: String): Boolean
+    external fun clearTrace()
+
+    /**
+     * Opt-in: navigation events after the first carry only the HTML chunks that changed plus
+     * references into an earlier snapshot. Needs a libsdk exporting `emit_webview_event_v2`.
+     * No current libsdk release exports it, so for now enabling always returns false and
+     * full pages are sent.
+     *
+     * @return whether delta mode is now on.
+     */
+    external fun setHtmlDeltaEnabled(enabled: Boolean): Boolean
+
+    /** JSON counters for delta mode: events, HTML bytes captured vs. bytes sent, chunk reuse. */
+    external fun getHtmlDeltaStats(): String
+
+    /**
+     * Serves successful results of [name] from a native cache for [ttlMs] after they are
+     * produced. Concurrent identical [get] calls are always coalesced into one execution;
+     * this only controls reuse after it finishes. A TTL of 0 turns caching off for the flow.
+     */
+    external fun setFlowCacheTtl(name: String, ttlMs: Long)
+
+    /** Drops cached results for [name], or for every flow when [name] is null. */
+    external fun invalidateFlowCache(name: String?)
+
+    /** JSON counters for the request layer: cache hits/misses, coalesced calls, executions. */
+    external fun getRequestCacheStats(): String
+
+    /** JSON counters for the scheduler: per-priority queue/run time, queued and rejected. */
+    external fun getSchedulerStats(): String
+
+    /**
+     * Appends every upcall with its arguments and result, every webview event and every
+     * [get] outcome to a JSON Lines file at [path] until [stopRecording], for later use with
+     * [replay]. Recordings include decrypted secure storage values and page contents, so the
+     * file is created owner-only and recording is limited to debuggable apps.
+     */
+    @JvmStatic
+    fun startRecording(path: String): Boolean {
+        checkDebuggable("startRecording")
+        return nativeStartRecording(path)
+    }
+
+    @JvmStatic
+    fun stopRecording() {
+        nativeStopRecording()
+    }
+
+    /** Feeds the native logger; use [NativeLog] rather than calling this directly. */
+    external fun writeLog(level: Int, site: String, message: String)
+    external fun isLogLevelEnabled(level: Int): Boolean
+
+    /**
+     * Writes native log records to [path] (appended) instead of logcat, or back to logcat
+     * when [path] is null. Returns false if the file could not be opened.
+     */
+    external fun setLogFile(path: String?): Boolean
+
+    /** JSON counters for the native logger: records written, dropped and rate limited. */
+    external fun getLogStats(): String
+
+    /**
+     * JSON view of native memory held by the bridge: per call site live bytes and count,
+     * high-water mark and bytes handed off to libsdk, plus retained HTML snapshots, cached
+     * flow results and trim totals.
+     */
+    external fun getMemoryStats(): String
+
+    /**
+     * Caps the native memory the bridge holds in caches and pinned strings. Once exceeded,
+     * caches are trimmed as for TRIM_MEMORY_RUNNING_CRITICAL. 0 removes the cap.
+     */
+    external fun setMemoryBudget(bytes: Long)
+
+    private external fun nativeTrimMemory(level: Int): Long
+    private external fun nativeDisableBrowserDebugLogs()
+
+    private external fun replayNative(path: String, originalTiming: Boolean): String?
+    private external fun nativeSetBackendUrl(url: String?): Boolean
+    private external fun nativeStartRecording(path: String): Boolean
+    private external fun nativeStopRecording()
 }
@@ -0,0 +1,317 @@
+package com.opacitylabs.opacitycore
+
+import android.content.Context
+import android.content.MutableContextWrapper
+import android.net.Uri
+import android.os.Bundle
+import android.os.Handler
+import android.os.Looper
+import android.webkit.CookieManager
+import android.webkit.JavascriptInterface
+import android.webkit.WebResourceRequest
+import android.webkit.WebResourceResponse
+import android.webkit.WebView
+import android.webkit.WebViewClient
+import androidx.webkit.WebViewCompat
+import androidx.webkit.WebViewFeature
+import java.net.InetAddress
+
+/**
+ * Builds the browser WebView ahead of time so [InAppBrowserActivity] doesn't have to.
+ *
+ * When libsdk calls android_prepare_request, [onPrepare] creates an off-screen WebView with
+ * the browser settings, the `OpacityNative` bridge and the document-start overlay scripts
+ * already installed, and depending on [OpacityCore.WarmUp] resolves and preconnects to the
+ * page's origin. With [OpacityCore.WarmUp.PRELOAD], [onPresent] also starts loading the page
+ * while the activity is still launching. The activity adopts the WebView in onCreate.
+ *
+ * WebView work is posted to the main thread; state is only touched there.
+ */
+internal object WebViewPrewarmer {
+    /** A WebView built by [onPrepare], plus what happened to it before adoption. */
+    class Prewarmed(
+        val webView: WebView,
+        val bridge: OpacityJsBridgeProxy,
+        val overlayScriptsInstalledAtDocumentStart: Boolean,
+        val loadedPreconnectPage: Boolean,
+    ) {
+        /** Set when [onPresent] already loaded the page, cookies and headers included. */
+        var preloadedUrl: String? = null
+        var startedUrl: String? = null
+        var finishedUrl: String? = null
+        var committed = false
+        val visitedUrls = mutableListOf<String>()
+        /** Non-http navigations the WebView handed off; reported to libsdk on adoption. */
+        val handedOffUrls = mutableListOf<String>()
+
+        /**
+         * Hands the page callbacks a preload got before adoption to the adopting activity's
+         * handlers, and records a warm first paint if the page was already committed.
+         */
+        fun replayPreload(
+            visited: (String) -> Unit,
+            pageStarted: (String) -> Unit,
+            pageFinished: (String) -> Unit,
+            handedOff: (String) -> Unit
+        ) {
+            visitedUrls.forEach(visited)
+            startedUrl?.let(pageStarted)
+            finishedUrl?.let(pageFinished)
+            if (committed) {
+                mainHandler.post { markFirstPaint(true) }
+            }
+            handedOffUrls.forEach(handedOff)
+        }
+    }
+
+    /**
+     * Forwards `OpacityNative` calls to the adopting activity's bridge. Calls made before
+     * adoption are queued and delivered on [attach].
+     */
+    class OpacityJsBridgeProxy {
+        private var target: InAppBrowserActivity.OpacityJsBridge? = null
+        private val pending = mutableListOf<(InAppBrowserActivity.OpacityJsBridge) -> Unit>()
+
+        fun attach(bridge: InAppBrowserActivity.OpacityJsBridge) {
+            val queued = synchronized(this) {
+                target = bridge
+                pending.toList().also { pending.clear() }
+            }
+            queued.forEach { it(bridge) }
+        }
+
+        private fun dispatch(call: (InAppBrowserActivity.OpacityJsBridge) -> Unit) {
+            val bridge = synchronized(this) {
+                target ?: run {
+                    pending.add(call)
+                    return
+                }
+            }
+            call(bridge)
+        }
+
+        @JavascriptInterface
+        fun onInterceptedRequest(json: String) = dispatch { it.onInterceptedRequest(json) }
+
+        @JavascriptInterface
+        fun storePostBody(url: String, body: String) = dispatch { it.storePostBody(url, body) }
+
+        @JavascriptInterface
+        fun notifyEvalResult(id: String, json: String) {
+            OpacityCore.notifyWebViewEvalResult(id, json)
+        }
+
+        @JavascriptInterface
+        fun onRenderedHtmlReady(json: String) = dispatch { it.onRenderedHtmlReady(json) }
+    }
+
+    @Volatile
+    var mode = OpacityCore.WarmUp.OFF
+
+    private val mainHandler = Handler(Looper.getMainLooper())
+
+    /** The WebView awaiting adoption. Main thread; set directly in tests. */
+    var prewarmed: Prewarmed? = null
+
+    @Volatile
+    private var prepareNanos = 0L
+
+    @Volatile
+    private var firstPaintRecorded = true
+
+    /** Clock behind prepare-to-first-paint; replaced in tests. */
+    var nanoClock: () -> Long = System::nanoTime
+
+    /**
+     * Receives prepare-to-first-paint as [nanoClock] readings. Replaced in tests, which can't
+     * load the native library.
+     */
+    var firstPaintReporter: (startNanos: Long, endNanos: Long, warm: Boolean) -> Unit =
+        { start, end, warm ->
+            OpacityCore.traceComplete("prepareToFirstPaint", start, end)
+            OpacityCore.recordPrepareToFirstPaint(end - start, warm)
+        }
+
+    fun onPrepare(context: Context, url: String) {
+        prepareNanos = nanoClock()
+        firstPaintRecorded = false
+        val mode = mode
+        mainHandler.post {
+            release()
+            if (mode != OpacityCore.WarmUp.OFF) {
+                prewarmed = OpacityCore.traceSpan("prewarmWebView") {
+                    build(context.applicationContext, url, mode)
+                }
+            }
+        }
+    }
+
+    fun onPresent(
+        url: String,
+        headers: Bundle,
+        cookies: List<Pair<String, String>>,
+        shouldIntercept: Boolean
+    ) {
+        if (mode != OpacityCore.WarmUp.PRELOAD) {
+            return
+        }
+        mainHandler.post {
+            val warm = prewarmed ?: return@post
+            // The intercept script has to run from the first page start; leave it to the
+            // activity.
+            if (shouldIntercept || Uri.parse(url).host == null) {
+                return@post
+            }
+
+            InAppBrowserActivity.resetCookies(
+                cookies.map { it.first }.toTypedArray(),
+                cookies.map { it.second }.toTypedArray()
+            )
+            headers.getString("user-agent")?.let { warm.webView.settings.userAgentString = it }
+            warm.preloadedUrl = url
+            warm.webView.loadUrl(url, InAppBrowserActivity.requestHeaders(headers))
+        }
+    }
+
+    /** Hands the prewarmed WebView over to [activity]; null if there is none. Main thread. */
+    fun adopt(activity: Context): Prewarmed? {
+        val warm = prewarmed ?: return null
+        prewarmed = null
+        (warm.webView.context as MutableContextWrapper).baseContext = activity
+        if (warm.preloadedUrl == null) {
+            warm.webView.stopLoading()
+        }
+        return warm
+    }
+
+    /** Destroys a WebView that was never adopted, e.g. when the flow ended before present. */
+    fun releaseAsync() {
+        mainHandler.post { release() }
+    }
+
+    private fun release() {
+        prewarmed?.webView?.destroy()
+        prewarmed = null
+    }
+
+    /** Records prepare-to-first-paint once per [onPrepare]. */
+    fun markFirstPaint(warm: Boolean) {
+        if (firstPaintRecorded) {
+            return
+        }
+        firstPaintRecorded = true
+        firstPaintReporter(prepareNanos, nanoClock(), warm)
+    }
+
+    private fun build(context: Context, url: String, mode: OpacityCore.WarmUp): Prewarmed {
+        val webView = WebView(MutableContextWrapper(context))
+        InAppBrowserActivity.applyBrowserSettings(webView)
+        val bridge = OpacityJsBridgeProxy()
+        webView.addJavascriptInterface(bridge, "OpacityNative")
+        CookieManager.getInstance().setAcceptThirdPartyCookies(webView, true)
+
+        var overlayInstalled = false
+        val overlayOriginRules = if (OpacityCore.isBrowserOverlayEnabled()) {
+            InAppBrowserActivity.overlayOriginRules(OpacityCore.loadBrowserOverlayPages() > 0)
+        } else {
+            emptySet()
+        }
+        if (overlayOriginRules.isNotEmpty() &&
+            WebViewFeature.isFeatureSupported(WebViewFeature.DOCUMENT_START_SCRIPT)
+        ) {
+            try {
+                WebViewCompat.addDocumentStartJavaScript(
+                    webView,
+                    OpacityCore.getBrowserOverlayBootstrapScript(),
+                    overlayOriginRules
+                )
+                WebViewCompat.addDocumentStartJavaScript(
+                    webView,
+                    OpacityCore.getBrowserOverlayObserverScript(),
+                    overlayOriginRules
+                )
+                overlayInstalled = true
+            } catch (e: Exception) {
+                NativeLog.e("prewarmWebView", "Failed to install document-start overlay scripts", e)
+            }
+        }
+
+        val origin = Uri.parse(url).let { uri ->
+            if (uri.scheme == "http" || uri.scheme == "https") {
+                "${uri.scheme}://${uri.encodedAuthority}"
+            } else {
+                null
+            }
+        }
+        val preconnect = mode != OpacityCore.WarmUp.WEBVIEW && origin != null
+        val warm = Prewarmed(webView, bridge, overlayInstalled, preconnect)
+        webView.webViewClient = PrewarmClient(warm)
+
+        if (preconnect) {
+            // The system resolver cache is shared with the WebView's network stack; the
+            // preconnect hint has the WebView open the TCP/TLS connection itself.
+            val host = Uri.parse(url).host!!
+            Thread({
+                try {
+                    InetAddress.getAllByName(host)
+                } catch (e: Exception) {
+                    NativeLog.e("prewarmWebView", "DNS warm-up failed for $host", e)
+                }
+            }, "opacity-dns-warmup").start()
+            webView.loadData(
+                "<link rel=\"preconnect\" href=\"$origin\"><link rel=\"dns-prefetch\" href=\"$origin\">",
+                "text/html",
+                "utf-8"
+            )
+        }
+        return warm
+    }
+
+    /** Tracks page progress until the activity installs its own client. */
+    class PrewarmClient(private val warm: Prewarmed) : WebViewClient() {
+        override fun onPageStarted(view: WebView?, url: String?, favicon: android.graphics.Bitmap?) {
+            if (url != null && !url.startsWith("data:")) {
+                warm.startedUrl = url
+                addVisited(url)
+            }
+        }
+
+        override fun onPageFinished(view: WebView?, url: String?) {
+            if (url != null && !url.startsWith("data:")) {
+                warm.finishedUrl = url
+            }
+        }
+
+        override fun onPageCommitVisible(view: WebView?, url: String?) {
+            if (url != null && !url.startsWith("data:")) {
+                warm.committed = true
+            }
+        }
+
+        // The page or a redirect may reach a host whose requests are re-issued without
+        // X-Requested-With. POST bodies only arrive once the bridge is attached, so before
+        // adoption only GETs are re-issued.
+        override fun shouldInterceptRequest(
+            view: WebView?,
+            request: WebResourceRequest?
+        ): WebResourceResponse? = InAppBrowserActivity.reissueWithoutRequestedWith(request) { null }
+
+        override fun shouldOverrideUrlLoading(view: WebView?, request: WebResourceRequest?): Boolean {
+            val url = request?.url ?: return false
+            val scheme = url.scheme?.lowercase()
+            if (scheme == "http" || scheme == "https") {
+                addVisited(url.toString())
+                return false
+            }
+            // App redirects such as uberlogin:// end the flow; libsdk must still see them.
+            warm.handedOffUrls.add(url.toString())
+            return true
+        }
+
+        private fun addVisited(url: String) {
+            if (warm.visitedUrls.lastOrNull() != url) {
+                warm.visitedUrls.add(url)
+            }
+        }
+    }
+}
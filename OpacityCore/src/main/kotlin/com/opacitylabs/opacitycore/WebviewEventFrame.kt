@@ -0,0 +1,136 @@
+package com.opacitylabs.opacitycore
+
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+import java.nio.CharBuffer
+import java.nio.charset.CoderResult
+import java.nio.charset.CodingErrorAction
+
+/**
+ * Builds binary webview event frames (see cpp/WebviewEventFrame.h) into a reusable direct
+ * buffer, so events reach libsdk without going through a Kotlin map and JSONObject.
+ *
+ * Writers are not thread safe; use [WebviewEventFrame.writer] to get the one for the
+ * current thread.
+ */
+class WebviewEventFrame private constructor() {
+    enum class Kind(val code: Byte) {
+        NAVIGATION(1),
+        LOCATION_CHANGED(2),
+        INTERCEPTED_REQUEST(3),
+        CLOSE(4),
+    }
+
+    enum class Tag(val code: Byte) {
+        ID(1),
+        URL(2),
+        VISITED_URL(3),
+        COOKIE_NAME(4),
+        COOKIE_VALUE(5),
+        HTML_BODY(6),
+        REQUEST_TYPE(7),
+        DATA(8),
+        COOKIES(13),
+    }
+
+    private var buffer: ByteBuffer = allocate(INITIAL_CAPACITY)
+    private val encoder = Charsets.UTF_8.newEncoder()
+        .onMalformedInput(CodingErrorAction.REPLACE)
+        .onUnmappableCharacter(CodingErrorAction.REPLACE)
+
+    private var trimGeneration = 0
+
+    fun begin(kind: Kind): WebviewEventFrame {
+        if (trimGeneration != trimRequests && buffer.capacity() > INITIAL_CAPACITY) {
+            buffer = allocate(INITIAL_CAPACITY)
+        }
+        trimGeneration = trimRequests
+        buffer.clear()
+        buffer.put('O'.code.toByte())
+        buffer.put('W'.code.toByte())
+        buffer.put(VERSION)
+        buffer.put(kind.code)
+        return this
+    }
+
+    fun put(tag: Tag, value: String): WebviewEventFrame {
+        ensureRemaining(FIELD_HEADER_SIZE + value.length)
+        val fieldStart = buffer.position()
+        buffer.put(tag.code)
+        buffer.putInt(0)
+
+        val chars = CharBuffer.wrap(value)
+        encoder.reset()
+        while (true) {
+            val result = encoder.encode(chars, buffer, true)
+            if (result == CoderResult.OVERFLOW) {
+                // Worst case is 3 bytes per UTF-16 unit for what is left.
+                grow(chars.remaining() * 3)
+                continue
+            }
+            encoder.flush(buffer)
+            break
+        }
+
+        val length = buffer.position() - fieldStart - FIELD_HEADER_SIZE
+        buffer.putInt(fieldStart + 1, length)
+        return this
+    }
+
+    fun putIfNotEmpty(tag: Tag, value: String?): WebviewEventFrame {
+        if (!value.isNullOrEmpty()) {
+            put(tag, value)
+        }
+        return this
+    }
+
+    /** Hands the frame to libsdk via [OpacityCore.emitWebviewEventFrame]. */
+    fun emit() {
+        OpacityCore.emitWebviewEventFrame(buffer, buffer.position())
+    }
+
+    private fun ensureRemaining(bytes: Int) {
+        if (buffer.remaining() < bytes) {
+            grow(bytes)
+        }
+    }
+
+    private fun grow(extra: Int) {
+        val needed = buffer.position() + extra
+        var capacity = buffer.capacity() * 2
+        while (capacity < needed) {
+            capacity *= 2
+        }
+        val grown = allocate(capacity)
+        buffer.flip()
+        grown.put(buffer)
+        buffer = grown
+    }
+
+    companion object {
+        private const val VERSION: Byte = 1
+        private const val FIELD_HEADER_SIZE = 5
+        private const val INITIAL_CAPACITY = 16 * 1024
+
+        private val writers = object : ThreadLocal<WebviewEventFrame>() {
+            override fun initialValue() = WebviewEventFrame()
+        }
+
+        private fun allocate(capacity: Int): ByteBuffer =
+            ByteBuffer.allocateDirect(capacity).order(ByteOrder.LITTLE_ENDIAN)
+
+        /** Bumped by [trimBuffers]; writers drop grown buffers on their next [begin]. */
+        @Volatile
+        private var trimRequests = 0
+
+        fun writer(): WebviewEventFrame = writers.get()!!
+
+        /**
+         * Asks every writer to shrink back to its initial buffer. Writers belong to their
+         * threads, so each one does it the next time it builds a frame.
+         */
+        fun trimBuffers() {
+            trimRequests++
+        }
+    }
+}
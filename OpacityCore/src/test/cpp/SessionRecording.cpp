@@ -0,0 +1,169 @@
+#include "SessionRecording.h"
+#include "Json.h"
+
+#include <cstdio>
+#include <fstream>
+
+using opacity_bridge::JsonValue;
+using opacity_bridge::WebviewEventKind;
+using opacity_bridge::WebviewEventTag;
+
+namespace opacity_bridge_test {
+
+namespace {
+
+std::string renderPage(int step) {
+  std::string html = "<html><head><title>Account</title></head><body>";
+  html.append("<nav><a href=\"/\">Home</a><a href=\"/trips\">Trips</a>"
+              "<a href=\"/wallet\">Wallet</a></nav><main>");
+  for (int row = 0; row < 300; row++) {
+    char line[128];
+    // Each render updates a few adjacent rows, like a list item being
+    // edited, and leaves the rest of the document alone.
+    int value = row / 6 == step % 50 ? row * 7 + step : row * 7;
+    snprintf(line, sizeof(line),
+             "<div class=\"row\" data-id=\"%d\"><span>Item %d</span>"
+             "<b>%d.00</b></div>",
+             row, row, value);
+    html.append(line);
+  }
+  char footer[96];
+  snprintf(footer, sizeof(footer), "</main><footer>render %d</footer>", step);
+  html.append(footer);
+  html.append("</body></html>");
+  return html;
+}
+
+bool kindFor(const std::string &name, WebviewEventKind &kind) {
+  if (name == "navigation") {
+    kind = WebviewEventKind::Navigation;
+  } else if (name == "location_changed") {
+    kind = WebviewEventKind::LocationChanged;
+  } else if (name == "intercepted_request") {
+    kind = WebviewEventKind::InterceptedRequest;
+  } else if (name == "close") {
+    kind = WebviewEventKind::Close;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+bool parseRecordedEvent(const std::string &json, RecordedEvent &out) {
+  JsonValue value;
+  if (!opacity_bridge::parseJson(json, value) ||
+      value.type != JsonValue::Type::Object) {
+    return false;
+  }
+  const JsonValue *event = value.find("event");
+  if (event == nullptr || !kindFor(event->text, out.kind)) {
+    return false;
+  }
+  out.json = json;
+  out.fields.clear();
+  for (const auto &[key, member] : value.members) {
+    if (key == "id") {
+      out.fields.emplace_back(WebviewEventTag::Id, member.text);
+    } else if (key == "url") {
+      out.fields.emplace_back(WebviewEventTag::Url, member.text);
+    } else if (key == "html_body") {
+      out.fields.emplace_back(WebviewEventTag::HtmlBody, member.text);
+    } else if (key == "request_type") {
+      out.fields.emplace_back(WebviewEventTag::RequestType, member.text);
+    } else if (key == "data") {
+      std::string data;
+      opacity_bridge::appendCanonicalJson(data, member);
+      out.fields.emplace_back(WebviewEventTag::Data, data);
+    } else if (key == "visited_urls") {
+      for (const auto &url : member.items) {
+        out.fields.emplace_back(WebviewEventTag::VisitedUrl, url.text);
+      }
+    } else if (key == "cookies" && member.type == JsonValue::Type::Object) {
+      out.fields.emplace_back(WebviewEventTag::Cookies, "");
+      for (const auto &[name, cookie] : member.members) {
+        out.fields.emplace_back(WebviewEventTag::CookieName, name);
+        out.fields.emplace_back(WebviewEventTag::CookieValue, cookie.text);
+      }
+    }
+  }
+  return true;
+}
+
+void encodeRecordedEvent(const RecordedEvent &event, std::string &frame) {
+  opacity_bridge::beginWebviewEventFrame(frame, event.kind);
+  for (const auto &[tag, value] : event.fields) {
+    opacity_bridge::appendWebviewEventField(frame, tag, value);
+  }
+}
+
+bool loadRecordedEvents(const char *path, std::vector<std::string> &out) {
+  std::ifstream file(path);
+  if (!file) {
+    return false;
+  }
+  std::string line;
+  while (std::getline(file, line)) {
+    JsonValue record;
+    if (!opacity_bridge::parseJson(line, record)) {
+      continue;
+    }
+    const JsonValue *type = record.find("type");
+    const JsonValue *payload = record.find("payload");
+    if (type != nullptr && type->text == "event" && payload != nullptr) {
+      out.push_back(payload->text);
+    }
+  }
+  return !out.empty();
+}
+
+std::vector<std::string> syntheticSession(int navigations) {
+  std::vector<std::string> events;
+  std::vector<std::string> visited;
+  for (int step = 0; step < navigations; step++) {
+    std::string url = "https://example.com/trips/" + std::to_string(step);
+    visited.push_back(url);
+
+    std::string request = "{\"event\":\"intercepted_request\","
+                          "\"request_type\":\"fetch\",\"data\":{\"url\":";
+    opacity_bridge::appendJsonString(request, url + "/details");
+    request.append(",\"status\":200,\"body\":");
+    opacity_bridge::appendJsonString(
+        request, std::string(512 + step % 7 * 64, 'x'));
+    request.append("},\"id\":\"");
+    request.append(std::to_string(1700000000000LL + step * 3));
+    request.append("\"}");
+    events.push_back(request);
+
+    std::string navigation = "{\"event\":\"navigation\",\"url\":";
+    opacity_bridge::appendJsonString(navigation, url);
+    navigation.append(",\"visited_urls\":[");
+    for (size_t i = 0; i < visited.size(); i++) {
+      if (i > 0) {
+        navigation.push_back(',');
+      }
+      opacity_bridge::appendJsonString(navigation, visited[i]);
+    }
+    navigation.append("],\"cookies\":{\"session\":\"abc123\",\"csrf\":");
+    opacity_bridge::appendJsonString(navigation,
+                                     "tok" + std::to_string(step % 5));
+    navigation.append("},\"html_body\":");
+    opacity_bridge::appendJsonString(navigation, renderPage(step));
+    navigation.append(",\"id\":\"");
+    navigation.append(std::to_string(1700000000001LL + step * 3));
+    navigation.append("\"}");
+    events.push_back(navigation);
+    visited.clear();
+
+    std::string location = "{\"event\":\"location_changed\",\"url\":";
+    opacity_bridge::appendJsonString(location, url + "#summary");
+    location.append(",\"id\":\"");
+    location.append(std::to_string(1700000000002LL + step * 3));
+    location.append("\"}");
+    events.push_back(location);
+  }
+  return events;
+}
+
+} // namespace opacity_bridge_test
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "WebviewEventFrame.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace opacity_bridge_test {
+
+// An emit_webview_event payload together with the frame fields
+// WebviewEventFrame.kt writes for it.
+struct RecordedEvent {
+  std::string json;
+  opacity_bridge::WebviewEventKind kind;
+  std::vector<std::pair<opacity_bridge::WebviewEventTag, std::string>> fields;
+};
+
+// Returns false for payloads that aren't a known webview event.
+bool parseRecordedEvent(const std::string &json, RecordedEvent &out);
+
+// Writes `event` as a binary frame into `frame`.
+void encodeRecordedEvent(const RecordedEvent &event, std::string &frame);
+
+// Loads the JSON payload of every "event" record in a FlowRecorder
+// recording. Returns false if the file can't be read or holds no events.
+bool loadRecordedEvents(const char *path, std::vector<std::string> &out);
+
+// A deterministic single-page-app session for when no recording is given:
+// a ~30 KB page re-rendered with small edits between navigations, mixed with
+// intercepted requests and location changes, as emit_webview_event JSON.
+std::vector<std::string> syntheticSession(int navigations);
+
+} // namespace opacity_bridge_test
@@ -0,0 +1,139 @@
+#include "StandInBackend.h"
+#include "Json.h"
+
+#include <arpa/inet.h>
+#include <cstdio>
+#include <fstream>
+#include <netinet/in.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace opacity_bridge_test {
+
+namespace {
+
+void sendAll(int fd, const std::string &data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n <= 0) {
+      return;
+    }
+    sent += static_cast<size_t>(n);
+  }
+}
+
+// Reads up to the end of the request headers; requests carry no body.
+std::string readRequest(int fd) {
+  std::string request;
+  char buf[1024];
+  while (request.find("\r\n\r\n") == std::string::npos &&
+         request.size() < 16 * 1024) {
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n <= 0) {
+      break;
+    }
+    request.append(buf, static_cast<size_t>(n));
+  }
+  return request;
+}
+
+} // namespace
+
+StandInBackend::StandInBackend(Routes routes) : routes_(std::move(routes)) {}
+
+StandInBackend::~StandInBackend() { stop(); }
+
+bool StandInBackend::start() {
+  listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
+  if (listenFd_ < 0) {
+    return false;
+  }
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof(addr);
+  if (bind(listenFd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+      listen(listenFd_, 16) != 0 ||
+      getsockname(listenFd_, reinterpret_cast<sockaddr *>(&addr), &length) !=
+          0) {
+    close(listenFd_);
+    listenFd_ = -1;
+    return false;
+  }
+  port_ = ntohs(addr.sin_port);
+  thread_ = std::thread(&StandInBackend::serve, this);
+  return true;
+}
+
+void StandInBackend::stop() {
+  if (listenFd_ < 0) {
+    return;
+  }
+  // Wakes the blocked accept.
+  shutdown(listenFd_, SHUT_RDWR);
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  close(listenFd_);
+  listenFd_ = -1;
+}
+
+std::string StandInBackend::url() const {
+  return "http://127.0.0.1:" + std::to_string(port_);
+}
+
+void StandInBackend::serve() {
+  while (true) {
+    int fd = accept(listenFd_, nullptr, nullptr);
+    if (fd < 0) {
+      return;
+    }
+    std::string request = readRequest(fd);
+    requests_.fetch_add(1);
+
+    // "GET <path> HTTP/1.x"
+    std::string path;
+    size_t start = request.find(' ');
+    size_t end =
+        start == std::string::npos ? start : request.find(' ', start + 1);
+    if (request.compare(0, 4, "GET ") == 0 && end != std::string::npos) {
+      path = request.substr(start + 1, end - start - 1);
+    }
+    auto route = routes_.find(path);
+    std::string response;
+    if (route == routes_.end()) {
+      response = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+    } else {
+      response = "HTTP/1.0 200 OK\r\nContent-Type: application/json\r\n"
+                 "Content-Length: " +
+                 std::to_string(route->second.size()) + "\r\n\r\n" +
+                 route->second;
+    }
+    sendAll(fd, response);
+    close(fd);
+  }
+}
+
+bool StandInBackend::loadRoutes(const char *path, Routes &out) {
+  std::ifstream file(path);
+  if (!file) {
+    return false;
+  }
+  std::stringstream contents;
+  contents << file.rdbuf();
+  opacity_bridge::JsonValue document;
+  if (!opacity_bridge::parseJson(contents.str(), document) ||
+      document.type != opacity_bridge::JsonValue::Type::Object) {
+    return false;
+  }
+  for (const auto &member : document.members) {
+    std::string body;
+    opacity_bridge::appendCanonicalJson(body, member.second);
+    out[member.first] = std::move(body);
+  }
+  return true;
+}
+
+} // namespace opacity_bridge_test
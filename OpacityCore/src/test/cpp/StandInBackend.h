@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+namespace opacity_bridge_test {
+
+// Loopback HTTP/1.0 server standing in for the Opacity backend while a flow
+// is replayed: GETs of a known path get its canned JSON body, anything else
+// a 404. Point libsdk at it with OPACITY_BACKEND_URL before opacity_init.
+class StandInBackend {
+public:
+  // Maps request paths to response bodies.
+  using Routes = std::unordered_map<std::string, std::string>;
+
+  explicit StandInBackend(Routes routes);
+  ~StandInBackend();
+
+  StandInBackend(const StandInBackend &) = delete;
+  StandInBackend &operator=(const StandInBackend &) = delete;
+
+  // Listens on an ephemeral 127.0.0.1 port. Returns false if it can't.
+  bool start();
+  void stop();
+
+  // http://127.0.0.1:<port>, valid once started.
+  std::string url() const;
+  uint64_t requests() const { return requests_.load(); }
+
+  // Reads {"<path>": <body>, ...}; bodies are served as canonical JSON.
+  static bool loadRoutes(const char *path, Routes &out);
+
+private:
+  void serve();
+
+  Routes routes_;
+  int listenFd_ = -1;
+  uint16_t port_ = 0;
+  std::thread thread_;
+  std::atomic<uint64_t> requests_{0};
+};
+
+} // namespace opacity_bridge_test
@@ -0,0 +1,483 @@
+// Soak harness for the JNI bridge. Embeds a JVM with the test doubles in
+// java/, links the bridge against sdk_stub.cpp and hammers every upcall, plus
+// a share of flows and webview events, from a pool of native threads the way
+// libsdk's Rust threads do.
+//
+// JNI refs are counted by swapping the VM's JNI function table through JVMTI:
+// every call that hands out a local ref on a worker thread bumps a per-thread
+// count, DeleteLocalRef and PopLocalFrame take it back. An upcall that leaves
+// the count higher than it found it leaked a local ref; global refs made on
+// worker threads must be gone again by the end of the run.
+//
+// Workers never detach themselves: the bridge's thread-exit hook has to, so
+// the live attached count must be back at 0 once they are joined.
+//
+// Fails (exit 1) on any ref leak, on threads attached more than once or left
+// attached after they exit, on RSS growth past --max-rss-growth-kb after
+// warm-up, or on an upcall whose p99 exceeds --max-p99-us.
+//
+// Usage: bridge_soak --classpath=<jar> [--threads=8] [--seconds=30]
+//                    [--warmup-seconds=3] [--max-p99-us=2000]
+//                    [--max-rss-growth-kb=16384]
+
+#include "BridgeMetrics.h"
+#include "Json.h"
+#include "sdk.h"
+
+#include <jni.h>
+#include <jvmti.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" jint JNI_OnLoad(JavaVM *vm, void *reserved);
+extern "C" jint Java_com_opacitylabs_opacitycore_OpacityCore_init(
+    JNIEnv *env, jobject thiz, jstring api_key, jboolean dry_run,
+    jint environment_enum, jboolean show_errors_in_webview);
+extern "C" jobject Java_com_opacitylabs_opacitycore_OpacityCore_getNative(
+    JNIEnv *env, jobject thiz, jstring name, jstring params, jint priority);
+extern "C" void Java_com_opacitylabs_opacitycore_OpacityCore_emitWebviewEvent(
+    JNIEnv *env, jobject thiz, jstring event_json);
+
+using opacity_bridge::JsonValue;
+using opacity_bridge::LatencyHistogram;
+
+namespace {
+
+struct Options {
+  std::string classpath;
+  int threads = 8;
+  int seconds = 30;
+  int warmupSeconds = 3;
+  long maxP99Micros = 2000;
+  long maxRssGrowthKb = 16 * 1024;
+};
+
+// ---- JNI ref accounting ---------------------------------------------------
+
+jniNativeInterface *originalJni;
+jniNativeInterface countingJni;
+
+thread_local bool isWorker = false;
+thread_local int64_t liveLocalRefs = 0;
+thread_local std::vector<int64_t> localFrames;
+std::atomic<int64_t> workerGlobalRefs{0};
+
+template <typename Ref> Ref trackLocal(Ref ref) {
+  if (ref != nullptr && isWorker) {
+    liveLocalRefs++;
+  }
+  return ref;
+}
+
+jstring JNICALL countingNewStringUTF(JNIEnv *env, const char *utf) {
+  return trackLocal(originalJni->NewStringUTF(env, utf));
+}
+
+jclass JNICALL countingFindClass(JNIEnv *env, const char *name) {
+  return trackLocal(originalJni->FindClass(env, name));
+}
+
+jclass JNICALL countingGetObjectClass(JNIEnv *env, jobject obj) {
+  return trackLocal(originalJni->GetObjectClass(env, obj));
+}
+
+jobject JNICALL countingNewLocalRef(JNIEnv *env, jobject ref) {
+  return trackLocal(originalJni->NewLocalRef(env, ref));
+}
+
+jthrowable JNICALL countingExceptionOccurred(JNIEnv *env) {
+  return trackLocal(originalJni->ExceptionOccurred(env));
+}
+
+jobject JNICALL countingNewObjectV(JNIEnv *env, jclass clazz,
+                                   jmethodID method, va_list args) {
+  return trackLocal(originalJni->NewObjectV(env, clazz, method, args));
+}
+
+jobject JNICALL countingCallObjectMethodV(JNIEnv *env, jobject obj,
+                                          jmethodID method, va_list args) {
+  return trackLocal(originalJni->CallObjectMethodV(env, obj, method, args));
+}
+
+jobject JNICALL countingCallStaticObjectMethodV(JNIEnv *env, jclass clazz,
+                                                jmethodID method,
+                                                va_list args) {
+  return trackLocal(
+      originalJni->CallStaticObjectMethodV(env, clazz, method, args));
+}
+
+void JNICALL countingDeleteLocalRef(JNIEnv *env, jobject ref) {
+  if (ref != nullptr && isWorker) {
+    liveLocalRefs--;
+  }
+  originalJni->DeleteLocalRef(env, ref);
+}
+
+jint JNICALL countingPushLocalFrame(JNIEnv *env, jint capacity) {
+  jint result = originalJni->PushLocalFrame(env, capacity);
+  if (result == JNI_OK && isWorker) {
+    localFrames.push_back(liveLocalRefs);
+  }
+  return result;
+}
+
+jobject JNICALL countingPopLocalFrame(JNIEnv *env, jobject result) {
+  jobject survivor = originalJni->PopLocalFrame(env, result);
+  if (isWorker && !localFrames.empty()) {
+    liveLocalRefs = localFrames.back() + (survivor != nullptr ? 1 : 0);
+    localFrames.pop_back();
+  }
+  return survivor;
+}
+
+jobject JNICALL countingNewGlobalRef(JNIEnv *env, jobject ref) {
+  jobject global = originalJni->NewGlobalRef(env, ref);
+  if (global != nullptr && isWorker) {
+    workerGlobalRefs.fetch_add(1, std::memory_order_relaxed);
+  }
+  return global;
+}
+
+void JNICALL countingDeleteGlobalRef(JNIEnv *env, jobject ref) {
+  if (ref != nullptr && isWorker) {
+    workerGlobalRefs.fetch_sub(1, std::memory_order_relaxed);
+  }
+  originalJni->DeleteGlobalRef(env, ref);
+}
+
+bool installRefCounting(JavaVM *vm) {
+  jvmtiEnv *jvmti = nullptr;
+  if (vm->GetEnv(reinterpret_cast<void **>(&jvmti), JVMTI_VERSION_1_2) !=
+          JNI_OK ||
+      jvmti->GetJNIFunctionTable(&originalJni) != JVMTI_ERROR_NONE) {
+    return false;
+  }
+  countingJni = *originalJni;
+  countingJni.NewStringUTF = countingNewStringUTF;
+  countingJni.FindClass = countingFindClass;
+  countingJni.GetObjectClass = countingGetObjectClass;
+  countingJni.NewLocalRef = countingNewLocalRef;
+  countingJni.ExceptionOccurred = countingExceptionOccurred;
+  countingJni.NewObjectV = countingNewObjectV;
+  countingJni.CallObjectMethodV = countingCallObjectMethodV;
+  countingJni.CallStaticObjectMethodV = countingCallStaticObjectMethodV;
+  countingJni.DeleteLocalRef = countingDeleteLocalRef;
+  countingJni.PushLocalFrame = countingPushLocalFrame;
+  countingJni.PopLocalFrame = countingPopLocalFrame;
+  countingJni.NewGlobalRef = countingNewGlobalRef;
+  countingJni.DeleteGlobalRef = countingDeleteGlobalRef;
+  return jvmti->SetJNIFunctionTable(&countingJni) == JVMTI_ERROR_NONE;
+}
+
+// ---- Workload -------------------------------------------------------------
+
+JavaVM *vm;
+jobject core;
+
+void freeResult(const char *value) { free(const_cast<char *>(value)); }
+
+// Upcalls are libsdk calling the bridge; nothing around them may hold on to
+// a local ref.
+struct Upcall {
+  const char *name;
+  void (*run)();
+};
+
+const Upcall kUpcalls[] = {
+    {"secure_set", [] { opacity_core::secure_set("session", "abc123"); }},
+    {"secure_get", [] { freeResult(opacity_core::secure_get("session")); }},
+    {"android_prepare_request",
+     [] { opacity_core::android_prepare_request("https://example.com/"); }},
+    {"android_set_request_header",
+     [] { opacity_core::android_set_request_header("X-Test", "1"); }},
+    {"android_present_webview",
+     [] { opacity_core::android_present_webview(true); }},
+    {"android_set_cookie",
+     [] {
+       opacity_core::android_set_cookie("https://example.com/", "a=b");
+     }},
+    {"android_webview_change_url",
+     [] { opacity_core::android_webview_change_url("https://example.com/a"); }},
+    {"android_close_webview", [] { opacity_core::android_close_webview(); }},
+    {"android_is_app_foregrounded",
+     [] { opacity_core::android_is_app_foregrounded(); }},
+    {"android_get_os_version",
+     [] { freeResult(opacity_core::android_get_os_version()); }},
+    {"android_get_device_manufacturer",
+     [] { freeResult(opacity_core::android_get_device_manufacturer()); }},
+    {"android_get_device_model",
+     [] { freeResult(opacity_core::android_get_device_model()); }},
+    {"android_get_device_locale",
+     [] { freeResult(opacity_core::android_get_device_locale()); }},
+    {"android_get_sdk_version",
+     [] { opacity_core::android_get_sdk_version(); }},
+    {"android_get_screen_width",
+     [] { opacity_core::android_get_screen_width(); }},
+    {"android_get_screen_height",
+     [] { opacity_core::android_get_screen_height(); }},
+    {"android_get_screen_density",
+     [] { opacity_core::android_get_screen_density(); }},
+    {"android_get_screen_dpi", [] { opacity_core::android_get_screen_dpi(); }},
+    {"android_get_device_cpu",
+     [] { freeResult(opacity_core::android_get_device_cpu()); }},
+    {"android_get_device_codename",
+     [] { freeResult(opacity_core::android_get_device_codename()); }},
+    {"android_get_bootloader",
+     [] { freeResult(opacity_core::android_get_bootloader()); }},
+    {"android_get_radio",
+     [] { freeResult(opacity_core::android_get_radio()); }},
+    {"android_get_build_time",
+     [] { freeResult(opacity_core::android_get_build_time()); }},
+    {"android_get_browser_cookies_for_current_url",
+     [] {
+       freeResult(opacity_core::android_get_browser_cookies_for_current_url());
+     }},
+    {"android_get_browser_cookies_for_domain",
+     [] {
+       freeResult(
+           opacity_core::android_get_browser_cookies_for_domain("example.com"));
+     }},
+    {"android_eval_js",
+     [] { freeResult(opacity_core::android_eval_js("document.title", 1.0)); }},
+    {"get_ip_address", [] { freeResult(opacity_core::get_ip_address()); }},
+};
+
+constexpr int kUpcallCount = sizeof(kUpcalls) / sizeof(kUpcalls[0]);
+// One flow and one webview event per this many upcalls.
+constexpr int kDowncallEvery = 16;
+
+struct UpcallStats {
+  LatencyHistogram latency;
+  std::atomic<uint64_t> localRefLeaks{0};
+};
+
+UpcallStats upcallStats[kUpcallCount];
+std::atomic<uint64_t> frameImbalances{0};
+std::atomic<uint64_t> operations{0};
+std::atomic<bool> stopping{false};
+
+// Downcalls run the way the VM runs a native method: inside a local frame
+// that is dropped when it returns.
+void runDowncalls(JNIEnv *env, uint64_t iteration) {
+  env->PushLocalFrame(16);
+  jstring name = env->NewStringUTF("soak_flow");
+  jstring params = env->NewStringUTF(
+      iteration % 2 == 0 ? "{\"page\":1}" : "{\"page\":2}");
+  Java_com_opacitylabs_opacitycore_OpacityCore_getNative(env, core, name,
+                                                         params, 0);
+  jstring event = env->NewStringUTF(
+      "{\"event\":\"location_changed\",\"url\":\"https://example.com/\","
+      "\"id\":\"1\"}");
+  Java_com_opacitylabs_opacitycore_OpacityCore_emitWebviewEvent(env, core,
+                                                                event);
+  env->PopLocalFrame(nullptr);
+}
+
+void worker(int index) {
+  isWorker = true;
+  JNIEnv *env = nullptr;
+  uint64_t iteration = static_cast<uint64_t>(index) * 7;
+  while (!stopping.load(std::memory_order_relaxed)) {
+    int which = static_cast<int>(iteration % kUpcallCount);
+    int64_t refsBefore = liveLocalRefs;
+    size_t framesBefore = localFrames.size();
+
+    uint64_t start = opacity_bridge::monotonicNanos();
+    kUpcalls[which].run();
+    upcallStats[which].latency.record(opacity_bridge::monotonicNanos() - start);
+
+    if (liveLocalRefs != refsBefore) {
+      upcallStats[which].localRefLeaks.fetch_add(1, std::memory_order_relaxed);
+      liveLocalRefs = refsBefore;
+    }
+    if (localFrames.size() != framesBefore) {
+      frameImbalances.fetch_add(1, std::memory_order_relaxed);
+      localFrames.resize(framesBefore);
+    }
+
+    // The first upcall attached this thread.
+    if (env == nullptr) {
+      vm->GetEnv(reinterpret_cast<void **>(&env), JNI_VERSION_1_6);
+    }
+    if (env != nullptr && iteration % kDowncallEvery == 0) {
+      runDowncalls(env, iteration);
+    }
+    operations.fetch_add(1, std::memory_order_relaxed);
+    iteration++;
+  }
+  isWorker = false;
+}
+
+// ---- Reporting ------------------------------------------------------------
+
+long long statsInteger(const char *key) {
+  JsonValue stats;
+  if (!opacity_bridge::parseJson(opacity_bridge::bridgeStatsJson(), stats)) {
+    return -1;
+  }
+  const JsonValue *value = stats.find(key);
+  return value != nullptr ? atoll(value->text.c_str()) : -1;
+}
+
+bool parseOptions(int argc, char **argv, Options &options) {
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *value = strchr(arg, '=');
+    if (value == nullptr) {
+      return false;
+    }
+    std::string key(arg, value - arg);
+    value++;
+    if (key == "--classpath") {
+      options.classpath = value;
+    } else if (key == "--threads") {
+      options.threads = atoi(value);
+    } else if (key == "--seconds") {
+      options.seconds = atoi(value);
+    } else if (key == "--warmup-seconds") {
+      options.warmupSeconds = atoi(value);
+    } else if (key == "--max-p99-us") {
+      options.maxP99Micros = atol(value);
+    } else if (key == "--max-rss-growth-kb") {
+      options.maxRssGrowthKb = atol(value);
+    } else {
+      return false;
+    }
+  }
+  return !options.classpath.empty() && options.threads > 0 &&
+         options.seconds > 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!parseOptions(argc, argv, options)) {
+    fprintf(stderr,
+            "usage: %s --classpath=<jar> [--threads=N] [--seconds=N] "
+            "[--warmup-seconds=N] [--max-p99-us=N] [--max-rss-growth-kb=N]\n",
+            argv[0]);
+    return 2;
+  }
+
+  std::string classpath = "-Djava.class.path=" + options.classpath;
+  JavaVMOption vmOptions[] = {{const_cast<char *>(classpath.c_str()), nullptr},
+                              {const_cast<char *>("-Xmx256m"), nullptr}};
+  JavaVMInitArgs vmArgs{};
+  vmArgs.version = JNI_VERSION_1_8;
+  vmArgs.nOptions = sizeof(vmOptions) / sizeof(vmOptions[0]);
+  vmArgs.options = vmOptions;
+  JNIEnv *env = nullptr;
+  if (JNI_CreateJavaVM(&vm, reinterpret_cast<void **>(&env), &vmArgs) !=
+      JNI_OK) {
+    fprintf(stderr, "could not create the JVM\n");
+    return 2;
+  }
+  if (!installRefCounting(vm)) {
+    fprintf(stderr, "could not install the JNI function table\n");
+    return 2;
+  }
+
+  JNI_OnLoad(vm, nullptr);
+  jclass coreClass = env->FindClass("com/opacitylabs/opacitycore/OpacityCore");
+  jmethodID constructor =
+      coreClass != nullptr ? env->GetMethodID(coreClass, "<init>", "()V")
+                           : nullptr;
+  if (constructor == nullptr) {
+    fprintf(stderr, "test doubles not found on %s\n",
+            options.classpath.c_str());
+    return 2;
+  }
+  core = env->NewGlobalRef(env->NewObject(coreClass, constructor));
+  if (Java_com_opacitylabs_opacitycore_OpacityCore_init(
+          env, core, env->NewStringUTF("soak"), JNI_FALSE, 0, JNI_FALSE) !=
+      opacity_core::OPACITY_OK) {
+    fprintf(stderr, "opacity_init failed\n");
+    return 2;
+  }
+
+  std::vector<std::thread> workers;
+  for (int i = 0; i < options.threads; i++) {
+    workers.emplace_back(worker, i);
+  }
+
+  std::this_thread::sleep_for(std::chrono::seconds(options.warmupSeconds));
+  long long rssBefore = statsInteger("rss_bytes");
+  int64_t globalRefsBefore = workerGlobalRefs.load();
+  uint64_t operationsBefore = operations.load();
+
+  std::this_thread::sleep_for(std::chrono::seconds(options.seconds));
+  uint64_t measured = operations.load() - operationsBefore;
+  long long rssAfter = statsInteger("rss_bytes");
+  stopping.store(true);
+  for (auto &thread : workers) {
+    thread.join();
+  }
+  int64_t globalRefsAfter = workerGlobalRefs.load();
+  long long attaches = statsInteger("thread_attaches");
+  long long stillAttached = statsInteger("attached_threads");
+
+  bool failed = false;
+  printf("%d threads, %d s: %.0f ops/s\n", options.threads, options.seconds,
+         static_cast<double>(measured) / options.seconds);
+  printf("%-44s %10s %10s %8s\n", "upcall", "calls", "p99_us", "leaks");
+  for (int i = 0; i < kUpcallCount; i++) {
+    const UpcallStats &stats = upcallStats[i];
+    uint64_t p99 = stats.latency.percentileNanos(99) / 1000;
+    uint64_t leaks = stats.localRefLeaks.load();
+    printf("%-44s %10llu %10llu %8llu\n", kUpcalls[i].name,
+           static_cast<unsigned long long>(stats.latency.count()),
+           static_cast<unsigned long long>(p99),
+           static_cast<unsigned long long>(leaks));
+    if (leaks > 0) {
+      fprintf(stderr, "FAIL %s leaked local refs\n", kUpcalls[i].name);
+      failed = true;
+    }
+    if (static_cast<long>(p99) > options.maxP99Micros) {
+      fprintf(stderr, "FAIL %s p99 %llu us > %ld us\n", kUpcalls[i].name,
+              static_cast<unsigned long long>(p99), options.maxP99Micros);
+      failed = true;
+    }
+  }
+
+  long long rssGrowthKb = (rssAfter - rssBefore) / 1024;
+  printf("rss growth after warm-up: %lld KB\n", rssGrowthKb);
+  printf("worker global refs: %lld -> %lld\n",
+         static_cast<long long>(globalRefsBefore),
+         static_cast<long long>(globalRefsAfter));
+  printf("thread attaches: %lld, still attached: %lld\n", attaches,
+         stillAttached);
+  if (frameImbalances.load() > 0) {
+    fprintf(stderr, "FAIL %llu upcalls left a local frame pushed\n",
+            static_cast<unsigned long long>(frameImbalances.load()));
+    failed = true;
+  }
+  if (globalRefsAfter > 0) {
+    fprintf(stderr, "FAIL %lld global refs made on worker threads leaked\n",
+            static_cast<long long>(globalRefsAfter));
+    failed = true;
+  }
+  if (attaches != options.threads) {
+    fprintf(stderr, "FAIL %lld thread attaches for %d threads\n", attaches,
+            options.threads);
+    failed = true;
+  }
+  if (stillAttached != 0) {
+    fprintf(stderr, "FAIL %lld threads still attached after they exited\n",
+            stillAttached);
+    failed = true;
+  }
+  if (rssBefore < 0 || rssAfter < 0 || rssGrowthKb > options.maxRssGrowthKb) {
+    fprintf(stderr, "FAIL rss grew by %lld KB (limit %ld KB)\n", rssGrowthKb,
+            options.maxRssGrowthKb);
+    failed = true;
+  }
+  return failed ? 1 : 0;
+}
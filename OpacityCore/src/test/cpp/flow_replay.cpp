@@ -0,0 +1,384 @@
+// Linux replayer for FlowRecorder recordings. Embeds a JVM with the test
+// doubles in java/, links the bridge against sdk_stub.cpp and points
+// OPACITY_BACKEND_URL at a StandInBackend, then replays a recorded flow
+// through OpacityCore.replay's native side and reports replay latency.
+//
+// Without --recording it checks the harness itself: it records a flow, with a
+// flow cache TTL set, and then requires every replay to
+//
+// - execute opacity_get again (the stand-in backend sees each run) instead
+//   of returning the cached result
+// - answer every upcall, get_ip_address included, from the recording
+//   without reaching Java
+// - end with the recorded result, and report a mismatch once the recorded
+//   get_ip_address answer is edited
+// - be refused while a live flow runs, and refuse live flows while it runs
+//
+// Usage: flow_replay --classpath=<jar> [--recording=<file>]
+//                    [--routes=<json>] [--runs=N] [--original-timing=1]
+//
+// --routes maps backend paths to response bodies, {"/flows/<name>": {..}}.
+
+#include "BridgeMetrics.h"
+#include "FlowRecorder.h"
+#include "Json.h"
+#include "StandInBackend.h"
+#include "sdk.h"
+#include "sdk_stub.h"
+
+#include <jni.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+extern "C" jint JNI_OnLoad(JavaVM *vm, void *reserved);
+extern "C" jint Java_com_opacitylabs_opacitycore_OpacityCore_init(
+    JNIEnv *env, jobject thiz, jstring api_key, jboolean dry_run,
+    jint environment_enum, jboolean show_errors_in_webview);
+extern "C" jobject Java_com_opacitylabs_opacitycore_OpacityCore_getNative(
+    JNIEnv *env, jobject thiz, jstring name, jstring params, jint priority);
+extern "C" void Java_com_opacitylabs_opacitycore_OpacityCore_emitWebviewEvent(
+    JNIEnv *env, jobject thiz, jstring event_json);
+extern "C" void Java_com_opacitylabs_opacitycore_OpacityCore_setFlowCacheTtl(
+    JNIEnv *env, jobject thiz, jstring name, jlong ttl_ms);
+extern "C" jboolean
+Java_com_opacitylabs_opacitycore_OpacityCore_nativeStartRecording(
+    JNIEnv *env, jobject thiz, jstring path);
+extern "C" void
+Java_com_opacitylabs_opacitycore_OpacityCore_nativeStopRecording(JNIEnv *env,
+                                                                 jobject thiz);
+extern "C" jstring Java_com_opacitylabs_opacitycore_OpacityCore_replayNative(
+    JNIEnv *env, jobject thiz, jstring path, jboolean original_timing);
+extern "C" jboolean
+Java_com_opacitylabs_opacitycore_OpacityCore_nativeSetBackendUrl(JNIEnv *env,
+                                                                 jobject thiz,
+                                                                 jstring url);
+
+using opacity_bridge::JsonValue;
+using opacity_bridge::LatencyHistogram;
+using opacity_bridge_test::StandInBackend;
+
+namespace {
+
+constexpr const char *kCheckFlow = "replay_check";
+constexpr const char *kEditedIp = "203.0.113.7";
+
+struct Options {
+  std::string classpath;
+  std::string recording;
+  std::string routes;
+  int runs = 20;
+  bool originalTiming = false;
+};
+
+struct Replay {
+  bool ok = false;
+  int status = 0;
+  std::string payload;
+  bool matchesRecording = false;
+};
+
+JNIEnv *env;
+jobject core;
+
+// Sum of upcall counts in getBridgeStats. Replayed upcalls never open an
+// UPCALL_SCOPE, so replays must leave it unchanged.
+long long javaUpcalls() {
+  JsonValue stats;
+  if (!opacity_bridge::parseJson(opacity_bridge::bridgeStatsJson(), stats)) {
+    return -1;
+  }
+  const JsonValue *upcalls = stats.find("upcalls");
+  long long total = 0;
+  for (const auto &site : upcalls->members) {
+    const JsonValue *count = site.second.find("count");
+    total += count != nullptr ? atoll(count->text.c_str()) : 0;
+  }
+  return total;
+}
+
+Replay replay(const std::string &path, bool originalTiming) {
+  Replay out;
+  jstring json = Java_com_opacitylabs_opacitycore_OpacityCore_replayNative(
+      env, core, env->NewStringUTF(path.c_str()),
+      originalTiming ? JNI_TRUE : JNI_FALSE);
+  if (json == nullptr) {
+    return out;
+  }
+  const char *chars = env->GetStringUTFChars(json, nullptr);
+  JsonValue outcome;
+  out.ok = opacity_bridge::parseJson(chars, outcome);
+  env->ReleaseStringUTFChars(json, chars);
+  env->DeleteLocalRef(json);
+  if (!out.ok) {
+    return out;
+  }
+  out.status = atoi(outcome.find("status")->text.c_str());
+  out.payload = outcome.find("payload")->text;
+  out.matchesRecording = outcome.find("matches_recording")->boolean;
+  return out;
+}
+
+// Records one run of kCheckFlow, cached for a minute, with a couple of
+// webview events ahead of it.
+bool recordCheckFlow(const std::string &path) {
+  jstring name = env->NewStringUTF(kCheckFlow);
+  Java_com_opacitylabs_opacitycore_OpacityCore_setFlowCacheTtl(env, core, name,
+                                                               60000);
+  if (!Java_com_opacitylabs_opacitycore_OpacityCore_nativeStartRecording(
+          env, core, env->NewStringUTF(path.c_str()))) {
+    return false;
+  }
+  for (const char *event :
+       {"{\"event\":\"location_changed\",\"url\":\"https://example.com/\"}",
+        "{\"event\":\"html_body\",\"url\":\"https://example.com/\","
+        "\"html\":\"<p>balance</p>\"}"}) {
+    Java_com_opacitylabs_opacitycore_OpacityCore_emitWebviewEvent(
+        env, core, env->NewStringUTF(event));
+  }
+  jobject response = Java_com_opacitylabs_opacitycore_OpacityCore_getNative(
+      env, core, name, nullptr, 0);
+  Java_com_opacitylabs_opacitycore_OpacityCore_nativeStopRecording(env, core);
+  return response != nullptr;
+}
+
+// Replay mode is process-wide, so a replay must not start under a live flow
+// and no live flow may start under a replay.
+bool replayExcludesLiveFlows(const std::string &path) {
+  opacity_bridge::RecordedFlow flow;
+  bool refusedReplay;
+  {
+    opacity_bridge::LiveFlowScope live;
+    refusedReplay = live.admitted() &&
+                    opacity_bridge::startReplay(
+                        path.c_str(), false, opacity_core::emit_webview_event,
+                        flow) == opacity_bridge::ReplayStart::Busy;
+  }
+  if (opacity_bridge::startReplay(path.c_str(), false,
+                                  opacity_core::emit_webview_event, flow) !=
+      opacity_bridge::ReplayStart::Started) {
+    return false;
+  }
+  bool refusedFlow = !opacity_bridge::LiveFlowScope().admitted();
+  opacity_bridge::stopReplay();
+  return refusedReplay && refusedFlow &&
+         opacity_bridge::LiveFlowScope().admitted();
+}
+
+// Rewrites the recorded get_ip_address answer to kEditedIp.
+bool editRecordedIp(const std::string &path) {
+  std::ifstream in(path);
+  std::vector<std::string> lines;
+  std::string line;
+  bool edited = false;
+  while (std::getline(in, line)) {
+    size_t result = line.find(",\"result\":");
+    if (line.find("\"name\":\"get_ip_address\"") != std::string::npos &&
+        result != std::string::npos) {
+      line = line.substr(0, result) + ",\"result\":\"" + kEditedIp + "\"}";
+      edited = true;
+    }
+    lines.push_back(line);
+  }
+  in.close();
+  std::ofstream out(path, std::ios::trunc);
+  for (const auto &each : lines) {
+    out << each << '\n';
+  }
+  return edited;
+}
+
+bool parseOptions(int argc, char **argv, Options &options) {
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *value = strchr(arg, '=');
+    if (value == nullptr) {
+      return false;
+    }
+    std::string key(arg, value - arg);
+    value++;
+    if (key == "--classpath") {
+      options.classpath = value;
+    } else if (key == "--recording") {
+      options.recording = value;
+    } else if (key == "--routes") {
+      options.routes = value;
+    } else if (key == "--runs") {
+      options.runs = atoi(value);
+    } else if (key == "--original-timing") {
+      options.originalTiming = atoi(value) != 0;
+    } else {
+      return false;
+    }
+  }
+  return !options.classpath.empty() && options.runs > 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!parseOptions(argc, argv, options)) {
+    fprintf(stderr,
+            "usage: %s --classpath=<jar> [--recording=<file>] "
+            "[--routes=<json>] [--runs=N] [--original-timing=1]\n",
+            argv[0]);
+    return 2;
+  }
+
+  StandInBackend::Routes routes;
+  if (!options.routes.empty()) {
+    if (!StandInBackend::loadRoutes(options.routes.c_str(), routes)) {
+      fprintf(stderr, "could not read routes from %s\n",
+              options.routes.c_str());
+      return 2;
+    }
+  } else {
+    routes[std::string("/flows/") + kCheckFlow] = "{\"balance\":42}";
+  }
+  StandInBackend backend(std::move(routes));
+  if (!backend.start()) {
+    fprintf(stderr, "could not start the stand-in backend\n");
+    return 2;
+  }
+
+  std::string classpath = "-Djava.class.path=" + options.classpath;
+  JavaVMOption vmOptions[] = {{const_cast<char *>(classpath.c_str()), nullptr},
+                              {const_cast<char *>("-Xmx256m"), nullptr}};
+  JavaVMInitArgs vmArgs{};
+  vmArgs.version = JNI_VERSION_1_8;
+  vmArgs.nOptions = sizeof(vmOptions) / sizeof(vmOptions[0]);
+  vmArgs.options = vmOptions;
+  JavaVM *vm = nullptr;
+  if (JNI_CreateJavaVM(&vm, reinterpret_cast<void **>(&env), &vmArgs) !=
+      JNI_OK) {
+    fprintf(stderr, "could not create the JVM\n");
+    return 2;
+  }
+  JNI_OnLoad(vm, nullptr);
+  jclass coreClass = env->FindClass("com/opacitylabs/opacitycore/OpacityCore");
+  jmethodID constructor =
+      coreClass != nullptr ? env->GetMethodID(coreClass, "<init>", "()V")
+                           : nullptr;
+  if (constructor == nullptr) {
+    fprintf(stderr, "test doubles not found on %s\n",
+            options.classpath.c_str());
+    return 2;
+  }
+  core = env->NewGlobalRef(env->NewObject(coreClass, constructor));
+  if (!Java_com_opacitylabs_opacitycore_OpacityCore_nativeSetBackendUrl(
+          env, core, env->NewStringUTF(backend.url().c_str()))) {
+    fprintf(stderr, "FAIL backend override refused before opacity_init\n");
+    return 1;
+  }
+  if (Java_com_opacitylabs_opacitycore_OpacityCore_init(
+          env, core, env->NewStringUTF("replay"), JNI_FALSE, 0, JNI_FALSE) !=
+      opacity_core::OPACITY_OK) {
+    fprintf(stderr, "opacity_init failed\n");
+    return 2;
+  }
+  // libsdk's threads may read the environment from here on.
+  if (Java_com_opacitylabs_opacitycore_OpacityCore_nativeSetBackendUrl(
+          env, core, nullptr)) {
+    fprintf(stderr, "FAIL backend override taken after opacity_init\n");
+    return 1;
+  }
+
+  bool selfCheck = options.recording.empty();
+  std::string path = options.recording;
+  if (selfCheck) {
+    char temp[] = "/tmp/flow_replay_XXXXXX";
+    int fd = mkstemp(temp);
+    if (fd < 0) {
+      fprintf(stderr, "could not create a recording file\n");
+      return 2;
+    }
+    close(fd);
+    path = temp;
+    if (!recordCheckFlow(path)) {
+      fprintf(stderr, "recording the check flow failed\n");
+      return 2;
+    }
+  }
+
+  long long upcallsBefore = javaUpcalls();
+  uint64_t backendBefore = backend.requests();
+  uint64_t eventsBefore = opacity_bridge_test::sdkStubWebviewEvents();
+  LatencyHistogram latency;
+  int matched = 0;
+  bool failed = false;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < options.runs; i++) {
+    auto runStart = std::chrono::steady_clock::now();
+    Replay run = replay(path, options.originalTiming);
+    latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now() - runStart)
+                       .count());
+    if (!run.ok) {
+      fprintf(stderr, "FAIL no recorded flow in %s\n", path.c_str());
+      return 1;
+    }
+    matched += run.matchesRecording ? 1 : 0;
+  }
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  long long upcalls = javaUpcalls() - upcallsBefore;
+  uint64_t backendRequests = backend.requests() - backendBefore;
+  uint64_t events = opacity_bridge_test::sdkStubWebviewEvents() - eventsBefore;
+
+  printf("%d replays: %.0f replays/s, p50 %llu us, p99 %llu us\n",
+         options.runs, options.runs / seconds,
+         static_cast<unsigned long long>(latency.percentileNanos(50) / 1000),
+         static_cast<unsigned long long>(latency.percentileNanos(99) / 1000));
+  printf("matched recording: %d/%d\n", matched, options.runs);
+  printf("backend requests: %llu, webview events fed: %llu, java upcalls: "
+         "%lld\n",
+         static_cast<unsigned long long>(backendRequests),
+         static_cast<unsigned long long>(events), upcalls);
+
+  if (matched != options.runs) {
+    fprintf(stderr, "FAIL %d replays ended differently from the recording\n",
+            options.runs - matched);
+    failed = true;
+  }
+  if (upcalls != 0) {
+    fprintf(stderr, "FAIL %lld upcalls reached Java while replaying\n",
+            upcalls);
+    failed = true;
+  }
+  if (selfCheck) {
+    if (backendRequests != static_cast<uint64_t>(options.runs)) {
+      fprintf(stderr, "FAIL %llu of %d replays executed opacity_get\n",
+              static_cast<unsigned long long>(backendRequests), options.runs);
+      failed = true;
+    }
+    if (events == 0) {
+      fprintf(stderr, "FAIL no recorded webview events were fed back\n");
+      failed = true;
+    }
+    Replay edited;
+    if (editRecordedIp(path)) {
+      edited = replay(path, false);
+    }
+    if (!edited.ok || edited.matchesRecording ||
+        edited.payload.find(kEditedIp) == std::string::npos) {
+      fprintf(stderr,
+              "FAIL replay did not use the edited get_ip_address answer\n");
+      failed = true;
+    }
+    if (!replayExcludesLiveFlows(path)) {
+      fprintf(stderr, "FAIL replays and live flows ran at the same time\n");
+      failed = true;
+    }
+    unlink(path.c_str());
+  }
+  backend.stop();
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+// Host stand-in for the NDK's <android/log.h>: log lines go to stderr.
+
+#include <cstdarg>
+#include <cstdio>
+
+enum android_LogPriority {
+  ANDROID_LOG_UNKNOWN = 0,
+  ANDROID_LOG_DEFAULT,
+  ANDROID_LOG_VERBOSE,
+  ANDROID_LOG_DEBUG,
+  ANDROID_LOG_INFO,
+  ANDROID_LOG_WARN,
+  ANDROID_LOG_ERROR,
+  ANDROID_LOG_FATAL,
+  ANDROID_LOG_SILENT,
+};
+
+inline int __android_log_write(int prio, const char *tag, const char *text) {
+  return fprintf(stderr, "%d %s: %s\n", prio, tag, text);
+}
+
+__attribute__((format(printf, 3, 4))) inline int
+__android_log_print(int prio, const char *tag, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  int written = fprintf(stderr, "%d %s: ", prio, tag);
+  written += vfprintf(stderr, fmt, args);
+  written += fprintf(stderr, "\n");
+  va_end(args);
+  return written;
+}
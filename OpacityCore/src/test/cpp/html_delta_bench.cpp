@@ -0,0 +1,173 @@
+// Measures what HTML delta mode saves on a single-page-app session: bytes
+// handed to libsdk per navigation with full pages against delta frames, and
+// the cost of the rewrite. Every delta frame is rebuilt the way a consumer
+// would, from its base snapshot plus chunks, and must match the original
+// page byte for byte.
+//
+// Usage: html_delta_bench [recording.jsonl]
+
+#include "HtmlDelta.h"
+#include "SessionRecording.h"
+#include "WebviewEventFrame.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace opacity_bridge;
+using opacity_bridge_test::RecordedEvent;
+
+namespace {
+
+uint32_t readU32(std::string_view value, size_t offset) {
+  uint32_t result = 0;
+  for (int i = 3; i >= 0; i--) {
+    result = (result << 8) | static_cast<unsigned char>(value[offset + i]);
+  }
+  return result;
+}
+
+uint64_t readU64(std::string_view value) {
+  return static_cast<uint64_t>(readU32(value, 0)) |
+         (static_cast<uint64_t>(readU32(value, 4)) << 32);
+}
+
+// Consumer side of delta mode: keeps every snapshot it was sent and
+// rebuilds pages from them.
+class DeltaConsumer {
+public:
+  bool rebuild(const WebviewEvent &event, std::string &html) {
+    uint64_t id = 0;
+    const std::string *base = nullptr;
+    html.clear();
+    for (const auto &field : event.fields) {
+      switch (field.tag) {
+      case WebviewEventTag::HtmlSnapshotId:
+        id = readU64(field.value);
+        break;
+      case WebviewEventTag::HtmlBaseSnapshotId: {
+        auto it = snapshots_.find(readU64(field.value));
+        if (it == snapshots_.end()) {
+          return false;
+        }
+        base = &it->second;
+        break;
+      }
+      case WebviewEventTag::HtmlBody:
+      case WebviewEventTag::HtmlChunk:
+        html.append(field.value);
+        break;
+      case WebviewEventTag::HtmlChunkRef: {
+        uint32_t offset = readU32(field.value, 0);
+        uint32_t length = readU32(field.value, 4);
+        if (base == nullptr || offset + length > base->size()) {
+          return false;
+        }
+        html.append(*base, offset, length);
+        break;
+      }
+      default:
+        break;
+      }
+    }
+    if (id == 0) {
+      return false;
+    }
+    snapshots_[id] = html;
+    return true;
+  }
+
+private:
+  std::unordered_map<uint64_t, std::string> snapshots_;
+};
+
+} // namespace
+
+int main(int argc, char **argv) {
+  std::vector<std::string> payloads;
+  if (argc > 1) {
+    if (!opacity_bridge_test::loadRecordedEvents(argv[1], payloads)) {
+      fprintf(stderr, "no events in %s\n", argv[1]);
+      return 1;
+    }
+  } else {
+    payloads = opacity_bridge_test::syntheticSession(60);
+  }
+
+  setHtmlDeltaEnabled(true);
+  DeltaConsumer consumer;
+  size_t events = 0, navigations = 0, mismatches = 0;
+  size_t fullBytes = 0, deltaBytes = 0, htmlBytes = 0;
+  uint64_t rewriteNanos = 0;
+  std::string frame, delta, rebuilt;
+
+  for (const auto &payload : payloads) {
+    RecordedEvent recorded;
+    if (!opacity_bridge_test::parseRecordedEvent(payload, recorded)) {
+      continue;
+    }
+    events++;
+    opacity_bridge_test::encodeRecordedEvent(recorded, frame);
+    fullBytes += frame.size();
+
+    WebviewEvent event;
+    decodeWebviewEventFrame(reinterpret_cast<const uint8_t *>(frame.data()),
+                            frame.size(), event);
+    auto start = std::chrono::steady_clock::now();
+    bool rewritten = rewriteNavigationFrame(event, delta);
+    rewriteNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+    if (!rewritten) {
+      deltaBytes += frame.size();
+      continue;
+    }
+    navigations++;
+    deltaBytes += delta.size();
+
+    std::string_view original;
+    for (const auto &field : event.fields) {
+      if (field.tag == WebviewEventTag::HtmlBody) {
+        original = field.value;
+      }
+    }
+    htmlBytes += original.size();
+
+    WebviewEvent deltaEvent;
+    if (!decodeWebviewEventFrame(
+            reinterpret_cast<const uint8_t *>(delta.data()), delta.size(),
+            deltaEvent) ||
+        !consumer.rebuild(deltaEvent, rebuilt) || rebuilt != original) {
+      mismatches++;
+    }
+  }
+
+  if (events == 0) {
+    fprintf(stderr, "no usable events\n");
+    return 1;
+  }
+  printf("%zu events, %zu navigations with html\n", events, navigations);
+  printf("bytes/event      full %10.0f   delta %10.0f\n",
+         static_cast<double>(fullBytes) / events,
+         static_cast<double>(deltaBytes) / events);
+  if (navigations > 0) {
+    printf("html/navigation  %10.0f   sent/navigation %10.0f\n",
+           static_cast<double>(htmlBytes) / navigations,
+           static_cast<double>(deltaBytes - (fullBytes - htmlBytes)) /
+               navigations);
+    printf("rewrite          %10.0f ns/navigation\n",
+           static_cast<double>(rewriteNanos) / navigations);
+  }
+  printf("moved            %.1f%% of full\n",
+         100.0 * static_cast<double>(deltaBytes) / fullBytes);
+  printf("%s\n", htmlDeltaStatsJson().c_str());
+  if (mismatches > 0) {
+    fprintf(stderr, "%zu delta frames did not rebuild their page\n",
+            mismatches);
+    return 1;
+  }
+  return 0;
+}
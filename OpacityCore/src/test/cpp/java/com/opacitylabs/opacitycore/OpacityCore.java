@@ -0,0 +1,105 @@
+package com.opacitylabs.opacitycore;
+
+import java.util.concurrent.ConcurrentHashMap;
+
+/**
+ * Test double for the Kotlin OpacityCore object, with every method the bridge's upcalls
+ * look up. Answers are canned and never touch JNI natives, so every local ref the soak
+ * harness sees on a worker thread was made by the bridge.
+ */
+public final class OpacityCore {
+    private final ConcurrentHashMap<String, String> secureStorage = new ConcurrentHashMap<>();
+
+    public void securelySet(String key, String value) {
+        secureStorage.put(key, value);
+    }
+
+    public String securelyGet(String key) {
+        return secureStorage.get(key);
+    }
+
+    public void prepareInAppBrowser(String url) {}
+
+    public void setBrowserHeader(String key, String value) {}
+
+    public void presentBrowser(boolean shouldIntercept) {}
+
+    public void setBrowserCookie(String url, String value) {}
+
+    public void changeUrlInBrowser(String url) {}
+
+    public void closeBrowser() {}
+
+    public boolean isAppForegrounded() {
+        return true;
+    }
+
+    public String getOsVersion() {
+        return "14";
+    }
+
+    public String getDeviceManufacturer() {
+        return "Google";
+    }
+
+    public String getDeviceModel() {
+        return "Pixel 8 Pro";
+    }
+
+    public String getDeviceLocale() {
+        return "en-US";
+    }
+
+    public int getSdkVersion() {
+        return 34;
+    }
+
+    public int getScreenWidth() {
+        return 1344;
+    }
+
+    public int getScreenHeight() {
+        return 2992;
+    }
+
+    public float getScreenDensity() {
+        return 3.0f;
+    }
+
+    public int getScreenDpi() {
+        return 480;
+    }
+
+    public String getDeviceCpu() {
+        return "arm64-v8a";
+    }
+
+    public String getDeviceCodename() {
+        return "husky";
+    }
+
+    public String getBootloader() {
+        return "ripcurrent-14.0";
+    }
+
+    public String getRadio() {
+        return "g5300q-231106";
+    }
+
+    public String getBuildTime() {
+        return "1700000000000";
+    }
+
+    public String getBrowserCookiesForCurrentUrl() {
+        return "{\"session\":\"abc123\"}";
+    }
+
+    /** Null for unknown domains, like the activity when no browser is open. */
+    public String getBrowserCookiesForDomain(String domain) {
+        return domain.isEmpty() ? null : "{}";
+    }
+
+    public String evalJs(String js, long timeoutMs) {
+        return "{\"result\":\"ok\"}";
+    }
+}
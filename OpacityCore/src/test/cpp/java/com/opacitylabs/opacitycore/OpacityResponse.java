@@ -0,0 +1,14 @@
+package com.opacitylabs.opacitycore;
+
+/** Test double for the Kotlin OpacityResponse data class built by getNative. */
+public final class OpacityResponse {
+    public final int status;
+    public final String data;
+    public final String err;
+
+    public OpacityResponse(int status, String data, String err) {
+        this.status = status;
+        this.data = data;
+        this.err = err;
+    }
+}
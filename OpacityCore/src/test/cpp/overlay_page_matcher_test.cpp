@@ -0,0 +1,90 @@
+// Checks the overlay pages schema, URL matching and the origin rules derived
+// for document-start injection.
+
+#include "OverlayPageMatcher.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace opacity_bridge;
+
+namespace {
+
+int failures = 0;
+
+void expect(bool condition, const char *what) {
+  if (!condition) {
+    fprintf(stderr, "FAIL: %s\n", what);
+    failures++;
+  }
+}
+
+std::string match(const char *url) {
+  std::string pageId;
+  return matchOverlayPage(url, pageId) ? pageId : "";
+}
+
+std::string origins() {
+  std::string joined;
+  for (const std::string &origin : overlayPageOrigins()) {
+    joined.append(joined.empty() ? "" : " ");
+    joined.append(origin);
+  }
+  return joined;
+}
+
+} // namespace
+
+int main() {
+  expect(loadOverlayPages(R"({"pages":[
+           {"id":"login","url_patterns":["https://*.bank.com/login*"]},
+           {"id":"summary","url_patterns":["bank.com/accounts/?"]},
+           {"id":"home","url_patterns":["www.shop.com"]}]})") == 3,
+         "well-formed definition loads");
+  expect(match("https://auth.bank.com/login?next=1") == "login",
+         "wildcard subdomain and path");
+  expect(match("http://auth.bank.com/login").empty(), "scheme is matched");
+  expect(match("https://evil.com/x.bank.com/login").empty(),
+         "host wildcard does not reach into the path");
+  expect(match("http://bank.com/accounts/7") == "summary",
+         "pattern without scheme matches any scheme");
+  expect(match("https://bank.com/accounts/77").empty(), "'?' is one char");
+  expect(match("https://www.shop.com/cart#top") == "home",
+         "pattern without path matches every page of its host");
+  expect(match("https://shop.com/").empty(), "host is matched whole");
+  expect(origins() == "http://bank.com http://www.shop.com https://*.bank.com "
+                      "https://bank.com https://www.shop.com",
+         "origins cover each pattern's scheme and host");
+
+  expect(loadOverlayPages(R"({"pages":[{"id":"a","url_patterns":["*"]}]})") ==
+             1,
+         "catch-all pattern loads");
+  expect(match("https://anything.example/") == "a", "catch-all matches");
+  expect(origins() == "*", "open host falls back to every origin");
+  expect(loadOverlayPages(
+             R"({"pages":[{"id":"a","url_patterns":["https://bank*.com/"]}]})") ==
+             1 &&
+             origins() == "*",
+         "wildcard inside a host falls back to every origin");
+
+  const char *malformed[] = {
+      R"([{"id":"a","url_patterns":["x.com"]}])",
+      R"({"a":{"url_patterns":["x.com"]}})",
+      R"({"pages":[{"name":"a","url_patterns":["x.com"]}]})",
+      R"({"pages":[{"id":"a","url":"x.com"}]})",
+      R"({"pages":[{"id":"a","url_patterns":"x.com"}]})",
+      R"({"pages":[{"id":"a","url_patterns":["x.com",""]}]})",
+      "not json",
+  };
+  for (const char *json : malformed) {
+    expect(loadOverlayPages(json) == -1, json);
+    expect(match("https://x.com/").empty() && origins().empty(),
+           "malformed definition drops the previous one");
+  }
+
+  if (failures == 0) {
+    printf("overlay page matcher: ok\n");
+  }
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,220 @@
+// Drives RequestScheduler and the coalescer with simulated flows (a sleep in
+// place of opacity_get) and checks the two admission claims:
+//
+// - interactive p99 stays close to its unloaded value while background
+//   callers keep every background slot busy, and an unreserved scheduler
+//   is shown for comparison
+// - an interactive caller that joins a coalesced execution still queued in
+//   the background class gets it admitted as interactive instead of
+//   waiting for a background slot
+//
+// Usage: scheduler_bench [--seconds=N] [--max-p99-ratio=N]
+
+#include "Json.h"
+#include "RequestCoalescer.h"
+#include "RequestScheduler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace opacity_bridge;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+constexpr auto kInteractiveRun = std::chrono::milliseconds(2);
+constexpr auto kBackgroundRun = std::chrono::milliseconds(15);
+constexpr int kInteractiveClients = 2;
+constexpr int kBackgroundClients = 12;
+constexpr auto kLongRun = std::chrono::milliseconds(400);
+
+std::atomic<uint64_t> nextKey{0};
+
+// One flow through the same path getNative takes. Returns the caller's
+// end-to-end latency in microseconds, or -1 when rejected.
+double runFlow(const std::string &name, RequestPriority priority,
+               Clock::duration runTime) {
+  auto start = Clock::now();
+  FlowResult result = runCoalesced(
+      name.c_str(), nullptr, priority, [&](AdmissionPriority &admission) {
+        AdmissionTicket ticket = admitRequest(admission);
+        if (!ticket.admitted()) {
+          return FlowResult{2, "overloaded"};
+        }
+        std::this_thread::sleep_for(runTime);
+        return FlowResult{0, "{}"};
+      });
+  if (result.status != 0) {
+    return -1;
+  }
+  return std::chrono::duration<double, std::micro>(Clock::now() - start)
+      .count();
+}
+
+std::string uniqueName(const char *prefix) {
+  return prefix + std::to_string(nextKey.fetch_add(1));
+}
+
+double percentile(std::vector<double> samples, double p) {
+  if (samples.empty()) {
+    return 0;
+  }
+  std::sort(samples.begin(), samples.end());
+  size_t index = static_cast<size_t>(p / 100.0 * (samples.size() - 1));
+  return samples[index];
+}
+
+// Interactive latencies over `seconds`, with `background` clients looping
+// background flows alongside.
+std::vector<double> interactiveLatencies(int background, double seconds) {
+  std::atomic<bool> stopping{false};
+  std::vector<std::thread> threads;
+  for (int i = 0; i < background; i++) {
+    threads.emplace_back([&] {
+      while (!stopping.load(std::memory_order_relaxed)) {
+        if (runFlow(uniqueName("background-"), RequestPriority::Background,
+                    kBackgroundRun) < 0) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+      }
+    });
+  }
+  // Let the background queue fill before measuring.
+  std::this_thread::sleep_for(kBackgroundRun * 2);
+
+  std::vector<std::vector<double>> perClient(kInteractiveClients);
+  std::vector<std::thread> clients;
+  auto until = Clock::now() + std::chrono::duration<double>(seconds);
+  for (int i = 0; i < kInteractiveClients; i++) {
+    clients.emplace_back([&, i] {
+      while (Clock::now() < until) {
+        double micros = runFlow(uniqueName("interactive-"),
+                                RequestPriority::Interactive, kInteractiveRun);
+        if (micros >= 0) {
+          perClient[i].push_back(micros);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(3));
+      }
+    });
+  }
+  for (auto &client : clients) {
+    client.join();
+  }
+  stopping = true;
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  std::vector<double> all;
+  for (const auto &samples : perClient) {
+    all.insert(all.end(), samples.begin(), samples.end());
+  }
+  return all;
+}
+
+void printLatencies(const char *label, const std::vector<double> &samples) {
+  printf("%-28s n=%-6zu p50 %8.0f us   p99 %8.0f us\n", label, samples.size(),
+         percentile(samples, 50), percentile(samples, 99));
+}
+
+uint64_t raisedWhileQueued() {
+  JsonValue stats;
+  if (!parseJson(schedulerStatsJson(), stats)) {
+    return 0;
+  }
+  const JsonValue *raised = stats.find("raised_while_queued");
+  return raised == nullptr ? 0 : strtoull(raised->text.c_str(), nullptr, 10);
+}
+
+// Fills both background slots with long flows, queues a background flow
+// and has an interactive caller join it. Returns the joiner's latency in
+// microseconds.
+double joinQueuedBackground() {
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 2; i++) {
+    threads.emplace_back([] {
+      runFlow(uniqueName("long-"), RequestPriority::Background, kLongRun);
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  threads.emplace_back(
+      [] { runFlow("shared", RequestPriority::Background, kInteractiveRun); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  double joined =
+      runFlow("shared", RequestPriority::Interactive, kInteractiveRun);
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  return joined;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  double seconds = 2;
+  double maxP99Ratio = 3;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--seconds=", 10) == 0) {
+      seconds = atof(argv[i] + 10);
+    } else if (strncmp(argv[i], "--max-p99-ratio=", 16) == 0) {
+      maxP99Ratio = atof(argv[i] + 16);
+    } else {
+      fprintf(stderr, "usage: %s [--seconds=N] [--max-p99-ratio=N]\n",
+              argv[0]);
+      return 2;
+    }
+  }
+
+  int failures = 0;
+  SchedulerConfig config;
+  config.maxInFlight = 4;
+  config.maxBackgroundInFlight = 2;
+  config.maxQueued = 64;
+  configureScheduler(config);
+
+  std::vector<double> idle = interactiveLatencies(0, seconds);
+  std::vector<double> loaded =
+      interactiveLatencies(kBackgroundClients, seconds);
+
+  // Same load with background allowed to take every slot.
+  SchedulerConfig unreserved = config;
+  unreserved.maxBackgroundInFlight = unreserved.maxInFlight;
+  configureScheduler(unreserved);
+  std::vector<double> contended =
+      interactiveLatencies(kBackgroundClients, seconds);
+  configureScheduler(config);
+
+  printLatencies("interactive, idle", idle);
+  printLatencies("interactive, loaded", loaded);
+  printLatencies("interactive, unreserved", contended);
+  double idleP99 = percentile(idle, 99);
+  double loadedP99 = percentile(loaded, 99);
+  if (idle.empty() || loaded.empty() || loadedP99 > idleP99 * maxP99Ratio) {
+    fprintf(stderr, "interactive p99 under load %.0f us exceeds %.1fx idle\n",
+            loadedP99, maxP99Ratio);
+    failures++;
+  }
+
+  uint64_t raisedBefore = raisedWhileQueued();
+  double joined = joinQueuedBackground();
+  uint64_t raised = raisedWhileQueued() - raisedBefore;
+  printf("interactive join of queued background flow: %.0f us, raised %llu\n",
+         joined, static_cast<unsigned long long>(raised));
+  // Without the raise the shared flow waits ~300 ms more for a background
+  // slot.
+  if (joined < 0 || joined > 150000 || raised != 1) {
+    fprintf(stderr, "joined execution was not admitted as interactive\n");
+    failures++;
+  }
+
+  printf("%s\n", schedulerStatsJson().c_str());
+  return failures == 0 ? 0 : 1;
+}
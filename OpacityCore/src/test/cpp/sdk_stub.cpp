@@ -0,0 +1,169 @@
+// Stand-in for the prebuilt libsdk so the bridge links on a host. Flows run a
+// fixed sequence of upcalls, the way libsdk drives a real one, and succeed
+// with what those returned. Like libsdk, opacity_init picks up
+// OPACITY_BACKEND_URL; when set, flows also GET /flows/<name> from it (plain
+// http to an IPv4 address only) and fail if that doesn't answer 200.
+
+#include "sdk.h"
+#include "sdk_stub.h"
+#include "Json.h"
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace opacity_core {
+
+const int32_t OPACITY_OK = 0;
+const int32_t OPACITY_MISSING_POINTER = 1;
+const int32_t OPACITY_GENERIC_ERROR = 2;
+const int32_t OPACITY_NOT_SUPPORTED = 3;
+const int32_t OPACITY_INVALID_ENVIRONMENT = 4;
+const int32_t OPACITY_ENVIRONMENT_LOCAL = 0;
+const int32_t OPACITY_ENVIRONMENT_SANDBOX = 1;
+const int32_t OPACITY_ENVIRONMENT_STAGING = 2;
+const int32_t OPACITY_ENVIRONMENT_PRODUCTION = 3;
+
+namespace {
+
+std::atomic<uint64_t> webviewEvents{0};
+std::string backendUrl;
+
+char *copyString(const char *value) { return strdup(value); }
+
+// Appends an upcall's string result as a JSON member and frees it.
+void appendUpcallResult(std::string &out, const char *key, const char *value) {
+  out.append(",\"");
+  out.append(key);
+  out.append("\":");
+  if (value == nullptr) {
+    out.append("null");
+  } else {
+    opacity_bridge::appendJsonString(out, value);
+    free(const_cast<char *>(value));
+  }
+}
+
+bool fetchBackend(const std::string &path, std::string &body) {
+  const char *scheme = "http://";
+  if (backendUrl.compare(0, strlen(scheme), scheme) != 0) {
+    return false;
+  }
+  std::string hostPort = backendUrl.substr(strlen(scheme));
+  size_t colon = hostPort.find(':');
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(colon == std::string::npos
+                            ? 80
+                            : atoi(hostPort.c_str() + colon + 1));
+  if (inet_pton(AF_INET, hostPort.substr(0, colon).c_str(), &addr.sin_addr) !=
+      1) {
+    return false;
+  }
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return false;
+  }
+  if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+    close(fd);
+    return false;
+  }
+  std::string request = "GET " + path + " HTTP/1.0\r\n\r\n";
+  send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+  std::string response;
+  char buf[4096];
+  ssize_t n;
+  while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+    response.append(buf, static_cast<size_t>(n));
+  }
+  close(fd);
+
+  size_t headersEnd = response.find("\r\n\r\n");
+  if (response.compare(0, 13, "HTTP/1.0 200 ") != 0 ||
+      headersEnd == std::string::npos) {
+    return false;
+  }
+  body = response.substr(headersEnd + 4);
+  return true;
+}
+
+} // namespace
+
+int32_t opacity_init(const char *api_key_str, bool dry_run,
+                     int32_t backend_environment, bool show_errors_in_webview,
+                     char **error_ptr) {
+  if (api_key_str == nullptr || *api_key_str == '\0') {
+    *error_ptr = copyString("missing api key");
+    return OPACITY_GENERIC_ERROR;
+  }
+  const char *url = getenv("OPACITY_BACKEND_URL");
+  backendUrl = url != nullptr ? url : "";
+  return OPACITY_OK;
+}
+
+int32_t opacity_initialize_open_telemetry(const char *open_telemetry_endpoint,
+                                          const char *grafana_instance_id,
+                                          const char *grafana_api_token,
+                                          char **err_ptr) {
+  return OPACITY_OK;
+}
+
+int32_t opacity_get(const char *name, const char *params, char **res_ptr,
+                    char **err_ptr) {
+  std::string result = "{\"verified\":true";
+  appendUpcallResult(result, "os_version", android_get_os_version());
+  appendUpcallResult(result, "ip_address", get_ip_address());
+  free(const_cast<char *>(secure_get("session")));
+  free(const_cast<char *>(android_eval_js("document.title", 1.0)));
+  free(const_cast<char *>(android_get_browser_cookies_for_current_url()));
+  if (!backendUrl.empty()) {
+    std::string body;
+    if (!fetchBackend(std::string("/flows/") + name, body)) {
+      *err_ptr = copyString(
+          "{\"code\":\"BackendError\",\"description\":\"no answer\"}");
+      return OPACITY_GENERIC_ERROR;
+    }
+    result.append(",\"backend\":");
+    result.append(body);
+  }
+  result.push_back('}');
+  *res_ptr = copyString(result.c_str());
+  return OPACITY_OK;
+}
+
+void opacity_free_string(char *ptr) { free(ptr); }
+
+void emit_webview_event(const char *payload) {
+  webviewEvents.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool is_browser_overlay_enabled(void) { return false; }
+
+const char *get_browser_overlay_pages_json(void) { return nullptr; }
+
+const char *get_browser_overlay_observer_script(void) {
+  return copyString("");
+}
+
+const char *get_browser_overlay_bootstrap_script(void) {
+  return copyString("");
+}
+
+const char *get_browser_overlay_renderer_script(void) {
+  return copyString("");
+}
+
+bool is_browser_debug_logs_enabled(void) { return false; }
+
+const char *get_api_version(void) { return "host-stub"; }
+
+} // namespace opacity_core
+
+uint64_t opacity_bridge_test::sdkStubWebviewEvents() {
+  return opacity_core::webviewEvents.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstdint>
+
+namespace opacity_bridge_test {
+
+// Payloads sdk_stub.cpp's emit_webview_event has received.
+uint64_t sdkStubWebviewEvents();
+
+} // namespace opacity_bridge_test
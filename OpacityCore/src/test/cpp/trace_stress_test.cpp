@@ -0,0 +1,143 @@
+// Dumps the trace repeatedly while several threads keep overwriting their
+// rings, and checks that every dumped event is one a thread actually wrote:
+// its name, start and duration all carry the same counter, so a torn read
+// shows up as a mismatch. Also checks that buffers of exited threads are
+// taken over by new ones, and that clearTrace drops earlier events without
+// resetting the writers.
+
+#include "Json.h"
+#include "TraceRecorder.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using opacity_bridge::JsonValue;
+
+namespace {
+
+constexpr int kWriters = 4;
+constexpr int kDumps = 40;
+
+std::atomic<bool> stopping{false};
+
+void writer(int index) {
+  char name[64];
+  for (uint64_t n = 1; !stopping.load(std::memory_order_relaxed); n++) {
+    int length = snprintf(name, sizeof(name), "w%d-%llu", index,
+                          static_cast<unsigned long long>(n));
+    // ts is in microseconds in the dump.
+    opacity_bridge::traceComplete("test", name, length, n * 1000,
+                                  n * 1000 + n * 3000);
+  }
+}
+
+bool loadDump(const char *path, JsonValue &out) {
+  std::ifstream file(path);
+  std::stringstream text;
+  text << file.rdbuf();
+  return opacity_bridge::parseJson(text.str(), out);
+}
+
+// Returns the number of bad events, or -1 if the dump doesn't parse.
+int checkDump(const char *path, size_t &events) {
+  JsonValue dump;
+  if (!loadDump(path, dump)) {
+    return -1;
+  }
+  const JsonValue *list = dump.find("traceEvents");
+  if (list == nullptr) {
+    return -1;
+  }
+  int bad = 0;
+  events = list->items.size();
+  for (const JsonValue &event : list->items) {
+    const JsonValue *name = event.find("name");
+    const JsonValue *ts = event.find("ts");
+    const JsonValue *dur = event.find("dur");
+    if (name == nullptr || ts == nullptr || dur == nullptr) {
+      bad++;
+      continue;
+    }
+    size_t dash = name->text.find('-');
+    uint64_t counter = dash == std::string::npos
+                           ? 0
+                           : strtoull(name->text.c_str() + dash + 1, nullptr, 10);
+    auto start = static_cast<uint64_t>(strtod(ts->text.c_str(), nullptr));
+    auto duration = static_cast<uint64_t>(strtod(dur->text.c_str(), nullptr));
+    if (counter == 0 || start != counter || duration != counter * 3) {
+      fprintf(stderr, "bad event %s ts=%s dur=%s\n", name->text.c_str(),
+              ts->text.c_str(), dur->text.c_str());
+      bad++;
+    }
+  }
+  return bad;
+}
+
+} // namespace
+
+int main() {
+  char path[] = "/tmp/trace_stress_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    return 1;
+  }
+  close(fd);
+
+  opacity_bridge::setTracingEnabled(true);
+  std::vector<std::thread> writers;
+  for (int i = 0; i < kWriters; i++) {
+    writers.emplace_back(writer, i);
+  }
+
+  int failures = 0;
+  size_t events = 0;
+  for (int i = 0; i < kDumps; i++) {
+    if (!opacity_bridge::dumpTrace(path) ||
+        checkDump(path, events) != 0) {
+      failures++;
+    }
+  }
+
+  stopping.store(true);
+  for (auto &thread : writers) {
+    thread.join();
+  }
+
+  // Each new thread takes over an exited writer's buffer, dropping its
+  // events, instead of adding a buffer of its own.
+  for (int i = 0; i < kWriters; i++) {
+    std::thread([] {
+      opacity_bridge::traceComplete("test", "w8-1", 4, 1000, 4000);
+    }).join();
+  }
+  if (!opacity_bridge::dumpTrace(path) || checkDump(path, events) != 0 ||
+      events != kWriters) {
+    fprintf(stderr, "%zu events after writers were replaced\n", events);
+    failures++;
+  }
+
+  // Everything written before the clear must be gone, later events kept.
+  opacity_bridge::clearTrace();
+  opacity_bridge::traceComplete("test", "w9-1", 4, 1000, 4000);
+  if (!opacity_bridge::dumpTrace(path) || checkDump(path, events) != 0 ||
+      events != 1) {
+    fprintf(stderr, "clearTrace kept %zu events\n", events);
+    failures++;
+  }
+  unlink(path);
+
+  if (failures > 0) {
+    fprintf(stderr, "%d of %d dumps had torn or stale events\n", failures,
+            kDumps + 2);
+    return 1;
+  }
+  printf("%d dumps under %d writers, no torn events\n", kDumps, kWriters);
+  return 0;
+}
@@ -0,0 +1,155 @@
+// Compares the two ways a webview event reaches libsdk:
+//
+//   json      the baseline path: the event serialized to JSON, copied out of
+//             the Java string and parsed by libsdk.
+//   frame     the binary frame written by WebviewEventFrame.kt, decoded by
+//             the bridge and rendered back to JSON for emit_webview_event.
+//   frame_v2  the binary frame handed to emit_webview_event_v2 as is.
+//
+// Only the native side is measured; the Kotlin JSONObject and frame writers
+// need a device. Every event is also round-tripped through the frame and
+// compared with its source JSON, which fails the run on any difference.
+//
+// Usage: webview_event_bench [recording.jsonl] [passes]
+
+#include "Json.h"
+#include "SessionRecording.h"
+#include "WebviewEventFrame.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace opacity_bridge;
+using opacity_bridge_test::RecordedEvent;
+
+namespace {
+
+WebviewEvent borrow(const RecordedEvent &event) {
+  WebviewEvent view{event.kind, {}};
+  for (const auto &[tag, value] : event.fields) {
+    view.fields.push_back({tag, value});
+  }
+  return view;
+}
+
+std::string canonical(const std::string &json) {
+  JsonValue value;
+  std::string out;
+  if (parseJson(json, value)) {
+    appendCanonicalJson(out, value);
+  }
+  return out;
+}
+
+struct PathResult {
+  const char *name;
+  double nanosPerEvent;
+  double bytesPerEvent;
+};
+
+template <typename Body>
+PathResult measure(const char *name, const std::vector<RecordedEvent> &events,
+                   int passes, Body &&body) {
+  size_t bytes = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int pass = 0; pass < passes; pass++) {
+    for (const auto &event : events) {
+      bytes += body(event);
+    }
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+  double count = static_cast<double>(events.size()) * passes;
+  return {name, elapsed / count, bytes / count};
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  std::vector<std::string> payloads;
+  if (argc > 1) {
+    if (!opacity_bridge_test::loadRecordedEvents(argv[1], payloads)) {
+      fprintf(stderr, "no events in %s\n", argv[1]);
+      return 1;
+    }
+  } else {
+    payloads = opacity_bridge_test::syntheticSession(40);
+  }
+  int passes = argc > 2 ? atoi(argv[2]) : 20;
+
+  std::vector<RecordedEvent> events;
+  for (const auto &payload : payloads) {
+    RecordedEvent event;
+    if (opacity_bridge_test::parseRecordedEvent(payload, event)) {
+      events.push_back(std::move(event));
+    }
+  }
+  if (events.empty()) {
+    fprintf(stderr, "no usable events\n");
+    return 1;
+  }
+
+  int mismatches = 0;
+  std::string frame;
+  for (const auto &event : events) {
+    opacity_bridge_test::encodeRecordedEvent(event, frame);
+    WebviewEvent decoded;
+    if (!decodeWebviewEventFrame(
+            reinterpret_cast<const uint8_t *>(frame.data()), frame.size(),
+            decoded) ||
+        canonical(webviewEventToJson(decoded)) != canonical(event.json)) {
+      fprintf(stderr, "round trip mismatch: %.200s\n", event.json.c_str());
+      mismatches++;
+    }
+  }
+
+  PathResult results[] = {
+      measure("json", events, passes,
+              [](const RecordedEvent &event) {
+                std::string json = webviewEventToJson(borrow(event));
+                // GetStringUTFChars hands libsdk its own copy.
+                std::string copy(json);
+                JsonValue parsed;
+                parseJson(copy, parsed);
+                return copy.size();
+              }),
+      measure("frame", events, passes,
+              [&frame](const RecordedEvent &event) {
+                opacity_bridge_test::encodeRecordedEvent(event, frame);
+                WebviewEvent decoded;
+                decodeWebviewEventFrame(
+                    reinterpret_cast<const uint8_t *>(frame.data()),
+                    frame.size(), decoded);
+                std::string json = webviewEventToJson(decoded);
+                JsonValue parsed;
+                parseJson(json, parsed);
+                return frame.size();
+              }),
+      measure("frame_v2", events, passes,
+              [&frame](const RecordedEvent &event) {
+                opacity_bridge_test::encodeRecordedEvent(event, frame);
+                WebviewEvent decoded;
+                decodeWebviewEventFrame(
+                    reinterpret_cast<const uint8_t *>(frame.data()),
+                    frame.size(), decoded);
+                return frame.size();
+              }),
+  };
+
+  printf("%zu events x %d passes\n", events.size(), passes);
+  printf("%-10s %14s %14s\n", "path", "ns/event", "bytes/event");
+  for (const auto &result : results) {
+    printf("%-10s %14.0f %14.0f\n", result.name, result.nanosPerEvent,
+           result.bytesPerEvent);
+  }
+  if (mismatches > 0) {
+    fprintf(stderr, "%d events did not survive the frame round trip\n",
+            mismatches);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,149 @@
+package com.opacitylabs.opacitycore
+
+import android.content.MutableContextWrapper
+import android.net.Uri
+import android.os.Looper
+import android.webkit.WebResourceRequest
+import android.webkit.WebView
+import org.junit.After
+import org.junit.Assert.assertEquals
+import org.junit.Assert.assertFalse
+import org.junit.Assert.assertNull
+import org.junit.Assert.assertTrue
+import org.junit.Before
+import org.junit.Test
+import org.junit.runner.RunWith
+import org.robolectric.RobolectricTestRunner
+import org.robolectric.RuntimeEnvironment
+import org.robolectric.Shadows.shadowOf
+
+/**
+ * Prepare-to-first-paint measurement and PRELOAD navigation handling, with the native
+ * library replaced by a recording reporter and a fake clock.
+ */
+@RunWith(RobolectricTestRunner::class)
+class WebViewPrewarmerTest {
+    private data class FirstPaint(val startNanos: Long, val endNanos: Long, val warm: Boolean)
+
+    private var now = 0L
+    private val reported = mutableListOf<FirstPaint>()
+    private val originalClock = WebViewPrewarmer.nanoClock
+    private val originalReporter = WebViewPrewarmer.firstPaintReporter
+
+    @Before
+    fun setUp() {
+        WebViewPrewarmer.mode = OpacityCore.WarmUp.OFF
+        WebViewPrewarmer.nanoClock = { now }
+        WebViewPrewarmer.firstPaintReporter = { start, end, warm ->
+            reported.add(FirstPaint(start, end, warm))
+        }
+    }
+
+    @After
+    fun tearDown() {
+        WebViewPrewarmer.prewarmed = null
+        WebViewPrewarmer.nanoClock = originalClock
+        WebViewPrewarmer.firstPaintReporter = originalReporter
+    }
+
+    @Test
+    fun firstPaintIsMeasuredFromPrepare() {
+        prepare(atNanos = 1_000)
+        now = 251_000
+        WebViewPrewarmer.markFirstPaint(warm = false)
+
+        assertEquals(listOf(FirstPaint(1_000, 251_000, false)), reported)
+    }
+
+    @Test
+    fun laterPaintsOfTheSameFlowAreIgnored() {
+        prepare(atNanos = 1_000)
+        now = 5_000
+        WebViewPrewarmer.markFirstPaint(warm = true)
+        now = 9_000
+        WebViewPrewarmer.markFirstPaint(warm = true)
+
+        assertEquals(listOf(FirstPaint(1_000, 5_000, true)), reported)
+    }
+
+    @Test
+    fun eachPrepareStartsANewMeasurement() {
+        prepare(atNanos = 1_000)
+        now = 2_000
+        WebViewPrewarmer.markFirstPaint(warm = false)
+        prepare(atNanos = 10_000)
+        now = 10_500
+        WebViewPrewarmer.markFirstPaint(warm = true)
+
+        assertEquals(
+            listOf(FirstPaint(1_000, 2_000, false), FirstPaint(10_000, 10_500, true)),
+            reported
+        )
+    }
+
+    @Test
+    fun appSchemeRedirectsArePassedOnForAdoption() {
+        val warm = WebViewPrewarmer.Prewarmed(
+            WebView(RuntimeEnvironment.getApplication()),
+            WebViewPrewarmer.OpacityJsBridgeProxy(),
+            overlayScriptsInstalledAtDocumentStart = false,
+            loadedPreconnectPage = false
+        )
+        val client = WebViewPrewarmer.PrewarmClient(warm)
+
+        assertFalse(client.shouldOverrideUrlLoading(warm.webView, request("https://auth.example.com/cb")))
+        assertTrue(client.shouldOverrideUrlLoading(warm.webView, request("uberlogin://done?code=1")))
+
+        assertEquals(listOf("https://auth.example.com/cb"), warm.visitedUrls)
+        assertEquals(listOf("uberlogin://done?code=1"), warm.handedOffUrls)
+    }
+
+    @Test
+    fun preloadCallbacksBeforeAdoptionAreReplayedWithAWarmFirstPaint() {
+        prepare(atNanos = 1_000)
+        val url = "https://example.com/login"
+        val warm = WebViewPrewarmer.Prewarmed(
+            WebView(MutableContextWrapper(RuntimeEnvironment.getApplication())),
+            WebViewPrewarmer.OpacityJsBridgeProxy(),
+            overlayScriptsInstalledAtDocumentStart = false,
+            loadedPreconnectPage = true
+        )
+        warm.preloadedUrl = url
+        WebViewPrewarmer.prewarmed = warm
+        val client = WebViewPrewarmer.PrewarmClient(warm)
+        client.onPageStarted(warm.webView, "data:text/html,preconnect", null)
+        client.onPageStarted(warm.webView, url, null)
+        client.onPageCommitVisible(warm.webView, url)
+        client.onPageFinished(warm.webView, url)
+
+        now = 40_000
+        val adopted = WebViewPrewarmer.adopt(RuntimeEnvironment.getApplication())
+        val replayed = mutableListOf<String>()
+        adopted!!.replayPreload(
+            visited = { replayed.add("visited $it") },
+            pageStarted = { replayed.add("started $it") },
+            pageFinished = { replayed.add("finished $it") },
+            handedOff = { replayed.add("handed off $it") }
+        )
+        shadowOf(Looper.getMainLooper()).idle()
+
+        assertEquals(listOf("visited $url", "started $url", "finished $url"), replayed)
+        assertEquals(listOf(FirstPaint(1_000, 40_000, true)), reported)
+        assertNull(WebViewPrewarmer.adopt(RuntimeEnvironment.getApplication()))
+    }
+
+    private fun prepare(atNanos: Long) {
+        now = atNanos
+        WebViewPrewarmer.onPrepare(RuntimeEnvironment.getApplication(), "https://example.com/login")
+        shadowOf(Looper.getMainLooper()).idle()
+    }
+
+    private fun request(url: String) = object : WebResourceRequest {
+        override fun getUrl(): Uri = Uri.parse(url)
+        override fun isForMainFrame() = true
+        override fun isRedirect() = true
+        override fun hasGesture() = false
+        override fun getMethod() = "GET"
+        override fun getRequestHeaders(): Map<String, String> = emptyMap()
+    }
+}
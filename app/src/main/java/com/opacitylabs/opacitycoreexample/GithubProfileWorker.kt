@@ -16,7 +16,7 @@ class GitHubProfileWorker(
         Log.d(TAG, "🚀 Background task started at $startTime")
 
         return try {
-            OpacityCore.get("github:profile", null)
+            OpacityCore.get("github:profile", null, OpacityCore.Priority.BACKGROUND)
             
             val endTime = System.currentTimeMillis()
             val duration = (endTime - startTime) / 1000.0